@@ -114,6 +114,22 @@ long numops(network *net)
     return ops;
 }
 
+void epilogue(char *cfgfile, int iter)
+{
+    gpu_index = -1;
+    network *net = parse_network_cfg(cfgfile);
+    set_batch_network(net, 1);
+    benchmark_convolutional_epilogue(net, iter);
+}
+
+void xnor(char *cfgfile, int iter)
+{
+    gpu_index = -1;
+    network *net = parse_network_cfg(cfgfile);
+    set_batch_network(net, 1);
+    benchmark_convolutional_xnor(net, iter);
+}
+
 void speed(char *cfgfile, int tics)
 {
     if (tics == 0) tics = 1000;
@@ -223,6 +239,14 @@ void rescale_net(char *cfgfile, char *weightfile, char *outfile)
     save_weights(net, outfile);
 }
 
+void map_weights_net(char *cfgfile, char *weightfile, char *outfile)
+{
+    gpu_index = -1;
+    network *net = load_network_inference(cfgfile, weightfile);
+    save_weights_mapped(net, outfile);
+    free_network(net);
+}
+
 void rgbgr_net(char *cfgfile, char *weightfile, char *outfile)
 {
     gpu_index = -1;
@@ -366,6 +390,20 @@ void denormalize_net(char *cfgfile, char *weightfile, char *outfile)
     save_weights(net, outfile);
 }
 
+void fold_batchnorm_net(char *cfgfile, char *weightfile, char *outfile)
+{
+    gpu_index = -1;
+    network *net = load_network(cfgfile, weightfile, 0);
+    fold_batchnorm_network(net);
+    int i;
+    // Folded layers keep identity batch norm params so the original cfg still loads the file
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type == CONVOLUTIONAL && l.rolling_mean) net->layers[i].batch_normalize = 1;
+    }
+    save_weights(net, outfile);
+}
+
 void mkimg(char *cfgfile, char *weightfile, int h, int w, int num, char *prefix)
 {
     network *net = load_network(cfgfile, weightfile, 0);
@@ -475,16 +513,30 @@ int main(int argc, char **argv)
         reset_normalize_net(argv[2], argv[3], argv[4]);
     } else if (0 == strcmp(argv[1], "denormalize")){
         denormalize_net(argv[2], argv[3], argv[4]);
+    } else if (0 == strcmp(argv[1], "fold")){
+        fold_batchnorm_net(argv[2], argv[3], argv[4]);
     } else if (0 == strcmp(argv[1], "statistics")){
         statistics_net(argv[2], argv[3]);
     } else if (0 == strcmp(argv[1], "normalize")){
         normalize_net(argv[2], argv[3], argv[4]);
     } else if (0 == strcmp(argv[1], "rescale")){
         rescale_net(argv[2], argv[3], argv[4]);
+    } else if (0 == strcmp(argv[1], "mapweights")){
+        map_weights_net(argv[2], argv[3], argv[4]);
     } else if (0 == strcmp(argv[1], "ops")){
         operations(argv[2]);
     } else if (0 == strcmp(argv[1], "speed")){
         speed(argv[2], (argc > 3 && argv[3]) ? atoi(argv[3]) : 0);
+    } else if (0 == strcmp(argv[1], "gemm")){
+        benchmark_gemm_cpu((argc > 2) ? atoi(argv[2]) : 0);
+    } else if (0 == strcmp(argv[1], "nms")){
+        benchmark_nms((argc > 2) ? atoi(argv[2]) : 0);
+    } else if (0 == strcmp(argv[1], "letterbox")){
+        benchmark_letterbox((argc > 2) ? atoi(argv[2]) : 0);
+    } else if (0 == strcmp(argv[1], "epilogue")){
+        epilogue(argv[2], (argc > 3) ? atoi(argv[3]) : 0);
+    } else if (0 == strcmp(argv[1], "xnor")){
+        xnor(argv[2], (argc > 3) ? atoi(argv[3]) : 0);
     } else if (0 == strcmp(argv[1], "oneoff")){
         oneoff(argv[2], argv[3], argv[4]);
     } else if (0 == strcmp(argv[1], "oneoff2")){
@@ -501,6 +553,8 @@ int main(int argc, char **argv)
         mkimg(argv[2], argv[3], atoi(argv[4]), atoi(argv[5]), atoi(argv[6]), argv[7]);
     } else if (0 == strcmp(argv[1], "imtest")){
         test_resize(argv[2]);
+    } else if (0 == strcmp(argv[1], "yolotest")){
+        test_yolo_layer();
     } else {
         fprintf(stderr, "Not an option: %s\n", argv[1]);
     }
@@ -1,5 +1,7 @@
 #include "darknet.h"
 
+static char *int8_calibration = 0;
+
 static int coco_ids[] = {1,2,3,4,5,6,7,8,9,10,11,13,14,15,16,17,18,19,20,21,22,23,24,25,27,28,31,32,33,34,35,36,37,38,39,40,41,42,43,44,46,47,48,49,50,51,52,53,54,55,56,57,58,59,60,61,62,63,64,65,67,70,72,73,74,75,76,77,78,79,80,81,82,84,85,86,87,88,89,90};
 
 
@@ -244,7 +246,9 @@ void validate_detector_flip(char *datacfg, char *cfgfile, char *weightfile, char
     if (mapf) map = read_map(mapf);
 
     network *net = load_network(cfgfile, weightfile, 0);
+    if(int8_calibration) quantize_network(net, int8_calibration);
     set_batch_network(net, 2);
+    plan_network_memory(net);
     fprintf(stderr, "Learning Rate: %g, Momentum: %g, Decay: %g\n", net->learning_rate, net->momentum, net->decay);
     srand(time(0));
 
@@ -331,6 +335,7 @@ void validate_detector_flip(char *datacfg, char *cfgfile, char *weightfile, char
             copy_cpu(net->w*net->h*net->c, val_resized[t].data, 1, input.data + net->w*net->h*net->c, 1);
 
             network_predict(net, input.data);
+            avg_flipped_network(net);
             int w = val[t].w;
             int h = val[t].h;
             int num = 0;
@@ -374,7 +379,9 @@ void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *out
     if (mapf) map = read_map(mapf);
 
     network *net = load_network(cfgfile, weightfile, 0);
+    if(int8_calibration) quantize_network(net, int8_calibration);
     set_batch_network(net, 1);
+    plan_network_memory(net);
     fprintf(stderr, "Learning Rate: %g, Momentum: %g, Decay: %g\n", net->learning_rate, net->momentum, net->decay);
     srand(time(0));
 
@@ -489,7 +496,9 @@ void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *out
 void validate_detector_recall(char *cfgfile, char *weightfile)
 {
     network *net = load_network(cfgfile, weightfile, 0);
+    if(int8_calibration) quantize_network(net, int8_calibration);
     set_batch_network(net, 1);
+    plan_network_memory(net);
     fprintf(stderr, "Learning Rate: %g, Momentum: %g, Decay: %g\n", net->learning_rate, net->momentum, net->decay);
     srand(time(0));
 
@@ -567,12 +576,16 @@ void test_detector(char *datacfg, char *cfgfile, char *weightfile, char *filenam
 
     image **alphabet = load_alphabet();
     network *net = load_network(cfgfile, weightfile, 0);
+    if(int8_calibration) quantize_network(net, int8_calibration);
     set_batch_network(net, 1);
+    plan_network_memory(net);
     srand(2222222);
     double time;
     char buff[256];
     char *input = buff;
-    float nms=.45;
+    detection_params params = net->detection;
+    default_detection_params(&params, .45, 1);
+    params.thresh = thresh;
     while(1){
         if(filename){
             strncpy(input, filename, 256);
@@ -599,8 +612,7 @@ void test_detector(char *datacfg, char *cfgfile, char *weightfile, char *filenam
         int nboxes = 0;
         detection *dets = get_network_boxes(net, im.w, im.h, thresh, hier_thresh, 0, 1, &nboxes);
         //printf("%d\n", nboxes);
-        //if (nms) do_nms_obj(boxes, probs, l.w*l.h*l.n, l.classes, nms);
-        if (nms) do_nms_sort(dets, nboxes, l.classes, nms);
+        postprocess_detections(dets, nboxes, l.classes, params);
         draw_detections(im, dets, nboxes, thresh, names, alphabet, l.classes);
         free_detections(dets, nboxes);
         if(outfile){
@@ -789,6 +801,86 @@ void network_detect(network *net, image im, float thresh, float hier_thresh, flo
 }
 */
 
+void calibrate_detector(char *datacfg, char *cfgfile, char *weightfile, char *outfile, int n)
+{
+    list *options = read_data_cfg(datacfg);
+    char *valid_images = option_find_str(options, "valid", "data/train.list");
+    network *net = load_network(cfgfile, weightfile, 0);
+    set_batch_network(net, 1);
+
+    list *plist = get_paths(valid_images);
+    char **paths = (char **)list_to_array(plist);
+    if(n > plist->size) n = plist->size;
+
+    int i, j, k;
+    float *maxes = calloc(net->n, sizeof(float));
+    for(i = 0; i < n; ++i){
+        image im = load_image_color(paths[i], 0, 0);
+        image sized = letterbox_image(im, net->w, net->h);
+        calibrate_network(net, sized.data, maxes);
+        free_image(im);
+        free_image(sized);
+    }
+    char buff[256];
+    if(!outfile){
+        sprintf(buff, "%s.calib", basecfg(cfgfile));
+        outfile = buff;
+    }
+    save_calibration(net, maxes, n, outfile);
+    fprintf(stderr, "Saved calibration over %d images to %s\n", n, outfile);
+    free(maxes);
+
+    // Quick check of the int8 net against the float one on the same images,
+    // run valid with -int8 for the full mAP comparison
+    network *qnet = load_network(cfgfile, weightfile, 0);
+    set_batch_network(qnet, 1);
+    quantize_network(qnet, outfile);
+    layer l = net->layers[net->n-1];
+    float thresh = .25;
+    float nms = .45;
+    int total = 0;
+    int matched = 0;
+    float avg_iou = 0;
+    double float_time = 0;
+    double int8_time = 0;
+    for(i = 0; i < n; ++i){
+        image im = load_image_color(paths[i], 0, 0);
+        image sized = letterbox_image(im, net->w, net->h);
+        double time = what_time_is_it_now();
+        network_predict(net, sized.data);
+        float_time += what_time_is_it_now() - time;
+        time = what_time_is_it_now();
+        network_predict(qnet, sized.data);
+        int8_time += what_time_is_it_now() - time;
+
+        int nf = 0, nq = 0;
+        detection *fd = get_network_boxes(net, im.w, im.h, thresh, .5, 0, 1, &nf);
+        detection *qd = get_network_boxes(qnet, im.w, im.h, thresh, .5, 0, 1, &nq);
+        do_nms_sort(fd, nf, l.classes, nms);
+        do_nms_sort(qd, nq, l.classes, nms);
+        for(j = 0; j < nf; ++j){
+            int class = max_index(fd[j].prob, l.classes);
+            if(fd[j].prob[class] < thresh) continue;
+            float best_iou = 0;
+            for(k = 0; k < nq; ++k){
+                if(qd[k].prob[class] < thresh) continue;
+                float iou = box_iou(fd[j].bbox, qd[k].bbox);
+                if(iou > best_iou) best_iou = iou;
+            }
+            ++total;
+            avg_iou += best_iou;
+            if(best_iou > .5) ++matched;
+        }
+        free_detections(fd, nf);
+        free_detections(qd, nq);
+        free_image(im);
+        free_image(sized);
+    }
+    fprintf(stderr, "int8 vs float: %d/%d detections matched (%.2f%%), avg IOU %.2f%%, %.1f ms -> %.1f ms per image\n",
+            matched, total, total ? 100.*matched/total : 100., total ? 100.*avg_iou/total : 100.,
+            n ? 1000*float_time/n : 0, n ? 1000*int8_time/n : 0);
+}
+
 void run_detector(int argc, char **argv)
 {
     char *prefix = find_char_arg(argc, argv, "-prefix", 0);
@@ -803,6 +895,8 @@ void run_detector(int argc, char **argv)
     }
     char *gpu_list = find_char_arg(argc, argv, "-gpus", 0);
     char *outfile = find_char_arg(argc, argv, "-out", 0);
+    int calib_images = find_int_arg(argc, argv, "-images", 100);
+    int8_calibration = find_char_arg(argc, argv, "-int8", 0);
     int *gpus = 0;
     int gpu = 0;
     int ngpus = 0;
@@ -841,6 +935,7 @@ void run_detector(int argc, char **argv)
     else if(0==strcmp(argv[2], "valid")) validate_detector(datacfg, cfg, weights, outfile);
     else if(0==strcmp(argv[2], "valid2")) validate_detector_flip(datacfg, cfg, weights, outfile);
     else if(0==strcmp(argv[2], "recall")) validate_detector_recall(cfg, weights);
+    else if(0==strcmp(argv[2], "calibrate")) calibrate_detector(datacfg, cfg, weights, outfile, calib_images);
     else if(0==strcmp(argv[2], "demo")) {
         list *options = read_data_cfg(datacfg);
         int classes = option_find_int(options, "classes", 20);
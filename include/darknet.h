@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
+#include <stdint.h>
 
 #define SECRET_NUM -1234
 extern int gpu_index;
@@ -61,6 +62,14 @@ typedef enum{
     MULT, ADD, SUB, DIV
 } BINARY_ACTIVATION;
 
+typedef enum{
+    FP32, FP16, BF16
+} PRECISION;
+
+typedef enum{
+    GREEDY_NMS, LINEAR_SOFT_NMS, GAUSSIAN_SOFT_NMS
+} NMS_KIND;
+
 typedef enum {
     CONVOLUTIONAL,
     DECONVOLUTIONAL,
@@ -113,6 +122,9 @@ typedef struct{
 struct network;
 typedef struct network network;
 
+struct thread_pool;
+typedef struct thread_pool thread_pool;
+
 struct layer;
 typedef struct layer layer;
 
@@ -154,6 +166,8 @@ struct layer{
     int index;
     int binary;
     int xnor;
+    int implicit_gemm;
+    int winograd;
     int steps;
     int hidden;
     int truth;
@@ -181,6 +195,7 @@ struct layer{
     int tanh;
     int *mask;
     int total;
+    int top_classes;
 
     float alpha;
     float beta;
@@ -232,6 +247,20 @@ struct layer{
     float * concat_delta;
 
     float * binary_weights;
+    float * winograd_weights;
+    int8_t * weights_int8;
+    float * weight_scales;
+    int * weight_sums;
+    float input_scale;
+    uint64_t * xnor_weights;
+    float * xnor_scales;
+    int * xnor_popcounts;
+    uint16_t * weights_half;
+    PRECISION precision;
+    int mapped;
+    float * weights_packed;
+    float * folded_scales;
+    float * folded_biases;
 
     float * biases;
     float * bias_updates;
@@ -431,6 +460,16 @@ typedef enum {
     CONSTANT, STEP, EXP, POLY, STEPS, SIG, RANDOM
 } learning_rate_policy;
 
+typedef struct detection_params{
+    float thresh;
+    NMS_KIND nms_kind;
+    float nms;
+    float sigma;
+    int per_class;
+    int top_k;
+    int max_detections;
+} detection_params;
+
 typedef struct network{
     int n;
     int batch;
@@ -477,6 +516,18 @@ typedef struct network{
     float saturation;
     float hue;
     int random;
+    int winograd;
+    float winograd_tolerance;
+    PRECISION precision;
+    int prepack;
+    detection_params detection;
+    int threads;
+    thread_pool *pool;
+    network *base;
+    float *output_arena;
+    size_t output_arena_size;
+    void *weights_map;
+    size_t weights_map_size;
 
     int gpu_index;
     tree *hierarchy;
@@ -487,6 +538,7 @@ typedef struct network{
     float *workspace;
     size_t workspace_size;
     int train;
+    int inference;
     int index;
     float *cost;
     float clip;
@@ -530,6 +582,22 @@ typedef struct detection{
     int sort_class;
 } detection;
 
+typedef struct compact_detection{
+    box bbox;
+    int class_id;
+    float score;
+} compact_detection;
+
+typedef struct detection_pool{
+    detection *dets;
+    float *probs;
+    float *masks;
+    int classes;
+    int masks_per_box;
+    int capacity;
+    int num;
+} detection_pool;
+
 typedef struct matrix{
     int rows, cols;
     float **vals;
@@ -590,6 +658,13 @@ typedef struct{
 
 
 network *load_network(char *cfg, char *weights, int clear);
+network *load_network_inference(char *cfg, char *weights);
+void fold_batchnorm_network(network *net);
+void set_network_precision(network *net, PRECISION p);
+void plan_network_memory(network *net);
+void calibrate_network(network *net, float *input, float *maxes);
+void save_calibration(network *net, float *maxes, int n, char *filename);
+void quantize_network(network *net, char *filename);
 load_args get_base_args(network *net);
 
 void free_data(data d);
@@ -609,6 +684,7 @@ typedef struct list{
 pthread_t load_data(load_args args);
 list *read_data_cfg(char *filename);
 list *read_cfg(char *filename);
+void free_cfg(list *sections);
 unsigned char *read_file(char *filename);
 data resize_data(data orig, int w, int h);
 data *tile_data(data orig, int divs, int size);
@@ -691,15 +767,24 @@ int option_find_int(list *l, char *key, int def);
 int option_find_int_quiet(list *l, char *key, int def);
 
 network *parse_network_cfg(char *filename);
+network *parse_network_cfg_inference(char *filename);
+void free_network_cfg_cache();
 void save_weights(network *net, char *filename);
 void load_weights(network *net, char *filename);
 void save_weights_upto(network *net, char *filename, int cutoff);
+void save_weights_mapped(network *net, char *filename);
 void load_weights_upto(network *net, char *filename, int start, int cutoff);
 
 void zero_objectness(layer l);
 void get_region_detections(layer l, int w, int h, int netw, int neth, float thresh, int *map, float tree_thresh, int relative, detection *dets);
 int get_yolo_detections(layer l, int w, int h, int netw, int neth, float thresh, int *map, int relative, detection *dets);
 void free_network(network *net);
+network *make_network_context(network *net);
+void free_network_context(network *ctx);
+void set_network_threads(network *net, int threads, char *cpus, int pin);
+thread_pool *make_thread_pool(int threads, char *cpus, int pin);
+void free_thread_pool(thread_pool *pool);
+int thread_pool_size(thread_pool *pool);
 void set_batch_network(network *net, int b);
 void set_temp_network(network *net, float t);
 image load_image(char *filename, int w, int h, int c);
@@ -708,6 +793,8 @@ image make_image(int w, int h, int c);
 image resize_image(image im, int w, int h);
 void censor_image(image im, int dx, int dy, int w, int h);
 image letterbox_image(image im, int w, int h);
+void letterbox_image_into(image im, int w, int h, image boxed);
+void letterbox_bytes_into(unsigned char *data, int w, int h, int c, int step, int swap_rb, image boxed);
 image crop_image(image im, int dx, int dy, int w, int h);
 image center_crop_image(image im, int w, int h);
 image resize_min(image im, int min);
@@ -717,6 +804,12 @@ image mask_to_rgb(image mask);
 int resize_network(network *net, int w, int h);
 void free_matrix(matrix m);
 void test_resize(char *filename);
+void test_yolo_layer();
+void benchmark_gemm_cpu(int iter);
+void benchmark_nms(int iter);
+void benchmark_letterbox(int iter);
+void benchmark_convolutional_epilogue(network *net, int iter);
+void benchmark_convolutional_xnor(network *net, int iter);
 void save_image(image p, const char *name);
 int show_image(image p, const char *name, int ms);
 image copy_image(image p);
@@ -755,15 +848,28 @@ float *network_predict_gpubuffer(network *net, float *input, int bufferDeviceNum
 int network_width(network *net);
 int network_height(network *net);
 float *network_predict_image(network *net, image im);
+float *network_predict_batch(network *net, image *ims, int n);
 void network_detect(network *net, image im, float thresh, float hier_thresh, float nms, detection *dets);
 detection *get_network_boxes(network *net, int w, int h, float thresh, float hier, int *map, int relative, int *num);
 void free_detections(detection *dets, int n);
+detection **get_network_boxes_batch(network *net, image *ims, int n, float thresh, float hier, int *map, int relative, int *nums);
+void free_detections_batch(detection **dets, int *nums, int n);
+void avg_flipped_network(network *net);
+detection_pool *make_detection_pool(network *net);
+detection *get_network_boxes_pooled(network *net, detection_pool *pool, int b, int w, int h, float thresh, float hier, int *map, int relative, int *num);
+void reset_detection_pool(detection_pool *pool);
+void free_detection_pool(detection_pool *pool);
 
 void reset_network_state(network *net, int b);
 
 char **get_labels(char *filename);
 void do_nms_obj(detection *dets, int total, int classes, float thresh);
 void do_nms_sort(detection *dets, int total, int classes, float thresh);
+void do_nms_batch(detection **dets, int *nums, int images, int classes, float thresh, int per_class);
+void do_soft_nms(detection *dets, int total, int classes, float thresh, detection_params p);
+void default_detection_params(detection_params *p, float nms, int per_class);
+void postprocess_detections(detection *dets, int total, int classes, detection_params p);
+int compact_detections(detection *dets, int total, int classes, float thresh, compact_detection *out);
 
 matrix make_matrix(int rows, int cols);
 
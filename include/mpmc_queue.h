@@ -0,0 +1,375 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace darknet {
+
+	// How a push or pop waits on a full or empty queue. Block spins for a
+	// little while and then sleeps, Spin keeps retrying (yielding the cpu
+	// between tries after a while) and never sleeps, None returns false
+	// straight away.
+	enum class QueueWait { Block, Spin, None };
+
+	// Bounded multi-producer multi-consumer ring. Every cell carries a
+	// sequence number saying whether it is free for the producer or full for
+	// the consumer holding that ticket, so pushes and pops only contend on the
+	// counter they bump. Sleepers park on a condition variable the other side
+	// only touches when someone is actually asleep on it.
+	template <class T>
+	class MPMCQueue {
+	public:
+		typedef std::chrono::steady_clock::time_point time_point;
+
+		// capacity is rounded up to a power of two
+		explicit MPMCQueue(size_t capacity = 1024) {
+			size_t size = 2;
+			while (size < capacity)
+				size <<= 1;
+			this->mask = size - 1;
+			this->cells.reset(new Cell[size]);
+			for (size_t i = 0; i < size; i++)
+				this->cells[i].sequence.store(i, std::memory_order_relaxed);
+			this->head.store(0, std::memory_order_relaxed);
+			this->tail.store(0, std::memory_order_relaxed);
+			this->pushWaiters.store(0, std::memory_order_relaxed);
+			this->popWaiters.store(0, std::memory_order_relaxed);
+		}
+
+		MPMCQueue(const MPMCQueue &) = delete;
+		MPMCQueue &operator=(const MPMCQueue &) = delete;
+
+		size_t capacity() const {
+			return this->mask + 1;
+		}
+
+		// Only a snapshot while others push and pop
+		size_t size() const {
+			size_t tail = this->tail.load(std::memory_order_acquire);
+			size_t head = this->head.load(std::memory_order_acquire);
+			return (tail > head) ? tail - head : 0;
+		}
+
+		bool push_back(const T &elem, QueueWait wait = QueueWait::Block) {
+			if (!this->waitFor([&]{ return this->enqueue(elem); }, wait, this->pushWaiters, this->pushMutex, this->notFull, nullptr))
+				return false;
+			this->wake(this->popWaiters, this->popMutex, this->notEmpty, false);
+			return true;
+		}
+
+		// Pushes them all, waiting for room as need be. Returns how many went
+		// in, which is short of elems.size() only with QueueWait::None.
+		size_t push_back(const std::vector<T> &elems, QueueWait wait = QueueWait::Block) {
+			size_t numPushed = 0;
+			for (auto &elem : elems) {
+				if (!this->waitFor([&]{ return this->enqueue(elem); }, wait, this->pushWaiters, this->pushMutex, this->notFull, nullptr))
+					break;
+				numPushed++;
+			}
+			if (numPushed > 0)
+				this->wake(this->popWaiters, this->popMutex, this->notEmpty, true);
+			return numPushed;
+		}
+
+		bool pop_front(T &elem, QueueWait wait = QueueWait::Block) {
+			return this->popOne(elem, wait, nullptr);
+		}
+
+		// Waits until deadline at the latest
+		bool pop_front_until(T &elem, time_point deadline) {
+			return this->popOne(elem, QueueWait::Block, &deadline);
+		}
+
+		// Waits for one element as wait says, then pops up to numElems - 1
+		// more that are already there. numElems is set to the number popped.
+		bool pop_front(std::vector<T> &elems, int &numElems, QueueWait wait = QueueWait::Block) {
+			return this->popBatch(elems, numElems, wait, nullptr);
+		}
+
+		bool pop_front_until(std::vector<T> &elems, int &numElems, time_point deadline) {
+			return this->popBatch(elems, numElems, QueueWait::Block, &deadline);
+		}
+
+	private:
+		static const int SPIN = 128;
+
+		struct Cell {
+			std::atomic<size_t> sequence;
+			T data;
+		};
+
+		static inline void pause() {
+		#if defined(__x86_64__) || defined(__i386__)
+			__builtin_ia32_pause();
+		#endif
+		}
+
+		bool enqueue(const T &elem) {
+			size_t pos = this->tail.load(std::memory_order_relaxed);
+			Cell *cell;
+			for (;;) {
+				cell = &this->cells[pos & this->mask];
+				size_t seq = cell->sequence.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+				if (diff == 0) {
+					if (this->tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				} else if (diff < 0) {
+					return false;
+				} else {
+					pos = this->tail.load(std::memory_order_relaxed);
+				}
+			}
+			cell->data = elem;
+			cell->sequence.store(pos + 1, std::memory_order_release);
+			return true;
+		}
+
+		bool dequeue(T &elem) {
+			size_t pos = this->head.load(std::memory_order_relaxed);
+			Cell *cell;
+			for (;;) {
+				cell = &this->cells[pos & this->mask];
+				size_t seq = cell->sequence.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+				if (diff == 0) {
+					if (this->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				} else if (diff < 0) {
+					return false;
+				} else {
+					pos = this->head.load(std::memory_order_relaxed);
+				}
+			}
+			elem = cell->data;
+			cell->sequence.store(pos + this->mask + 1, std::memory_order_release);
+			return true;
+		}
+
+		// Retries attempt as wait says. A sleeper bumps waiters and retries
+		// under the mutex before sleeping, and the other side checks waiters
+		// after its change is visible, so one of them always sees the other.
+		template <class F>
+		bool waitFor(F attempt, QueueWait wait, std::atomic<int> &waiters, std::mutex &mutex,
+				std::condition_variable &cv, const time_point *deadline) {
+			if (attempt())
+				return true;
+			if (wait == QueueWait::None)
+				return false;
+			for (int i = 0; wait == QueueWait::Spin || i < SPIN; i++) {
+				// Whoever we are waiting on may need this cpu
+				if (i < SPIN/2)
+					pause();
+				else
+					std::this_thread::yield();
+				if (attempt())
+					return true;
+				if (deadline && std::chrono::steady_clock::now() >= *deadline)
+					return false;
+			}
+
+			std::unique_lock<std::mutex> lock(mutex);
+			waiters.fetch_add(1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			bool done;
+			while (!(done = attempt())) {
+				if (deadline == nullptr) {
+					cv.wait(lock);
+				} else if (cv.wait_until(lock, *deadline) == std::cv_status::timeout) {
+					done = attempt();
+					break;
+				}
+			}
+			waiters.fetch_sub(1, std::memory_order_relaxed);
+			return done;
+		}
+
+		void wake(std::atomic<int> &waiters, std::mutex &mutex, std::condition_variable &cv, bool all) {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (waiters.load(std::memory_order_relaxed) == 0)
+				return;
+			// Taking the mutex makes sure a waiter that missed our change is
+			// already inside wait() and gets the notification
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+			}
+			if (all)
+				cv.notify_all();
+			else
+				cv.notify_one();
+		}
+
+		bool popOne(T &elem, QueueWait wait, const time_point *deadline) {
+			if (!this->waitFor([&]{ return this->dequeue(elem); }, wait, this->popWaiters, this->popMutex, this->notEmpty, deadline))
+				return false;
+			this->wake(this->pushWaiters, this->pushMutex, this->notFull, false);
+			return true;
+		}
+
+		bool popBatch(std::vector<T> &elems, int &numElems, QueueWait wait, const time_point *deadline) {
+			T elem;
+			int numPopped = 0;
+			if (numElems > 0 && this->waitFor([&]{ return this->dequeue(elem); }, wait, this->popWaiters, this->popMutex, this->notEmpty, deadline)) {
+				do {
+					elems.push_back(elem);
+					numPopped++;
+				} while (numPopped < numElems && this->dequeue(elem));
+				this->wake(this->pushWaiters, this->pushMutex, this->notFull, numPopped > 1);
+			}
+			numElems = numPopped;
+			return numPopped > 0;
+		}
+
+		// Producers and consumers each hammer their own counter. Padded
+		// rather than aligned, since new only aligns to 16 before C++17.
+		char pad0[64];
+		std::atomic<size_t> tail;
+		char pad1[64 - sizeof(std::atomic<size_t>)];
+		std::atomic<size_t> head;
+		char pad2[64 - sizeof(std::atomic<size_t>)];
+		size_t mask;
+		std::unique_ptr<Cell[]> cells;
+
+		std::atomic<int> pushWaiters;
+		std::atomic<int> popWaiters;
+		std::mutex pushMutex;
+		std::mutex popMutex;
+		std::condition_variable notFull;
+		std::condition_variable notEmpty;
+	}; // class MPMCQueue
+
+	// Bounded queue behind one mutex, with the same interface as MPMCQueue.
+	// Uncontended it is cheaper than the ring, which pays a fence per
+	// operation, so it is the default where a single thread pops; the ring
+	// is for queues that several threads pop.
+	template <class T>
+	class MutexQueue {
+	public:
+		typedef std::chrono::steady_clock::time_point time_point;
+
+		explicit MutexQueue(size_t capacity = 1024) : limit(capacity) {}
+
+		MutexQueue(const MutexQueue &) = delete;
+		MutexQueue &operator=(const MutexQueue &) = delete;
+
+		size_t capacity() const {
+			return this->limit;
+		}
+
+		size_t size() const {
+			std::lock_guard<std::mutex> lock(this->mutex);
+			return this->queue.size();
+		}
+
+		bool push_back(const T &elem, QueueWait wait = QueueWait::Block) {
+			std::unique_lock<std::mutex> lock(this->mutex);
+			if (!this->waitFor(lock, [this]{ return this->queue.size() < this->limit; }, wait, this->notFull, nullptr))
+				return false;
+			this->queue.push_back(elem);
+			lock.unlock();
+			this->notEmpty.notify_one();
+			return true;
+		}
+
+		size_t push_back(const std::vector<T> &elems, QueueWait wait = QueueWait::Block) {
+			std::unique_lock<std::mutex> lock(this->mutex);
+			size_t numPushed = 0;
+			for (auto &elem : elems) {
+				// Consumers have to hear about what is in already before we
+				// wait for them to make room
+				if (this->queue.size() >= this->limit)
+					this->notEmpty.notify_all();
+				if (!this->waitFor(lock, [this]{ return this->queue.size() < this->limit; }, wait, this->notFull, nullptr))
+					break;
+				this->queue.push_back(elem);
+				numPushed++;
+			}
+			lock.unlock();
+			if (numPushed > 0)
+				this->notEmpty.notify_all();
+			return numPushed;
+		}
+
+		bool pop_front(T &elem, QueueWait wait = QueueWait::Block) {
+			return this->popOne(elem, wait, nullptr);
+		}
+
+		bool pop_front_until(T &elem, time_point deadline) {
+			return this->popOne(elem, QueueWait::Block, &deadline);
+		}
+
+		bool pop_front(std::vector<T> &elems, int &numElems, QueueWait wait = QueueWait::Block) {
+			return this->popBatch(elems, numElems, wait, nullptr);
+		}
+
+		bool pop_front_until(std::vector<T> &elems, int &numElems, time_point deadline) {
+			return this->popBatch(elems, numElems, QueueWait::Block, &deadline);
+		}
+
+	private:
+		template <class F>
+		bool waitFor(std::unique_lock<std::mutex> &lock, F ready, QueueWait wait,
+				std::condition_variable &cv, const time_point *deadline) {
+			while (!ready()) {
+				if (wait == QueueWait::None) {
+					return false;
+				} else if (wait == QueueWait::Spin) {
+					lock.unlock();
+					std::this_thread::yield();
+					lock.lock();
+				} else if (deadline == nullptr) {
+					cv.wait(lock);
+				} else if (cv.wait_until(lock, *deadline) == std::cv_status::timeout) {
+					return ready();
+				}
+			}
+			return true;
+		}
+
+		bool popOne(T &elem, QueueWait wait, const time_point *deadline) {
+			std::unique_lock<std::mutex> lock(this->mutex);
+			if (!this->waitFor(lock, [this]{ return !this->queue.empty(); }, wait, this->notEmpty, deadline))
+				return false;
+			elem = this->queue.front();
+			this->queue.pop_front();
+			lock.unlock();
+			this->notFull.notify_one();
+			return true;
+		}
+
+		bool popBatch(std::vector<T> &elems, int &numElems, QueueWait wait, const time_point *deadline) {
+			int numPopped = 0;
+			std::unique_lock<std::mutex> lock(this->mutex);
+			if (numElems > 0 && this->waitFor(lock, [this]{ return !this->queue.empty(); }, wait, this->notEmpty, deadline)) {
+				while (numPopped < numElems && !this->queue.empty()) {
+					elems.push_back(this->queue.front());
+					this->queue.pop_front();
+					numPopped++;
+				}
+			}
+			lock.unlock();
+			if (numPopped > 0)
+				this->notFull.notify_all();
+			numElems = numPopped;
+			return numPopped > 0;
+		}
+
+		std::deque<T> queue;
+		size_t limit;
+		mutable std::mutex mutex;
+		std::condition_variable notFull;
+		std::condition_variable notEmpty;
+	}; // class MutexQueue
+
+} // namespace darknet
+
+#endif // MPMC_QUEUE_H
@@ -4,9 +4,9 @@
 #include <thread>
 #include <cstring>
 
-#include <queue>
 #include <mutex>
 #include <condition_variable>
+#include "utils/Queue.h"
 
 extern "C" {
 	#undef __cplusplus
@@ -16,12 +16,11 @@ extern "C" {
 
 #include "utils/Timer.h"
 #include "utils/Types.h"
-#include "utils/Queue.h"
 #include "utils/PointerMap.h"
 
 using LiveStreamDetector::Frame;
 using LiveStreamDetector::WorkRequest;
-using LiveStreamDetector::MutexQueue;
+using LiveStreamDetector::MPMCQueue;
 using LiveStreamDetector::PointerMap;
 
 class Detector {
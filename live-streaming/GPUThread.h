@@ -12,7 +12,7 @@ using LiveStreamDetector::WorkRequest;
 
 class GPUThread {
 public:
-	void Init(NvPipe_Codec codec, MutexQueue<Frame> *frames,
+	void Init(NvPipe_Codec codec, MPMCQueue<Frame> *frames,
 			std::vector<PointerMap<Frame> *> &completedFramesMap,
 			int firstGPU, int detectorGPU,
 			int targetFPS, int inWidth, int inHeight, int numStreams,
@@ -115,7 +115,7 @@ public:
 
 		while(true) {
 			Frame *frame = new Frame;
-			while (frames->pop_front(*frame) == false) {
+			while (frames->pop_front_until(*frame, std::chrono::steady_clock::now() + std::chrono::milliseconds(10)) == false) {
 				// Check whether we've been signalled to shut down.
 				if (this->done.load(std::memory_order_acquire) == true) {
 					detector.Shutdown();
@@ -280,7 +280,7 @@ private:
 	int threadID;
 
 	// Objects (or pointers to)
-	MutexQueue<Frame> *frames;
+	MPMCQueue<Frame> *frames;
 	std::vector<PointerMap<Frame> *> completedFramesMap;
 	std::atomic_bool done;
 	Detector detector;
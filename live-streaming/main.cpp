@@ -63,7 +63,9 @@ simplelogger::Logger *logger = simplelogger::LoggerFactory::CreateConsoleLogger(
 
 using LiveStreamDetector::Frame;
 using LiveStreamDetector::WorkRequest;
+using LiveStreamDetector::MPMCQueue;
 using LiveStreamDetector::MutexQueue;
+using LiveStreamDetector::QueueWait;
 
 #include "GPUThread.h"
 
@@ -72,7 +74,7 @@ using LiveStreamDetector::MutexQueue;
 // container, e.g., MP4 --- MP4 is not a binary encoding but a data
 // representation format, i.e., it contains a bunch of H.264 encoded pictures
 // and some metadata about how to access them, their order, etc.) them into a
-// mutex-protected queue. All the frames are demuxed into the queue before we
+// lock-free queue. All the frames are demuxed into the queue before we
 // do any other processing to ensure we're not waiting on disk I/O. This of
 // course would be different in a server that is receiving videos over the
 // network. The demuxed (but still encoded) image is put into a Frame object;
@@ -98,9 +100,10 @@ using LiveStreamDetector::MutexQueue;
 * on-GPU decoders (using the NVPipe API).
 * Inputs:
 * NvPipe* decoder --- the NVPipe decoder object (initialized in main)
-* MutexQueue<Frame> *inFrames --- A mutex-protected input queue of Frames
-* MutexQueue<Frame> *outFrames --- Similar, but for processed Frames
-* Look under utils/ for the MutexQueue and Frame data types;
+* MutexQueue<Frame> *inFrames --- This decoder's input queue of Frames
+* MPMCQueue<Frame> *outFrames --- A lock-free queue of decoded Frames, shared
+*   by all the decoders and GPU threads
+* Look under utils/ for the queue and Frame data types;
 * MutexQueue<void *> *gpuFramesQueue --- This is a queue of pre-allocated
 *   buffers on the GPU, these buffers are what NVPipe writes the decoded image
 *   into on the GPU.
@@ -117,7 +120,7 @@ using LiveStreamDetector::MutexQueue;
 *   we're running a long running service that accepts videos from the internet.
 */
 void decodeFrame(NvPipe* decoder, MutexQueue<Frame> *inFrames,
-  MutexQueue<Frame> *outFrames, MutexQueue<void *> *gpuFramesQueue,
+  MPMCQueue<Frame> *outFrames, MutexQueue<void *> *gpuFramesQueue,
   int inWidth, int inHeight,int fps, int gpuNum, uint64_t lastFrameNum)
 {
   uint64_t frameNum = 0;
@@ -126,8 +129,8 @@ void decodeFrame(NvPipe* decoder, MutexQueue<Frame> *inFrames,
 
   while( frameNum < lastFrameNum ) {
     Frame frame;
-    // Busy loop until we get a frame to process;
-    while(!inFrames->pop_front(frame));
+    // Sleep until we get a frame to process;
+    inFrames->pop_front(frame);
 
     // Some book keeping for the frame
     frame.timer.reset();
@@ -136,7 +139,7 @@ void decodeFrame(NvPipe* decoder, MutexQueue<Frame> *inFrames,
     frame.deviceNumDecompressed = gpuNum;
     // Grab a pre-allocated buffer to use;
     // returned to the queue by the encode thread;
-    if(!gpuFramesQueue->pop_front(frame.decompressedFrameDevice)){
+    if(!gpuFramesQueue->pop_front(frame.decompressedFrameDevice, QueueWait::None)){
       LOG(INFO) << "Ran out of buffers. Calling cudaMalloc...";
       cudaMalloc(&frame.decompressedFrameDevice, frame.decompressedFrameSize);
       frame.needsCudaFree = true;
@@ -425,8 +428,6 @@ int main(int argc, char* argv[])
   FFmpegStreamer *muxers[numStreams];
   NvPipe* encoders[numStreams];
   NvPipe* decoders[numStreams];
-  // These Queues are used to store the perStream compressed frames to be muxed
-  MutexQueue<Frame> compressedFramesQueues[numStreams];
   for (int i = 0; i < numStreams; i++) {
     decoders[i] = NvPipe_CreateDecoder(NVPIPE_NV12, codec);
     if (!decoders[i]) {
@@ -450,7 +451,7 @@ int main(int argc, char* argv[])
     }
   }
 
-  MutexQueue<Frame> decompressedFramesQueue;
+  MPMCQueue<Frame> decompressedFramesQueue;
 
   std::vector<PointerMap<Frame> *> detectedFrameMaps(numStreams);
   std::vector<PointerMap<Frame> *> encodedFrameMaps(numStreams);
@@ -459,34 +460,44 @@ int main(int argc, char* argv[])
     detectedFrameMaps[i] = new PointerMap<Frame>;
   }
 
-  // Demux compressed frames, and insert them into the FrameMap
+  // Demux compressed frames, and insert them into the per stream queues
+  // of compressed frames; the queues are bounded, so they are sized once
+  // the whole video has been demuxed
+  std::vector<std::vector<Frame>> demuxedFrames(numStreams);
   uint8_t *compressedFrame = nullptr;
   int compressedFrameSize = 0;
   uint64_t frameNum = 0;
   while(demuxer.Demux(&compressedFrame, &compressedFrameSize)) {
     for (int i = 0; i < numStreams; i++) {
-      Frame *frame = new Frame;
-      frame->frameNum = frameNum;
-      frame->data = new uint8_t[compressedFrameSize];
-      std::memcpy(frame->data, compressedFrame, compressedFrameSize);
-      frame->frameSize = compressedFrameSize;
-      frame->streamNum = i;
-      compressedFramesQueues[i].push_back(*frame);
+      Frame frame;
+      frame.frameNum = frameNum;
+      frame.data = new uint8_t[compressedFrameSize];
+      std::memcpy(frame.data, compressedFrame, compressedFrameSize);
+      frame.frameSize = compressedFrameSize;
+      frame.streamNum = i;
+      demuxedFrames[i].push_back(frame);
     }
     frameNum++;
   }
+  std::vector<std::unique_ptr<MutexQueue<Frame>>> compressedFramesQueues(numStreams);
+  for (int i = 0; i < numStreams; i++) {
+    compressedFramesQueues[i].reset(new MutexQueue<Frame>(frameNum));
+    compressedFramesQueues[i]->push_back(demuxedFrames[i]);
+  }
+  demuxedFrames.clear();
 
   int numBuffers = fps*4;
   size_t bufferSize = inWidth*inHeight*4;
   size_t totalBufferSize = numBuffers*bufferSize;
   void *largeBuffers[numStreams];
-  MutexQueue<void *> gpuFrameBuffers[numStreams];
+  std::vector<std::unique_ptr<MutexQueue<void *>>> gpuFrameBuffers(numStreams);
   for (int i = 0; i < numStreams; i++) {
     cudaSetDevice(i);
     cudaMalloc(&largeBuffers[i], totalBufferSize);
+    gpuFrameBuffers[i].reset(new MutexQueue<void *>(numBuffers));
     for (int j = 0; j < numBuffers; j++) {
       void *offset = (void *)((uint8_t *)largeBuffers[i]+(bufferSize*j));
-      gpuFrameBuffers[i].push_back(offset);
+      gpuFrameBuffers[i]->push_back(offset);
     }
   }
 
@@ -499,7 +510,7 @@ int main(int argc, char* argv[])
   std::vector<std::thread> encoderThreads(numStreams);
   for(int i = 0; i < numStreams; i++) {
     encoderThreads[i] = std::thread(&encodeFrame, encoders[i],
-      detectedFrameMaps[i], encodedFrameMaps[i], &gpuFrameBuffers[i], inWidth,
+      detectedFrameMaps[i], encodedFrameMaps[i], gpuFrameBuffers[i].get(), inWidth,
       inHeight, i, frameNum);
   }
 
@@ -530,7 +541,7 @@ int main(int argc, char* argv[])
   std::vector<std::thread> decoderThreads(numStreams);
   for(int i = 0; i < numStreams; i++) {
       decoderThreads[i] = std::thread(&decodeFrame, decoders[i],
-          &compressedFramesQueues[i], &decompressedFramesQueue, &gpuFrameBuffers[i],
+          compressedFramesQueues[i].get(), &decompressedFramesQueue, gpuFrameBuffers[i].get(),
           inWidth, inHeight, fps, i, frameNum, numPhysicalGPUs);
   }
 
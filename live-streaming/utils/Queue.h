@@ -1,61 +1,16 @@
 #ifndef LIVESTREAMDETECTOR_QUEUE_H
 #define LIVESTREAMDETECTOR_QUEUE_H
-#include <queue>
-#include <mutex>
-#include <condition_variable>
+#include "../../include/mpmc_queue.h"
 
 namespace LiveStreamDetector {
 
-	template <class T>
-	class MutexQueue {
-	public:
-		void push_back(T &elem) {
-			std::lock_guard<std::mutex> lock(this->mutex);
-			this->queue.push(elem);
-		}
-
-		void push_back(std::vector<T> &elems) {
-			std::lock_guard<std::mutex> lock(this->mutex);
-			for (auto elemIterator = elems.begin(); elemIterator != elems.end(); elemIterator++) {
-				this->queue.push(*elemIterator);
-			}
-		}
-
-		// pops 1 element
-		bool pop_front(T &elem) {
-			if (this->queue.empty())
-				return false;
-
-			std::unique_lock<std::mutex> lock(this->mutex);
-			if(!this->queue.empty()) {
-				elem = (this->queue.front());
-				this->queue.pop();
-				return true;
-			}
-			return false;
-		}
-
-		// Pops upto N elements
-		bool pop_front(std::vector<T> &elems, int &numElems) {
-			if (this->queue.empty())
-				return false;
-
-			std::unique_lock<std::mutex> lock(this->mutex);
-			int numPopped = 0;
-			while( !this->queue.empty() && (numPopped < numElems) ) {
-				elems.insert(elems.end(), this->queue.front());
-				this->queue.pop();
-				numPopped++;
-			}
-			numElems = numPopped;
-			return true;
-		}
-
-	private:
-		std::queue<T> queue;
-		std::mutex mutex;
-
-	}; // class DetectionQueue
+	// The pipeline stages hand frames and buffers on over bounded queues:
+	// MutexQueue where one thread pops, the lock-free MPMCQueue where
+	// several do. Pops block by default; QueueWait::None polls, and
+	// pop_front_until gives up at a deadline.
+	using darknet::MPMCQueue;
+	using darknet::MutexQueue;
+	using darknet::QueueWait;
 
 } // namespace
 
@@ -86,6 +86,10 @@ load_net = lib.load_network
 load_net.argtypes = [c_char_p, c_char_p, c_int]
 load_net.restype = c_void_p
 
+load_net_inference = lib.load_network_inference
+load_net_inference.argtypes = [c_char_p, c_char_p]
+load_net_inference.restype = c_void_p
+
 do_nms_obj = lib.do_nms_obj
 do_nms_obj.argtypes = [POINTER(DETECTION), c_int, c_int, c_float]
 
@@ -99,6 +103,9 @@ letterbox_image = lib.letterbox_image
 letterbox_image.argtypes = [IMAGE, c_int, c_int]
 letterbox_image.restype = IMAGE
 
+letterbox_bytes = lib.letterbox_bytes_into
+letterbox_bytes.argtypes = [c_void_p, c_int, c_int, c_int, c_int, c_int, IMAGE]
+
 load_meta = lib.get_metadata
 lib.get_metadata.argtypes = [c_char_p]
 lib.get_metadata.restype = METADATA
@@ -122,6 +129,17 @@ def classify(net, meta, im):
     res = sorted(res, key=lambda x: -x[1])
     return res
 
+def detections(meta, dets, num):
+    res = []
+    for j in range(num):
+        for i in range(meta.classes):
+            if dets[j].prob[i] > 0:
+                b = dets[j].bbox
+                res.append((meta.names[i], dets[j].prob[i], (b.x, b.y, b.w, b.h)))
+    res = sorted(res, key=lambda x: -x[1])
+    free_detections(dets, num)
+    return res
+
 def detect(net, meta, image, thresh=.5, hier_thresh=.5, nms=.45):
     im = load_image(image, 0, 0)
     num = c_int(0)
@@ -131,16 +149,23 @@ def detect(net, meta, image, thresh=.5, hier_thresh=.5, nms=.45):
     num = pnum[0]
     if (nms): do_nms_obj(dets, num, meta.classes, nms);
 
-    res = []
-    for j in range(num):
-        for i in range(meta.classes):
-            if dets[j].prob[i] > 0:
-                b = dets[j].bbox
-                res.append((meta.names[i], dets[j].prob[i], (b.x, b.y, b.w, b.h)))
-    res = sorted(res, key=lambda x: -x[1])
     free_image(im)
-    free_detections(dets, num)
-    return res
+    return detections(meta, dets, num)
+
+# frame is an 8 bit BGR numpy array of shape (h, w, c), as OpenCV returns it
+def detect_frame(net, meta, frame, thresh=.5, hier_thresh=.5, nms=.45):
+    h, w, c = frame.shape
+    im = make_image(lib.network_width(net), lib.network_height(net), c)
+    letterbox_bytes(frame.ctypes.data, w, h, c, frame.strides[0], 1, im)
+    num = c_int(0)
+    pnum = pointer(num)
+    predict(net, im.data)
+    dets = get_network_boxes(net, w, h, thresh, hier_thresh, None, 0, pnum)
+    num = pnum[0]
+    if (nms): do_nms_obj(dets, num, meta.classes, nms);
+
+    free_image(im)
+    return detections(meta, dets, num)
     
 if __name__ == "__main__":
     #net = load_net("cfg/densenet201.cfg", "/home/pjreddie/trained/densenet201.weights", 0)
@@ -148,7 +173,7 @@ if __name__ == "__main__":
     #meta = load_meta("cfg/imagenet1k.data")
     #r = classify(net, meta, im)
     #print r[:10]
-    net = load_net("cfg/tiny-yolo.cfg", "tiny-yolo.weights", 0)
+    net = load_net_inference("cfg/tiny-yolo.cfg", "tiny-yolo.weights")
     meta = load_meta("cfg/coco.data")
     r = detect(net, meta, "data/dog.jpg")
     print r
@@ -68,7 +68,7 @@ typedef struct {
 	int height;
 	int numChannels;
 	int widthStep;
-	float *data;
+	unsigned char *data;
 } Image;
 
 void printImage(Image &image)
@@ -87,15 +87,9 @@ Image getImageFromMat(cv::Mat *m)
 	image.width = m->cols;
 	image.numChannels = m->channels();
 	image.widthStep = (int)m->step;
-	image.data = new float[image.height*image.width*image.numChannels]();
-
-	for(int h = 0; h < image.height; ++h){
-		for(int c= 0; c < image.numChannels; ++c){
-			for(int w = 0; w < image.width; ++w){
-				image.data[(c*image.width*image.height + h*image.width + w)] = m->data[h*image.widthStep + w*image.numChannels + c]/255.0;
-			}
-		}
-	}
+	// The server letterboxes and converts the raw BGR rows itself.
+	image.data = new unsigned char[image.height*image.widthStep];
+	memcpy(image.data, m->data, image.height*image.widthStep);
 	return image;
 }
 
@@ -155,7 +149,8 @@ class ImageDetectionClient {
 		auto requestOffset = darknetServer::CreateKeyFrame(*messageBuilder,
 													image->width, image->height,
 													image->numChannels, image->widthStep,
-													messageBuilder->CreateVector<float>(image->data, image->height*image->width*image->numChannels));
+													flatbuffers::Offset<flatbuffers::Vector<float>>(),
+													messageBuilder->CreateVector(image->data, image->height*image->widthStep));
 		messageBuilder->Finish(requestOffset);
 		// grab the message, so we are the owners.
 		auto frameFBMessage = messageBuilder->ReleaseMessage<KeyFrame>();
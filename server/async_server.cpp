@@ -34,41 +34,93 @@ using darknetServer::ImageDetection;
 
 using DarknetWrapper::WorkRequest;
 using DarknetWrapper::DetectionQueue;
+using DarknetWrapper::CompletionQueue;
 using DarknetWrapper::AsyncDetector;
+using DarknetWrapper::BatchPolicy;
+using DarknetWrapper::Scheduler;
+
+// Where the detector instances and the threads serving rpcs run, and how
+// much work each instance may have outstanding.
+struct ServerConfig {
+	int instances;
+	std::vector<std::string> instanceCpus;	// one cpu list per instance, reused round robin
+	int ioThreads;	// each for the front and the back half
+	std::string ioCpus;
+	int queueDepth;
+	BatchPolicy policy;
+};
+
+// cpus is a list like "0-3,8,10-11"
+static void parseCpus(const std::string &cpus, cpu_set_t *set) {
+	CPU_ZERO(set);
+	const char *s = cpus.c_str();
+	while (*s) {
+		char *next;
+		int first = strtol(s, &next, 10);
+		int last = first;
+		if (next == s)
+			break;
+		if (*next == '-')
+			last = strtol(next + 1, &next, 10);
+		for (; first <= last; first++)
+			CPU_SET(first, set);
+		s = (*next == ',') ? next + 1 : next + strlen(next);
+	}
+}
+
+static void pinThread(std::thread &thread, const std::string &cpus) {
+	if (cpus.empty())
+		return;
+	cpu_set_t cpuset;
+	parseCpus(cpus, &cpuset);
+	int rc = pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuset);
+	if (rc != 0)
+		std::cerr << "Error calling pthread_setaffinity_np: " << rc << "\n";
+}
 
 class ServerImpl final {
   public:
 	~ServerImpl() {
-		for (int i = 0; i <4; i++)
-			detector[i].Shutdown();
+		for (auto &detector : detectors)
+			detector->Shutdown();
+		if (model != nullptr)
+			free_network(model);
 		server_->Shutdown();
 		// Always shutdown the completion queue after the server.
 		cq_->Shutdown();
 	}
 
 	// There is no shutdown handling in this code.
-	void Run(int argc, char** argv) {
+	void Run(int argc, char** argv, ServerConfig &config) {
 		std::string server_address("zemaitis:50051");
 		//std::string server_address("128.83.122.71:50051");
 
-		std::vector<std::thread> detectionThreads(4);
-		int cpuMapping[4] = {0,1,12,13};
-		// Initialize detector - pass it the request and completion queues
-		// Initialization must be done before launching the detection thread.
-		for (int i = 0; i < 4; i++) {
-			detector[i].Init(argc, argv, &requestQueue[i], &completionQueue[i], i);
-			// start a Thread per GPU to run doDetection
-			detectionThreads[i] = std::thread(&AsyncDetector::doDetection, &detector[i]);
-			// Create a cpu_set_t object representing a set of CPUs. Clear it and mark
-			// only CPU i as set.
-			cpu_set_t cpuset;
-			CPU_ZERO(&cpuset);
-			// 0 -> 0; 1 -> 24; 2 -> 12; 3 -> 36;
-			CPU_SET(cpuMapping[i], &cpuset);
-			int rc = pthread_setaffinity_np(detectionThreads[i].native_handle(), sizeof(cpu_set_t), &cpuset);
-			if (rc != 0)
-				std::cerr << "Error calling pthread_setaffinity_np: " << rc << "\n";
+		int numInstances = config.instances;
+		std::vector<std::thread> detectionThreads(numInstances);
+#ifndef GPU
+		// On the CPU the detectors share one copy of the weights, each running
+		// in its own context.
+		model = load_network_inference(argv[2], argv[3]);
+#endif
+		// Initialize detectors - pass them their request queue and the shared
+		// completion queue. Initialization must be done before launching the
+		// detection threads.
+		std::vector<AsyncDetector *> instances;
+		for (int i = 0; i < numInstances; i++) {
+			std::string cpus = config.instanceCpus.empty() ? "" : config.instanceCpus[i % config.instanceCpus.size()];
+			requestQueues.emplace_back(new DetectionQueue(config.queueDepth));
+			detectors.emplace_back(new AsyncDetector);
+			detectors[i]->Init(argc, argv, requestQueues[i].get(), &completionQueue, i, model, config.policy);
+#ifndef GPU
+			if (!cpus.empty())
+				detectors[i]->pinThreads(const_cast<char *>(cpus.c_str()));
+#endif
+			instances.push_back(detectors[i].get());
+			// start a thread per instance to run doDetection
+			detectionThreads[i] = std::thread(&AsyncDetector::doDetection, detectors[i].get());
+			pinThread(detectionThreads[i], cpus);
 		}
+		scheduler.Init(instances, config.queueDepth);
 
 		ServerBuilder builder;
 		std::string key;
@@ -103,37 +155,19 @@ class ServerImpl final {
 		std::cout << "Server listening on " << server_address << std::endl;
 
 		// Start the threads that handle the second half of the processing.
-		std::vector<std::thread> laterHalfThreads(8);
-		int cpuNums_bottom[8] = {2,3,4,5,14,15,16,17};
-		for (int i = 0; i < 8; i++) {
-			// Thread: 0 1 2 3 4 5 6 7
-			// GPU:    0 0 1 1 2 2 3 3
-			laterHalfThreads[i] = std::thread(&ServerImpl::doLaterHalf, this, i/2);
-			// Create a cpu_set_t object representing a set of CPUs. Clear it and mark
-			// only CPU i as set.
-			cpu_set_t cpuset;
-			CPU_ZERO(&cpuset);
-			CPU_SET(cpuNums_bottom[i], &cpuset);
-			int rc = pthread_setaffinity_np(laterHalfThreads[i].native_handle(), sizeof(cpu_set_t), &cpuset);
-			if (rc != 0)
-				std::cerr << "Error calling pthread_setaffinity_np: " << rc << "\n";
+		// Any of them takes results from any detector.
+		std::vector<std::thread> laterHalfThreads(config.ioThreads);
+		for (int i = 0; i < config.ioThreads; i++) {
+			laterHalfThreads[i] = std::thread(&ServerImpl::doLaterHalf, this);
+			pinThread(laterHalfThreads[i], config.ioCpus);
 		}
 
 		// Start the threads that handle the first half of the processing.
-		std::vector<std::thread> frontHalfThreads(8);
-		int cpuNums_front[8] = {7,8,9,10,19,20,21,22};
-		for (int i = 0; i < 8; i++) {
-			// Thread: 0 1 2 3 4 5 6 7
-			// GPU:    0 0 1 1 2 2 3 3
-			frontHalfThreads[i] = std::thread(&ServerImpl::doFirstHalf, this, i/2);
-			// Create a cpu_set_t object representing a set of CPUs. Clear it and mark
-			// only CPU i as set.
-			cpu_set_t cpuset;
-			CPU_ZERO(&cpuset);
-			CPU_SET(cpuNums_front[i], &cpuset);
-			int rc = pthread_setaffinity_np(frontHalfThreads[i].native_handle(), sizeof(cpu_set_t), &cpuset);
-			if (rc != 0)
-				std::cerr << "Error calling pthread_setaffinity_np: " << rc << "\n";
+		// The scheduler picks a detector for every request they take.
+		std::vector<std::thread> frontHalfThreads(config.ioThreads);
+		for (int i = 0; i < config.ioThreads; i++) {
+			frontHalfThreads[i] = std::thread(&ServerImpl::doFirstHalf, this);
+			pinThread(frontHalfThreads[i], config.ioCpus);
 		}
 
 		// The server's main loop.
@@ -170,11 +204,10 @@ class ServerImpl final {
 		// Take in the "service" instance (in this case representing an asynchronous
 		// server) and the completion queue "cq" used for asynchronous communication
 		// with the gRPC runtime.
-		CallData(ImageDetection::AsyncService* service, ServerCompletionQueue* cq, DetectionQueue *requestQ, AsyncDetector *detector)
+		CallData(ImageDetection::AsyncService* service, ServerCompletionQueue* cq, ServerImpl *server)
 				: service_(service), cq_(cq), asyncResponder(&ctx_), status_(CREATE) {
 			// Invoke the serving logic right away.
-			this->requestQueue = requestQ;
-			this->detector = detector;
+			this->server = server;
 			scheduleRequest();
 		}
 
@@ -198,17 +231,22 @@ class ServerImpl final {
 				// Spawn a new CallData instance to serve new clients while we process
 				// the one for this CallData. The instance will deallocate itself as
 				// part of its FINISH state.
-				new CallData(service_, cq_, requestQueue, detector);
+				new CallData(service_, cq_, server);
 
-				// The actual processing.
+				// The actual processing, on whichever detector should get to it
+				// first. This waits if they are all backed up.
 				work.done = false;
 				work.cancelled = false;
 				work.tag = this;
+				work.arrival = std::chrono::steady_clock::now();
+				work.instance = server->scheduler.acquire();
+				detector = server->detectors[work.instance].get();
 				work.img = detector->convertImage(requestMessage.GetRoot());
 				work.dets = nullptr;
+				work.pool = nullptr;
 				work.nboxes = 0;
 
-				requestQueue->push_back(work);
+				server->requestQueues[work.instance]->push_back(work);
 				status_ = PROCESSING;
 			} else if (status_ == FINISH) {
 				// Once in the FINISH state, deallocate ourselves (CallData).
@@ -225,19 +263,13 @@ class ServerImpl final {
 				GPR_ASSERT(work.done == true);
 				GPR_ASSERT(work.dets != nullptr);
 
-				std::vector<flatbuffers::Offset<DetectedObject>> objects;
-				int numObjects = 0;
-				detection *dets = work.dets;
-				for (int i = 0; i < work.nboxes; i++) {
-					if(dets[i].objectness == 0) continue;
-					bbox box(dets[i].bbox.x, dets[i].bbox.y, dets[i].bbox.w, dets[i].bbox.h);
-					std::vector<float> prob;
-					for (int j = 0; j < work.classes; j++) {
-						prob.push_back(dets[i].prob[j]);
-					}
-					auto objectOffset = darknetServer::CreateDetectedObjectDirect(messageBuilder, &box, dets[i].classes, dets[i].objectness, dets[i].sort_class, &prob);
-					objects.push_back(objectOffset);
-					numObjects++;
+				std::vector<compact_detection> compact(work.nboxes);
+				int numObjects = detector->compactDetections(work, compact.data());
+				std::vector<DetectedObject> objects;
+				objects.reserve(numObjects);
+				for (int i = 0; i < numObjects; i++) {
+					bbox box(compact[i].bbox.x, compact[i].bbox.y, compact[i].bbox.w, compact[i].bbox.h);
+					objects.push_back(DetectedObject(box, compact[i].class_id, compact[i].score));
 				}
 
 				flatbuffers::Offset<DetectedObjects> detectedObjectsOffset = darknetServer::CreateDetectedObjectsDirect(messageBuilder, numObjects, &objects);
@@ -247,7 +279,7 @@ class ServerImpl final {
 				GPR_ASSERT(this->responseMessage.Verify());
 
 				// Clean up
-				free_detections(work.dets, work.nboxes);
+				detector->releaseDetections(work);
 				status_ = FINISH;
 				std::cout << "Total server time for this frame: " << probe_time_end2(&ts_server) << " milliseconds"<< std::endl;
 				asyncResponder.Finish(this->responseMessage, Status::OK, this);
@@ -277,7 +309,7 @@ class ServerImpl final {
 
 		WorkRequest work;
 
-		DetectionQueue *requestQueue;
+		ServerImpl *server;
 		AsyncDetector *detector;
 
 		// Used to make Flatbuffer messages...
@@ -297,9 +329,9 @@ class ServerImpl final {
 	};
 
 	// This can be run in multiple threads if needed.
-	void doFirstHalf(int gpuNum) {
+	void doFirstHalf() {
 		// Spawn a new CallData instance to serve new clients.
-		new CallData(&service, cq_.get(), &requestQueue[gpuNum], &detector[gpuNum]);
+		new CallData(&service, cq_.get(), this);
 		void* tag;  // uniquely identifies a request.
 		bool ok;
 		while (true) {
@@ -314,18 +346,21 @@ class ServerImpl final {
 		}
 	}
 
-	void doLaterHalf(int gpuNum) {
+	void doLaterHalf() {
 		while(true) {
 			WorkRequest work;
-			completionQueue[gpuNum].pop_front(work);
+			completionQueue.pop_front(work);
 			static_cast<CallData*>(work.tag)->completeRequest(work);
+			scheduler.release(work.instance);
 		}
 	}
 
-	// Darknet detector
-	AsyncDetector detector[4];
-	DetectionQueue requestQueue[4];
-	DetectionQueue completionQueue[4];
+	// Darknet detectors, one request queue each
+	network *model = nullptr;
+	std::vector<std::unique_ptr<AsyncDetector>> detectors;
+	std::vector<std::unique_ptr<DetectionQueue>> requestQueues;
+	CompletionQueue completionQueue;
+	Scheduler scheduler;
 
 	std::unique_ptr<ServerCompletionQueue> cq_;
 	ImageDetection::AsyncService service;
@@ -335,12 +370,40 @@ class ServerImpl final {
 int main(int argc, char** argv) {
 
 	if(argc < 4){
-		fprintf(stderr, "usage: %s <datacfg> <cfg> <weights>\n", argv[0]);
+		fprintf(stderr, "usage: %s <datacfg> <cfg> <weights> [-instances n] [-instance_cpus list;list;...]"
+				" [-io_threads n] [-io_cpus list] [-queue_depth n] [-max_batch n] [-max_delay ms] [-p99 ms]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	// Detector instances, each pinned to the next of the ';' separated cpu
+	// lists (on the CPU its layers run on a thread per cpu there), and the
+	// rpc threads for each half, pinned to io_cpus. An instance takes up to
+	// queue_depth requests before the scheduler stops handing it more.
+	ServerConfig config;
+	config.instances = find_int_arg(argc, argv, const_cast<char *>("-instances"), 4);
+	std::string instanceCpus = find_char_arg(argc, argv, const_cast<char *>("-instance_cpus"), const_cast<char *>(""));
+	std::stringstream cpuLists(instanceCpus);
+	for (std::string cpus; std::getline(cpuLists, cpus, ';'); )
+		if (!cpus.empty())
+			config.instanceCpus.push_back(cpus);
+	config.ioThreads = find_int_arg(argc, argv, const_cast<char *>("-io_threads"), 8);
+	config.ioCpus = find_char_arg(argc, argv, const_cast<char *>("-io_cpus"), const_cast<char *>(""));
+	config.queueDepth = find_int_arg(argc, argv, const_cast<char *>("-queue_depth"), 64);
+
+	// Batches of up to max_batch (the cfg's batch by default), held for at
+	// most max_delay for stragglers, sized to keep p99 latency under -p99.
+	// Stragglers get a quarter of the p99 budget by default, 5 ms without one.
+	config.policy.maxBatch = find_int_arg(argc, argv, const_cast<char *>("-max_batch"), 0);
+	config.policy.latencyTarget = find_float_arg(argc, argv, const_cast<char *>("-p99"), 0);
+	float maxDelay = (config.policy.latencyTarget > 0) ? config.policy.latencyTarget/4 : 5;
+	config.policy.maxDelay = find_float_arg(argc, argv, const_cast<char *>("-max_delay"), maxDelay);
+	if (config.instances < 1 || config.ioThreads < 1 || config.queueDepth < 1) {
+		fprintf(stderr, "-instances, -io_threads and -queue_depth must be at least 1\n");
 		return EXIT_FAILURE;
 	}
 
 	ServerImpl server;
-	server.Run(argc, argv);
+	server.Run(argc, argv, config);
 
 	return EXIT_SUCCESS;
 }
@@ -63,7 +63,7 @@ typedef struct {
 	int height;
 	int numChannels;
 	int widthStep;
-	float *data;
+	unsigned char *data;
 } Image;
 
 void printImage(Image &image){
@@ -83,15 +83,9 @@ Image getImageFromMat(cv::Mat *m) {
 	image.width = m->cols;
 	image.numChannels = m->channels();
 	image.widthStep = (int)m->step;
-	image.data = new float[image.height*image.width*image.numChannels]();
-
-	for(int i = 0; i < image.height; ++i){
-		for(int k= 0; k < image.numChannels; ++k){
-			for(int j = 0; j < image.width; ++j){
-				image.data[(k*image.width*image.height + i*image.width + j)] = m->data[i*image.widthStep + j*image.numChannels + k]/255.0;
-			}
-		}
-	}
+	// The server letterboxes and converts the raw BGR rows itself.
+	image.data = new unsigned char[image.height*image.widthStep];
+	memcpy(image.data, m->data, image.height*image.widthStep);
 	return image;
 }
 
@@ -123,7 +117,8 @@ class ImageDetectionClient {
 		auto requestOffset = darknetServer::CreateKeyFrame(messageBuilder,
 													image->width, image->height,
 													image->numChannels, image->widthStep,
-													messageBuilder.CreateVector<float>(image->data, image->height*image->width*image->numChannels));
+													flatbuffers::Offset<flatbuffers::Vector<float>>(),
+													messageBuilder.CreateVector(image->data, image->height*image->widthStep));
 		messageBuilder.Finish(requestOffset);
 		// grab the message, so we are the owners.
 		auto frameFBMessage = messageBuilder.ReleaseMessage<KeyFrame>();
@@ -4,11 +4,16 @@
 #include <grpcpp/grpcpp.h>
 #include <grpc/support/log.h>
 #include <thread>
-#include <queue>
+#include <deque>
+#include <vector>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
 #include <cstring>
 #include <sys/time.h>
+#include "mpmc_queue.h"
 
 extern "C" {
 	#undef __cplusplus
@@ -54,69 +59,46 @@ namespace DarknetWrapper {
 		bool cancelled;
 		image img;
 		detection *dets;
+		detection_pool *pool;
 		int nboxes;
 		int classes;
 		void *tag;
+		int instance;	// the detector the scheduler handed it to
+		// When the request reached the server, for the batcher's deadlines
+		std::chrono::steady_clock::time_point arrival;
 	} WorkRequest;
 
-	class DetectionQueue
+	// Knobs for AsyncDetector's batcher. A batch is cut once it is full, once
+	// its oldest request has waited maxDelay, or once waiting any longer would
+	// put that request over latencyTarget.
+	typedef struct
 	{
-	public:
-
-		void push_back(WorkRequest &elem) {
-			std::lock_guard<std::mutex> lock(this->mutex);
-			this->queue.push(elem);
-			this->cv.notify_one();
-		}
-
-		void push_back(std::vector<WorkRequest> &elems) {
-			std::lock_guard<std::mutex> lock(this->mutex);
-			for (auto elemIterator = elems.begin(); elemIterator != elems.end(); elemIterator++) {
-				this->queue.push(*elemIterator);
-			}
-			this->cv.notify_one();
-		}
-
-		// pops 1 element
-		void pop_front(WorkRequest &elem) {
-			std::unique_lock<std::mutex> lock(this->mutex);
-			if(this->queue.empty())
-				cv.wait(lock, [this](){ return !this->queue.empty(); });
-
-			// Once the cv wakes us up....
-			if(!this->queue.empty()) {
-				elem = (this->queue.front());
-				this->queue.pop();
-			}
-		}
-
-		// Pops upto N elements
-		void pop_front(std::vector<WorkRequest> &elems, int &numElems) {
-			std::unique_lock<std::mutex> lock(this->mutex);
-			if(this->queue.empty())
-				cv.wait(lock, [this](){ return !this->queue.empty(); });
-
-			// Once the cv wakes us up....
-			int numPopped = 0;
-			while( !this->queue.empty() && (numPopped < numElems) ) {
-				elems.insert(elems.end(), this->queue.front());
-				this->queue.pop();
-				numPopped++;
-			}
-			numElems = numPopped;
-		}
-
-	private:
-		std::queue<WorkRequest> queue;
-		std::mutex mutex;
-		std::condition_variable cv;
+		int maxBatch;		// 0 for the network's batch
+		float maxDelay;		// milliseconds
+		float latencyTarget;	// p99 in milliseconds, 0 for none
+	} BatchPolicy;
 
-	}; // class DetectionQueue
+	typedef struct
+	{
+		int size;
+		int cap;		// the batch size the batcher was aiming for
+		float wait;		// queueing delay of the oldest request, ms
+		float service;	// network time, ms
+		float p99;		// end to end over the recent window, ms
+	} BatchStats;
+
+	// Each detector is the only thread popping its request queue, so that
+	// stays a mutex queue; the io threads all pop the completion queue, so
+	// that one is the ring
+	typedef darknet::MutexQueue<WorkRequest> DetectionQueue;
+	typedef darknet::MPMCQueue<WorkRequest> CompletionQueue;
 
 	class Detector {
 	public:
 
-		void Init(int argc, char** argv, int gpuNo) {
+		// With a model, the detector runs in its own context on the model's
+		// weights (CPU only), so several detectors can share one copy.
+		void Init(int argc, char** argv, int gpuNo, network *model = nullptr) {
 			// Initialization: Load config files, labels, graph, etc.,
 			// Config the GPU and get into a thread that is ready to accept
 			// images for detection.
@@ -127,29 +109,64 @@ namespace DarknetWrapper {
 			char *cfgfile = argv[2];
 			char *weightfile = argv[3];
 
-			this->net = load_network(cfgfile, weightfile, 0);
+			if (model != nullptr)
+				this->net = make_network_context(model);
+			else
+				this->net = load_network_inference(cfgfile, weightfile);
+			this->maxBatch = this->net->batch;
+			// thresh=, nms=, nms_kind=, top_k=, max_detections= in the cfg's [net];
+			// without nms= the server keeps its do_nms_obj at .4
+			this->params = this->net->detection;
+			default_detection_params(&this->params, .4, 0);
 			this->gpuBufferInit = false;
 
 			this->numNetworkOutputs = this->sizeNetwork();
 			this->predictions = new float[numNetworkOutputs];
 			this->average = new float[numNetworkOutputs];
+
+			// Enough input slabs for one batch in flight and the next filling up
+			for (int i = 0; i < 2*this->maxBatch; i++)
+				this->freeSlabs.push_back(this->allocSlab());
 		}
 
 		void Shutdown() {
 			// Free any darknet resources held. Close the GPU connection, etc...
 			delete this->predictions;
 			delete this->average;
+			for (auto pool : this->freePools)
+				free_detection_pool(pool);
+			this->freePools.clear();
+			for (auto slab : this->slabs) {
+				#ifdef GPU
+				cudaFreeHost(slab);
+				#else
+				free(slab);
+				#endif
+			}
+			this->slabs.clear();
+			this->freeSlabs.clear();
 			free_network(this->net);
 		}
 
 		image convertImage(const darknetServer::KeyFrame *frame) {
-			image newImage;
+			// Frames with as many channels as the network takes are letterboxed
+			// into one of the detector's input slabs
+			image boxed;
+			if (frame->numChannels() == net->c)
+				boxed = float_to_image(net->w, net->h, net->c, this->acquireSlab());
+			else
+				boxed = make_image(net->w, net->h, frame->numChannels());
+
+			// Raw 8 bit frames go straight to a letterboxed network input in one pass
+			if (frame->pixels() != nullptr) {
+				letterbox_bytes_into(const_cast<unsigned char *>(frame->pixels()->data()), frame->width(), frame->height(),
+						frame->numChannels(), frame->widthStep(), 1, boxed);
+				return boxed;
+			}
 
-			// ==== Convert to the right format ====
-			// Allocate memory for data in 'image', based on the size of 'data' in frame
-			newImage.data = new float[frame->data()->size()];
+			image newImage;
 
-			// Copy from the frame in elem to the 'image' format that darknet uses internally...
+			// Point the 'image' format that darknet uses internally at the frame's floats...
 			this->convertFrameToImage(frame, &newImage);
 
 			//save_image(newImage, "recieved");
@@ -160,12 +177,21 @@ namespace DarknetWrapper {
 
 			// Scale the image to 410x410 retaining the original aspect ratio,
 			// and add black borders (letter-boxing) around the scaled image
-			return letterbox_image(newImage, net->w, net->h);
+			letterbox_image_into(newImage, net->w, net->h, boxed);
+			return boxed;
+		}
+
+		int batchSize() {
+			return this->maxBatch;
+		}
+
+		// Runs this detector's layers on a pool of its own, one thread
+		// pinned to each of cpus (a list like "0-3,8"). CPU only.
+		void pinThreads(char *cpus) {
+			set_network_threads(this->net, 0, cpus, 1);
 		}
 
 		void doDetection(WorkRequest &elem) {
-			float nms = .4;
-			set_batch_network(net, 1);
 			layer l = net->layers[net->n-1];
 
 			 // ==== Now we finally run the actual network ====
@@ -190,13 +216,10 @@ namespace DarknetWrapper {
 			if (elem.cancelled == true)
 				return;
 
-			network_predict(net, elem.img.data);
-			elem.dets = get_network_boxes(this->net, elem.img.w, elem.img.h, 0.5, 0.5, 0, 1, &(elem.nboxes));
-
-			// What the hell does this do?
-			if (nms > 0) {
-				do_nms_obj(elem.dets, elem.nboxes, l.classes, nms);
-			}
+			network_predict_batch(net, &elem.img, 1);
+			elem.pool = this->acquirePool();
+			elem.dets = get_network_boxes_pooled(this->net, elem.pool, 0, elem.img.w, elem.img.h, params.thresh, 0.5, 0, 1, &(elem.nboxes));
+			postprocess_detections(elem.dets, elem.nboxes, l.classes, params);
 
 			elem.classes = l.classes;
 			elem.done = true;
@@ -204,32 +227,10 @@ namespace DarknetWrapper {
 			std::cout << elem.tag << " GPU processing took " << probe_time_end2(&ts_gpu) << " milliseconds"<< std::endl;
 		}
 
+		// numImages can be at most batchSize()
 		void doDetection(std::vector<WorkRequest> &elems, int numImages) {
-
-			std::cout << "doDetection: new batch request. Batch Size = " << numImages << std::endl;
-			probe_time_start2(&ts_detect);
-
-			// Save the address of the l.output for YOLO layers so we can restore it later.
-			// What a dirty hack...
-			this->saveBaseOutput();
-
-			float nms = .4;
-			set_batch_network(net, numImages);
 			layer l = net->layers[net->n-1];
 
-			int bufferSize = 0;
-
-			for (int elemNum = 0; elemNum < numImages; elemNum++)
-				bufferSize += net->h*net->w*elems[elemNum].img.c;
-
-			// Copy all the images into 1 buffer.
-			float *dataToProcess = new float[bufferSize*sizeof(float)];
-			for (int elemNum = 0 ; elemNum < numImages; elemNum++) {
-				int imgSize = net->h*net->w*elems[elemNum].img.c;
-				std::memcpy(dataToProcess+elemNum*imgSize, elems[elemNum].img.data,
-							imgSize*sizeof(float));
-			}
-
 			// If at least one of the images is not cancelled, go through with it...
 			bool process = false;
 			for (int elemNum = 0 ; elemNum < numImages; elemNum++) {
@@ -241,80 +242,98 @@ namespace DarknetWrapper {
 			if (!process)
 				return;
 
-			 // Now we finally run the actual network
-			probe_time_start2(&ts_gpu);
+			std::vector<image> images(numImages);
+			for (int elemNum = 0 ; elemNum < numImages; elemNum++)
+				images[elemNum] = elems[elemNum].img;
 
-			network_predict(net, dataToProcess);
+			 // Now we finally run the actual network
+			network_predict_batch(net, images.data(), numImages);
 
-			// Copy the detected boxes into the appropriate WorkRequest
+			// Hand each image its own detections
 			for (int elemNum = 0 ; elemNum < numImages; elemNum++) {
-				elems[elemNum].dets = get_network_boxes(this->net, elems[elemNum].img.w, elems[elemNum].img.h,0.5, 0.5, 0, 1, &(elems[elemNum].nboxes));
-				// What the hell does this do?
-				if (nms > 0) {
-					do_nms_obj(elems[elemNum].dets, elems[elemNum].nboxes, l.classes, nms);
-				}
-				// Darknet batching is kinda broken.
-				// Gotta do this nonsense to set the l.output to the right address
-				shiftOutput();
+				elems[elemNum].pool = this->acquirePool();
+				elems[elemNum].dets = get_network_boxes_pooled(this->net, elems[elemNum].pool, elemNum,
+						images[elemNum].w, images[elemNum].h, params.thresh, 0.5, 0, 1, &(elems[elemNum].nboxes));
+				postprocess_detections(elems[elemNum].dets, elems[elemNum].nboxes, l.classes, params);
 				elems[elemNum].classes = l.classes;
 				elems[elemNum].done = true;
-
 			}
-			restoreOutputAddr();
-			delete dataToProcess;
+		}
 
-			std::cout << "Batch GPU processing took " << probe_time_end2(&ts_gpu) << " milliseconds"<< std::endl;
-			std::cout << " doDetection: took " << probe_time_end2(&ts_detect) << " milliseconds"<< std::endl;
+		// What goes on the wire: the best class of every detection over the
+		// threshold, best first. out needs room for elem.nboxes.
+		int compactDetections(WorkRequest &elem, compact_detection *out) {
+			return compact_detections(elem.dets, elem.nboxes, elem.classes, params.thresh, out);
 		}
 
-	private:
-		void convertFrameToImage(const darknetServer::KeyFrame *frame, image *newImage) {
-			newImage->w = frame->width();
-			newImage->h = frame->height();
-			newImage->c = frame->numChannels();
-			newImage->data =  const_cast<float *>(frame->data()->data());
+		// Detections are built in pools that go back to the detector once the
+		// response has been written, instead of being freed. The letterboxed
+		// image is done with too, its slab going back for the next request.
+		void releaseDetections(WorkRequest &elem) {
+			if (elem.img.data != nullptr && elem.img.c == this->net->c)
+				this->releaseSlab(elem.img.data);
+			else
+				free_image(elem.img);
+			elem.img.data = nullptr;
+			if (elem.pool == nullptr)
+				return;
+			reset_detection_pool(elem.pool);
+			std::lock_guard<std::mutex> lock(this->poolMutex);
+			this->freePools.push_back(elem.pool);
+			elem.pool = nullptr;
+			elem.dets = nullptr;
 		}
 
-		// Helper functions from https://gist.github.com/ElPatou/706a6ff36b2dce1f492007e87bcd2a0c
-		void saveBaseOutput() {
-			int num = 0;
-			for(int i = 0; i < net->n; ++i) {
-				layer *l = &(net->layers[i]);
-				if (l->type == YOLO) {
-					num++;
-				}
-			}
+	private:
+		detection_pool *acquirePool() {
+			std::lock_guard<std::mutex> lock(this->poolMutex);
+			if (this->freePools.empty())
+				return make_detection_pool(this->net);
+			detection_pool *pool = this->freePools.back();
+			this->freePools.pop_back();
+			return pool;
+		}
 
-			baseOutput = (float **)calloc(num, sizeof(float **));
+		// Slabs hold one letterboxed network input. They are page-locked on
+		// the GPU and faulted in up front on the CPU, and only ever reused.
+		float *allocSlab() {
+			float *slab = nullptr;
+			size_t size = this->net->inputs*sizeof(float);
+			#ifdef GPU
+			if (cudaHostAlloc((void **)&slab, size, cudaHostAllocDefault) != cudaSuccess)
+				error("Couldn't allocate a pinned input slab");
+			#else
+			if (posix_memalign((void **)&slab, 64, size))
+				error("Couldn't allocate an input slab");
+			#endif
+			memset(slab, 0, size);
+			std::lock_guard<std::mutex> lock(this->slabMutex);
+			this->slabs.push_back(slab);
+			return slab;
+		}
 
-			int k = 0;
-			for(int i = 0; i < net->n; ++i) {
-				layer *l = &(net->layers[i]);
-				if (l->type == YOLO) {
-					baseOutput[k] = l->output;
-					k++;
+		float *acquireSlab() {
+			{
+				std::lock_guard<std::mutex> lock(this->slabMutex);
+				if (!this->freeSlabs.empty()) {
+					float *slab = this->freeSlabs.back();
+					this->freeSlabs.pop_back();
+					return slab;
 				}
 			}
+			return this->allocSlab();
 		}
 
-		void restoreOutputAddr() {
-			int k = 0;
-			for(int i = 0; i < net->n; ++i) {
-				layer *l = &(net->layers[i]);
-				if (l->type == YOLO) {
-					l->output = baseOutput[k];
-					k++;
-				}
-			}
+		void releaseSlab(float *slab) {
+			std::lock_guard<std::mutex> lock(this->slabMutex);
+			this->freeSlabs.push_back(slab);
 		}
 
-		void shiftOutput() {
-			for(int i = 0; i < net->n; ++i) {
-				layer *l = &(net->layers[i]);
-				if (l->type == YOLO) {
-					l->output += l->outputs;
-				}
-			}
+		void convertFrameToImage(const darknetServer::KeyFrame *frame, image *newImage) {
+			newImage->w = frame->width();
+			newImage->h = frame->height();
+			newImage->c = frame->numChannels();
+			newImage->data =  const_cast<float *>(frame->data()->data());
 		}
 
 		// Helper functions stolen from demo.c
@@ -331,7 +350,6 @@ namespace DarknetWrapper {
 		}
 
 		// All the darknet globals.
-		struct timestamp ts_detect;
 		struct timestamp ts_gpu;
 		float *predictions;
 		float *average;
@@ -340,19 +358,45 @@ namespace DarknetWrapper {
 		int nboxes;
 		network *net;
 		int numNetworkOutputs;
-
-		float **baseOutput;
+		int maxBatch;
+		detection_params params;
+		std::vector<detection_pool *> freePools;
+		std::mutex poolMutex;
+		std::vector<float *> slabs;
+		std::vector<float *> freeSlabs;
+		std::mutex slabMutex;
 
 	}; // class Detector
 
+	// Runs the detector on batches cut from its request queue. With a latency
+	// target the batch size adapts to the p99 latency seen over the last few
+	// hundred requests, growing under a backlog while bigger batches are
+	// cheaper per image and shrinking when the batch itself is too slow.
 	class AsyncDetector : Detector
 	{
 	  public:
-		void Init(int argc, char** argv, DetectionQueue *requestQueue, DetectionQueue *completionQueue, int gpuNo) {
+		void Init(int argc, char** argv, DetectionQueue *requestQueue, CompletionQueue *completionQueue, int gpuNo,
+				network *model = nullptr, BatchPolicy policy = BatchPolicy()) {
 			// Store pointers to the workQueues
 			this->requestQueue = requestQueue;
 			this->completionQueue = completionQueue;
-			Detector::Init(argc, argv, gpuNo);
+			Detector::Init(argc, argv, gpuNo, model);
+
+			// Batches can't outgrow the cfg's batch=, which the network was built for
+			if (policy.maxBatch > Detector::batchSize())
+				std::cerr << "max batch " << policy.maxBatch << " is over the network's batch, using "
+						<< Detector::batchSize() << std::endl;
+			if (policy.maxBatch <= 0 || policy.maxBatch > Detector::batchSize())
+				policy.maxBatch = Detector::batchSize();
+			this->policy = policy;
+			this->cap = (policy.latencyTarget > 0) ? 1 : policy.maxBatch;
+			this->service.assign(policy.maxBatch + 1, 0);
+			this->latencies.assign(LATENCY_WINDOW, 0);
+			this->numLatencies = 0;
+			this->sinceAdjust = 0;
+			this->totalBatches = 0;
+			this->totalImages = 0;
+			this->cost.store(0, std::memory_order_relaxed);
 		}
 
 		void Shutdown() {
@@ -366,25 +410,36 @@ namespace DarknetWrapper {
 			return Detector::convertImage(frame);
 		}
 
+		int compactDetections(WorkRequest &elem, compact_detection *out) {
+			return Detector::compactDetections(elem, out);
+		}
+
+		void releaseDetections(WorkRequest &elem) {
+			Detector::releaseDetections(elem);
+		}
+
 		void doDetection() {
 			std::vector<WorkRequest> elems;
-			elems.reserve(4);
+			elems.reserve(this->policy.maxBatch);
 			while(true) {
-				int numImages = 4;
+				int batch = this->cap;
+				int numImages = batch;
 
-				// Wait on the requestQueue
+				// Wait on the requestQueue for the first request, then give the
+				// batch until its deadline to fill up
 				requestQueue->pop_front(elems, numImages);
+				auto deadline = this->batchDeadline(elems[0].arrival, batch);
+				while (numImages < batch && std::chrono::steady_clock::now() < deadline) {
+					int more = batch - numImages;
+					requestQueue->pop_front_until(elems, more, deadline);
+					numImages += more;
+				}
 
 				// Do the detection
-				// For N=1, and N=2, just fall back to the 1 image at a time step.
-				if (numImages == 1) {
-					Detector::doDetection(elems[0]);
-				} else if (numImages == 2) {
-					Detector::doDetection(elems[0]);
-					Detector::doDetection(elems[1]);
-				} else{
-					Detector::doDetection(elems, numImages);
-				}
+				auto start = std::chrono::steady_clock::now();
+				Detector::doDetection(elems, numImages);
+				auto end = std::chrono::steady_clock::now();
+				this->recordBatch(elems, numImages, batch, start, end);
 
 				// Put the result back on the completionQueue.
 				completionQueue->push_back(elems);
@@ -394,11 +449,172 @@ namespace DarknetWrapper {
 			}
 		}
 
+		// Smoothed network time per image in milliseconds, 0 before the
+		// first batch.
+		float imageCost() {
+			return this->cost.load(std::memory_order_relaxed);
+		}
+
+		void pinThreads(char *cpus) {
+			Detector::pinThreads(cpus);
+		}
+
+		// The most recent batches, oldest first, and the totals so far.
+		void batchStats(std::vector<BatchStats> &recent, long &batches, long &images) {
+			std::lock_guard<std::mutex> lock(this->statsMutex);
+			recent.assign(this->history.begin(), this->history.end());
+			batches = this->totalBatches;
+			images = this->totalImages;
+		}
+
 	  private:
+		static const int LATENCY_WINDOW = 256;
+		static const int STATS_HISTORY = 256;
+
+		static float milliseconds(std::chrono::steady_clock::duration d) {
+			return std::chrono::duration<float, std::milli>(d).count();
+		}
+
+		std::chrono::steady_clock::time_point batchDeadline(std::chrono::steady_clock::time_point oldest, int batch) {
+			float wait = this->policy.maxDelay;
+			if (this->policy.latencyTarget > 0)
+				wait = std::min(wait, this->policy.latencyTarget - this->service[batch]);
+			wait = std::max(wait, 0.f);
+			return oldest + std::chrono::microseconds((long)(wait*1000));
+		}
+
+		void recordBatch(std::vector<WorkRequest> &elems, int numImages, int batch,
+				std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+			BatchStats stats;
+			stats.size = numImages;
+			stats.cap = batch;
+			stats.wait = milliseconds(start - elems[0].arrival);
+			stats.service = milliseconds(end - start);
+
+			// A full batch whose oldest request sat through a good part of the
+			// previous batch means there is a backlog
+			bool backlog = numImages == batch && stats.wait > .5f*this->service[batch];
+
+			// Network time by batch size, smoothed
+			float &s = this->service[numImages];
+			s = (s == 0) ? stats.service : .8f*s + .2f*stats.service;
+			float perImage = stats.service/numImages;
+			float cost = this->cost.load(std::memory_order_relaxed);
+			this->cost.store((cost == 0) ? perImage : .8f*cost + .2f*perImage, std::memory_order_relaxed);
+
+			for (int i = 0; i < numImages; i++)
+				this->latencies[this->numLatencies++ % LATENCY_WINDOW] = milliseconds(end - elems[i].arrival);
+			int n = (int)std::min(this->numLatencies, (long)LATENCY_WINDOW);
+			std::vector<float> sorted(this->latencies.begin(), this->latencies.begin() + n);
+			std::nth_element(sorted.begin(), sorted.begin() + n*99/100, sorted.end());
+			stats.p99 = sorted[n*99/100];
+
+			// Only move the cap once a good part of the window reflects the last move
+			this->sinceAdjust += numImages;
+			float target = this->policy.latencyTarget;
+			if (target > 0 && this->sinceAdjust >= LATENCY_WINDOW/8) {
+				// With a backlog the queue rather than the batch is what costs
+				// latency, and a bigger batch drains it faster, as long as it is
+				// cheaper per image.
+				bool grow = batch < this->policy.maxBatch &&
+						(this->service[batch+1] == 0 || this->service[batch+1]/(batch+1) < this->service[batch]/batch);
+				bool shrink = batch > 1 && (!backlog ||
+						(this->service[batch-1] > 0 && this->service[batch-1]/(batch-1) <= this->service[batch]/batch));
+				int cap = batch;
+				if (stats.p99 > target)
+					cap = (backlog && grow) ? batch + 1 : shrink ? std::max(1, batch - std::max(1, batch/4)) : batch;
+				else if (stats.p99 < .8f*target && backlog && grow)
+					cap = batch + 1;
+				if (cap != batch) {
+					this->cap = cap;
+					this->sinceAdjust = 0;
+				}
+			}
+
+			std::lock_guard<std::mutex> lock(this->statsMutex);
+			this->history.push_back(stats);
+			if ((int)this->history.size() > STATS_HISTORY)
+				this->history.pop_front();
+			this->totalBatches++;
+			this->totalImages += numImages;
+		}
+
 		DetectionQueue *requestQueue;
-		DetectionQueue *completionQueue;
+		CompletionQueue *completionQueue;
+
+		BatchPolicy policy;
+		int cap;
+		std::vector<float> service;
+		std::vector<float> latencies;
+		long numLatencies;
+		int sinceAdjust;
+
+		std::atomic<float> cost;
+
+		std::deque<BatchStats> history;
+		long totalBatches;
+		long totalImages;
+		std::mutex statsMutex;
 	};
 
+	// Hands each request to the detector instance expected to finish it
+	// first: the least work already outstanding on it, weighed by what an
+	// image has lately been costing that instance, so a slow replica gets
+	// fewer. Each instance takes at most depth outstanding requests; past
+	// that acquire() waits for one to complete, pushing back on the callers.
+	class Scheduler
+	{
+	  public:
+		void Init(std::vector<AsyncDetector *> &detectors, int depth) {
+			this->detectors = detectors;
+			this->depth = depth;
+			this->outstanding.assign(detectors.size(), 0);
+		}
+
+		// Counts the request against the instance returned until release()
+		int acquire() {
+			std::unique_lock<std::mutex> lock(this->mutex);
+			int instance;
+			while ((instance = this->pick()) < 0)
+				this->cv.wait(lock);
+			this->outstanding[instance]++;
+			return instance;
+		}
+
+		void release(int instance) {
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				this->outstanding[instance]--;
+			}
+			this->cv.notify_one();
+		}
+
+	  private:
+		// An instance that has yet to run a batch costs 0, so the idle ones
+		// get tried first and ties go to the shortest queue.
+		int pick() {
+			int best = -1;
+			float bestFinish = 0;
+			for (int i = 0; i < (int)this->detectors.size(); i++) {
+				if (this->outstanding[i] >= this->depth)
+					continue;
+				float finish = (this->outstanding[i] + 1)*this->detectors[i]->imageCost();
+				if (best < 0 || finish < bestFinish ||
+						(finish == bestFinish && this->outstanding[i] < this->outstanding[best])) {
+					best = i;
+					bestFinish = finish;
+				}
+			}
+			return best;
+		}
+
+		std::vector<AsyncDetector *> detectors;
+		std::vector<int> outstanding;
+		int depth;
+		std::mutex mutex;
+		std::condition_variable cv;
+	}; // class Scheduler
+
 } // namespace DarknetWrapper
 
 #endif // DARKNET_WRAPPER_CPP
@@ -0,0 +1,105 @@
+// Contention benchmark for the request and completion queues: half the
+// threads push, the other half pop (one thread does both), for the mutex
+// queue and the lock-free ring, with blocking, spinning and batched pops.
+//
+// usage: queue_benchmark [items per thread count] [max threads]
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+
+#include "mpmc_queue.h"
+
+using darknet::MPMCQueue;
+using darknet::MutexQueue;
+using darknet::QueueWait;
+
+enum Mode { BLOCK, SPIN, BATCH };
+static const int BATCH_SIZE = 16;
+
+static QueueWait waitFor(Mode mode) {
+	return mode == SPIN ? QueueWait::Spin : QueueWait::Block;
+}
+
+template <class Q> static bool push(Q &q, long elem, Mode mode) { return q.push_back(elem, waitFor(mode)); }
+template <class Q> static bool pop(Q &q, long &elem, Mode mode) { return q.pop_front(elem, waitFor(mode)); }
+template <class Q> static int popBatch(Q &q, std::vector<long> &elems, int n) { q.pop_front(elems, n); return n; }
+
+// Millions of pushes plus pops per second
+template <class Q>
+static double run(int threads, long items, Mode mode) {
+	Q q;
+	long sum = 0;
+	auto start = std::chrono::steady_clock::now();
+	if (threads == 1) {
+		long elem;
+		for (long i = 0; i < items; i++) {
+			push(q, i, mode);
+			pop(q, elem, mode);
+			sum += elem;
+		}
+	} else {
+		int producers = threads/2;
+		int consumers = threads - producers;
+		std::vector<std::thread> workers;
+		std::vector<long> sums(consumers);
+		for (int p = 0; p < producers; p++) {
+			workers.push_back(std::thread([&, p]() {
+				for (long i = p; i < items; i += producers)
+					push(q, i, mode);
+			}));
+		}
+		for (int c = 0; c < consumers; c++) {
+			workers.push_back(std::thread([&, c]() {
+				long share = items/consumers + (c < items%consumers);
+				long total = 0;
+				std::vector<long> elems;
+				elems.reserve(BATCH_SIZE);
+				while (share > 0) {
+					if (mode == BATCH) {
+						elems.clear();
+						int n = popBatch(q, elems, (int)std::min<long>(share, BATCH_SIZE));
+						for (int i = 0; i < n; i++)
+							total += elems[i];
+						share -= n;
+					} else {
+						long elem;
+						pop(q, elem, mode);
+						total += elem;
+						share--;
+					}
+				}
+				sums[c] = total;
+			}));
+		}
+		for (auto &worker : workers)
+			worker.join();
+		for (auto s : sums)
+			sum += s;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (sum != items*(items - 1)/2)
+		std::cerr << "lost elements with " << threads << " threads" << std::endl;
+	return 2*items/seconds/1e6;
+}
+
+int main(int argc, char **argv) {
+	long items = (argc > 1) ? atol(argv[1]) : 1000000;
+	int maxThreads = (argc > 2) ? atoi(argv[2]) : 64;
+
+	std::cout << "threads  mutex block  mutex spin  mpmc block   mpmc spin  mutex batch  mpmc batch  (Mops/s)" << std::endl;
+	for (int threads = 1; threads <= maxThreads; threads *= 2) {
+		std::cout << std::setw(7) << threads << std::fixed << std::setprecision(2)
+				<< std::setw(13) << run<MutexQueue<long>>(threads, items, BLOCK)
+				<< std::setw(12) << run<MutexQueue<long>>(threads, items, SPIN)
+				<< std::setw(12) << run<MPMCQueue<long>>(threads, items, BLOCK)
+				<< std::setw(12) << run<MPMCQueue<long>>(threads, items, SPIN)
+				<< std::setw(13) << run<MutexQueue<long>>(threads, items, BATCH)
+				<< std::setw(12) << run<MPMCQueue<long>>(threads, items, BATCH)
+				<< std::endl;
+	}
+	return 0;
+}
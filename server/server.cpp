@@ -58,6 +58,7 @@ class ServiceImpl final : public ImageDetection::Service {
 		work.tag = this;
 		work.img = detector.convertImage(requestMessage->GetRoot());
 		work.dets = nullptr;
+		work.pool = nullptr;
 		work.nboxes = 0;
 		work.classes = 0;
 
@@ -68,19 +69,13 @@ class ServiceImpl final : public ImageDetection::Service {
 		GPR_ASSERT(work.done == true);
 		GPR_ASSERT(work.dets != nullptr);
 
-		std::vector<flatbuffers::Offset<DetectedObject>> objects;
-		int numObjects = 0;
-		for (int i = 0; i < work.nboxes; i++) {
-			if(work.dets[i].objectness == 0) continue;
-			bbox box(work.dets[i].bbox.x, work.dets[i].bbox.y, work.dets[i].bbox.w, work.dets[i].bbox.h);
-		//	std::cout << work.dets[i].bbox.x <<" " <<work.dets[i].bbox.y <<" " << work.dets[i].bbox.w <<" " <<work.dets[i].bbox.h <<std::endl;
-			std::vector<float> prob;
-			for (int j = 0; j < work.classes; j++) {
-				prob.push_back(work.dets[i].prob[j]);
-			}
-			auto objectOffset = darknetServer::CreateDetectedObjectDirect(messageBuilder, &box, work.dets[i].classes, work.dets[i].objectness, work.dets[i].sort_class, &prob);
-			objects.push_back(objectOffset);
-			numObjects++;
+		std::vector<compact_detection> compact(work.nboxes);
+		int numObjects = detector.compactDetections(work, compact.data());
+		std::vector<DetectedObject> objects;
+		objects.reserve(numObjects);
+		for (int i = 0; i < numObjects; i++) {
+			bbox box(compact[i].bbox.x, compact[i].bbox.y, compact[i].bbox.w, compact[i].bbox.h);
+			objects.push_back(DetectedObject(box, compact[i].class_id, compact[i].score));
 		}
 
 		flatbuffers::Offset<DetectedObjects> detectedObjectsOffset = darknetServer::CreateDetectedObjectsDirect(messageBuilder, numObjects, &objects);
@@ -90,7 +85,7 @@ class ServiceImpl final : public ImageDetection::Service {
 		assert(responseMessage->Verify());
 
 		// Clean up
-		free_detections(work.dets, work.nboxes);
+		detector.releaseDetections(work);
 
 		std::cout << work.tag << "Server took " << probe_time_end2(&ts_server) << " milliseconds"<< std::endl;
 		return Status::OK;
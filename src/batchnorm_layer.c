@@ -3,7 +3,7 @@
 #include "blas.h"
 #include <stdio.h>
 
-layer make_batchnorm_layer(int batch, int w, int h, int c)
+layer make_batchnorm_layer(int batch, int w, int h, int c, int inference)
 {
     fprintf(stderr, "Batch Normalization Layer: %d x %d x %d image\n", w,h,c);
     layer l = {0};
@@ -13,21 +13,23 @@ layer make_batchnorm_layer(int batch, int w, int h, int c)
     l.w = l.out_w = w;
     l.c = l.out_c = c;
     l.output = calloc(h * w * c * batch, sizeof(float));
-    l.delta  = calloc(h * w * c * batch, sizeof(float));
+    if(!inference) l.delta  = calloc(h * w * c * batch, sizeof(float));
     l.inputs = w*h*c;
     l.outputs = l.inputs;
 
     l.scales = calloc(c, sizeof(float));
-    l.scale_updates = calloc(c, sizeof(float));
+    if(!inference) l.scale_updates = calloc(c, sizeof(float));
     l.biases = calloc(c, sizeof(float));
-    l.bias_updates = calloc(c, sizeof(float));
+    if(!inference) l.bias_updates = calloc(c, sizeof(float));
     int i;
     for(i = 0; i < c; ++i){
         l.scales[i] = 1;
     }
 
-    l.mean = calloc(c, sizeof(float));
-    l.variance = calloc(c, sizeof(float));
+    if(!inference){
+        l.mean = calloc(c, sizeof(float));
+        l.variance = calloc(c, sizeof(float));
+    }
 
     l.rolling_mean = calloc(c, sizeof(float));
     l.rolling_variance = calloc(c, sizeof(float));
@@ -135,8 +137,8 @@ void resize_batchnorm_layer(layer *layer, int w, int h)
 void forward_batchnorm_layer(layer l, network net)
 {
     if(l.type == BATCHNORM) copy_cpu(l.outputs*l.batch, net.input, 1, l.output, 1);
-    copy_cpu(l.outputs*l.batch, l.output, 1, l.x, 1);
     if(net.train){
+        copy_cpu(l.outputs*l.batch, l.output, 1, l.x, 1);
         mean_cpu(l.output, l.batch, l.out_c, l.out_h*l.out_w, l.mean);
         variance_cpu(l.output, l.mean, l.batch, l.out_c, l.out_h*l.out_w, l.variance);
 
@@ -1,4 +1,5 @@
 #include "blas.h"
+#include "parallel.h"
 
 #include <math.h>
 #include <assert.h>
@@ -65,6 +66,33 @@ void weighted_delta_cpu(float *a, float *b, float *s, float *da, float *db, floa
     }
 }
 
+typedef struct{
+    int w1, h1, c1;
+    float *add;
+    int w2, h2, c2;
+    float s1, s2;
+    float *out;
+    int stride, sample;
+    int minw, minh, minc;
+} shortcut_args;
+
+static void shortcut_planes(void *ptr, int begin, int end)
+{
+    shortcut_args *a = ptr;
+    int i,j,p;
+    for(p = begin; p < end; ++p){
+        int b = p / a->minc;
+        int k = p % a->minc;
+        for(j = 0; j < a->minh; ++j){
+            for(i = 0; i < a->minw; ++i){
+                int out_index = i*a->sample + a->w2*(j*a->sample + a->h2*(k + a->c2*b));
+                int add_index = i*a->stride + a->w1*(j*a->stride + a->h1*(k + a->c1*b));
+                a->out[out_index] = a->s1*a->out[out_index] + a->s2*a->add[add_index];
+            }
+        }
+    }
+}
+
 void shortcut_cpu(int batch, int w1, int h1, int c1, float *add, int w2, int h2, int c2, float s1, float s2, float *out)
 {
     int stride = w1/w2;
@@ -77,18 +105,8 @@ void shortcut_cpu(int batch, int w1, int h1, int c1, float *add, int w2, int h2,
     int minh = (h1 < h2) ? h1 : h2;
     int minc = (c1 < c2) ? c1 : c2;
 
-    int i,j,k,b;
-    for(b = 0; b < batch; ++b){
-        for(k = 0; k < minc; ++k){
-            for(j = 0; j < minh; ++j){
-                for(i = 0; i < minw; ++i){
-                    int out_index = i*sample + w2*(j*sample + h2*(k + c2*b));
-                    int add_index = i*stride + w1*(j*stride + h1*(k + c1*b));
-                    out[out_index] = s1*out[out_index] + s2*add[add_index];
-                }
-            }
-        }
-    }
+    shortcut_args a = {w1, h1, c1, add, w2, h2, c2, s1, s2, out, stride, sample, minw, minh, minc};
+    parallel_for(batch*minc, parallel_grain(minw*minh), shortcut_planes, &a);
 }
 
 void mean_cpu(float *x, int batch, int filters, int spatial, float *mean)
@@ -144,19 +162,30 @@ void l2normalize_cpu(float *x, float *dx, int batch, int filters, int spatial)
 }
 
 
-void normalize_cpu(float *x, float *mean, float *variance, int batch, int filters, int spatial)
+typedef struct{
+    float *x, *mean, *variance;
+    int filters, spatial;
+} normalize_args;
+
+static void normalize_planes(void *ptr, int begin, int end)
 {
-    int b, f, i;
-    for(b = 0; b < batch; ++b){
-        for(f = 0; f < filters; ++f){
-            for(i = 0; i < spatial; ++i){
-                int index = b*filters*spatial + f*spatial + i;
-                x[index] = (x[index] - mean[f])/(sqrt(variance[f]) + .000001f);
-            }
+    normalize_args *a = ptr;
+    int p, i;
+    for(p = begin; p < end; ++p){
+        int f = p % a->filters;
+        float *x = a->x + (size_t)p*a->spatial;
+        for(i = 0; i < a->spatial; ++i){
+            x[i] = (x[i] - a->mean[f])/(sqrt(a->variance[f]) + .000001f);
         }
     }
 }
 
+void normalize_cpu(float *x, float *mean, float *variance, int batch, int filters, int spatial)
+{
+    normalize_args a = {x, mean, variance, filters, spatial};
+    parallel_for(batch*filters, parallel_grain(spatial), normalize_planes, &a);
+}
+
 void const_cpu(int N, float ALPHA, float *X, int INCX)
 {
     int i;
@@ -331,21 +360,37 @@ void softmax_cpu(float *input, int n, int batch, int batch_offset, int groups, i
     }
 }
 
-void upsample_cpu(float *in, int w, int h, int c, int batch, int stride, int forward, float scale, float *out)
+typedef struct{
+    float *in;
+    int w, h, stride, forward;
+    float scale;
+    float *out;
+} upsample_args;
+
+// planes are independent, so backward accumulation doesn't race
+static void upsample_planes(void *ptr, int begin, int end)
 {
-    int i, j, k, b;
-    for(b = 0; b < batch; ++b){
-        for(k = 0; k < c; ++k){
-            for(j = 0; j < h*stride; ++j){
-                for(i = 0; i < w*stride; ++i){
-                    int in_index = b*w*h*c + k*w*h + (j/stride)*w + i/stride;
-                    int out_index = b*w*h*c*stride*stride + k*w*h*stride*stride + j*w*stride + i;
-                    if(forward) out[out_index] = scale*in[in_index];
-                    else in[in_index] += scale*out[out_index];
-                }
+    upsample_args *a = ptr;
+    int w = a->w, h = a->h, stride = a->stride;
+    int i, j, p;
+    for(p = begin; p < end; ++p){
+        float *in = a->in + (size_t)p*w*h;
+        float *out = a->out + (size_t)p*w*h*stride*stride;
+        for(j = 0; j < h*stride; ++j){
+            for(i = 0; i < w*stride; ++i){
+                int in_index = (j/stride)*w + i/stride;
+                int out_index = j*w*stride + i;
+                if(a->forward) out[out_index] = a->scale*in[in_index];
+                else in[in_index] += a->scale*out[out_index];
             }
         }
     }
 }
 
+void upsample_cpu(float *in, int w, int h, int c, int batch, int stride, int forward, float scale, float *out)
+{
+    upsample_args a = {in, w, h, stride, forward, scale, out};
+    parallel_for(batch*c, parallel_grain(w*h*stride*stride), upsample_planes, &a);
+}
+
 
@@ -3,91 +3,6 @@
 #include <math.h>
 #include <stdlib.h>
 
-int nms_comparator(const void *pa, const void *pb)
-{
-    detection a = *(detection *)pa;
-    detection b = *(detection *)pb;
-    float diff = 0;
-    if(b.sort_class >= 0){
-        diff = a.prob[b.sort_class] - b.prob[b.sort_class];
-    } else {
-        diff = a.objectness - b.objectness;
-    }
-    if(diff < 0) return 1;
-    else if(diff > 0) return -1;
-    return 0;
-}
-
-void do_nms_obj(detection *dets, int total, int classes, float thresh)
-{
-    int i, j, k;
-    k = total-1;
-    for(i = 0; i <= k; ++i){
-        if(dets[i].objectness == 0){
-            detection swap = dets[i];
-            dets[i] = dets[k];
-            dets[k] = swap;
-            --k;
-            --i;
-        }
-    }
-    total = k+1;
-
-    for(i = 0; i < total; ++i){
-        dets[i].sort_class = -1;
-    }
-
-    qsort(dets, total, sizeof(detection), nms_comparator);
-    for(i = 0; i < total; ++i){
-        if(dets[i].objectness == 0) continue;
-        box a = dets[i].bbox;
-        for(j = i+1; j < total; ++j){
-            if(dets[j].objectness == 0) continue;
-            box b = dets[j].bbox;
-            if (box_iou(a, b) > thresh){
-                dets[j].objectness = 0;
-                for(k = 0; k < classes; ++k){
-                    dets[j].prob[k] = 0;
-                }
-            }
-        }
-    }
-}
-
-
-void do_nms_sort(detection *dets, int total, int classes, float thresh)
-{
-    int i, j, k;
-    k = total-1;
-    for(i = 0; i <= k; ++i){
-        if(dets[i].objectness == 0){
-            detection swap = dets[i];
-            dets[i] = dets[k];
-            dets[k] = swap;
-            --k;
-            --i;
-        }
-    }
-    total = k+1;
-
-    for(k = 0; k < classes; ++k){
-        for(i = 0; i < total; ++i){
-            dets[i].sort_class = k;
-        }
-        qsort(dets, total, sizeof(detection), nms_comparator);
-        for(i = 0; i < total; ++i){
-            if(dets[i].prob[k] == 0) continue;
-            box a = dets[i].bbox;
-            for(j = i+1; j < total; ++j){
-                box b = dets[j].bbox;
-                if (box_iou(a, b) > thresh){
-                    dets[j].prob[k] = 0;
-                }
-            }
-        }
-    }
-}
-
 box float_to_box(float *f, int stride)
 {
     box b = {0};
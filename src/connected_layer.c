@@ -5,13 +5,14 @@
 #include "cuda.h"
 #include "blas.h"
 #include "gemm.h"
+#include "quantize.h"
 
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-layer make_connected_layer(int batch, int inputs, int outputs, ACTIVATION activation, int batch_normalize, int adam)
+layer make_connected_layer(int batch, int inputs, int outputs, ACTIVATION activation, int batch_normalize, int adam, int inference)
 {
     int i;
     layer l = {0};
@@ -30,10 +31,12 @@ layer make_connected_layer(int batch, int inputs, int outputs, ACTIVATION activa
     l.out_c = outputs;
 
     l.output = calloc(batch*outputs, sizeof(float));
-    l.delta = calloc(batch*outputs, sizeof(float));
+    if(!inference){
+        l.delta = calloc(batch*outputs, sizeof(float));
 
-    l.weight_updates = calloc(inputs*outputs, sizeof(float));
-    l.bias_updates = calloc(outputs, sizeof(float));
+        l.weight_updates = calloc(inputs*outputs, sizeof(float));
+        l.bias_updates = calloc(outputs, sizeof(float));
+    }
 
     l.weights = calloc(outputs*inputs, sizeof(float));
     l.biases = calloc(outputs, sizeof(float));
@@ -44,7 +47,7 @@ layer make_connected_layer(int batch, int inputs, int outputs, ACTIVATION activa
 
     //float scale = 1./sqrt(inputs);
     float scale = sqrt(2./inputs);
-    for(i = 0; i < outputs*inputs; ++i){
+    for(i = 0; i < outputs*inputs && !inference; ++i){
         l.weights[i] = scale*rand_uniform(-1, 1);
     }
 
@@ -52,7 +55,7 @@ layer make_connected_layer(int batch, int inputs, int outputs, ACTIVATION activa
         l.biases[i] = 0;
     }
 
-    if(adam){
+    if(adam && !inference){
         l.m = calloc(l.inputs*l.outputs, sizeof(float));
         l.v = calloc(l.inputs*l.outputs, sizeof(float));
         l.bias_m = calloc(l.outputs, sizeof(float));
@@ -62,21 +65,24 @@ layer make_connected_layer(int batch, int inputs, int outputs, ACTIVATION activa
     }
     if(batch_normalize){
         l.scales = calloc(outputs, sizeof(float));
-        l.scale_updates = calloc(outputs, sizeof(float));
         for(i = 0; i < outputs; ++i){
             l.scales[i] = 1;
         }
 
-        l.mean = calloc(outputs, sizeof(float));
-        l.mean_delta = calloc(outputs, sizeof(float));
-        l.variance = calloc(outputs, sizeof(float));
-        l.variance_delta = calloc(outputs, sizeof(float));
-
         l.rolling_mean = calloc(outputs, sizeof(float));
         l.rolling_variance = calloc(outputs, sizeof(float));
 
-        l.x = calloc(batch*outputs, sizeof(float));
-        l.x_norm = calloc(batch*outputs, sizeof(float));
+        if(!inference){
+            l.scale_updates = calloc(outputs, sizeof(float));
+
+            l.mean = calloc(outputs, sizeof(float));
+            l.mean_delta = calloc(outputs, sizeof(float));
+            l.variance = calloc(outputs, sizeof(float));
+            l.variance_delta = calloc(outputs, sizeof(float));
+
+            l.x = calloc(batch*outputs, sizeof(float));
+            l.x_norm = calloc(batch*outputs, sizeof(float));
+        }
     }
 
 #ifdef GPU
@@ -148,16 +154,33 @@ void update_connected_layer(layer l, update_args a)
     scal_cpu(l.inputs*l.outputs, momentum, l.weight_updates, 1);
 }
 
+static void forward_connected_int8(layer l, network net)
+{
+    int i, j;
+    float *t = net.workspace;
+    gemm_int8_nt_cpu(l.outputs, l.batch, l.inputs, l.weights_int8, l.weight_scales, l.weight_sums,
+            net.input, l.inputs, l.input_scale, t, l.batch, 0, t + l.outputs*l.batch);
+    for(i = 0; i < l.batch; ++i){
+        for(j = 0; j < l.outputs; ++j){
+            l.output[i*l.outputs + j] = t[j*l.batch + i];
+        }
+    }
+}
+
 void forward_connected_layer(layer l, network net)
 {
-    fill_cpu(l.outputs*l.batch, 0, l.output, 1);
-    int m = l.batch;
-    int k = l.inputs;
-    int n = l.outputs;
-    float *a = net.input;
-    float *b = l.weights;
-    float *c = l.output;
-    gemm(0,1,m,n,k,1,a,k,b,k,1,c,n);
+    if(l.weights_int8 && !net.train){
+        forward_connected_int8(l, net);
+    } else {
+        fill_cpu(l.outputs*l.batch, 0, l.output, 1);
+        int m = l.batch;
+        int k = l.inputs;
+        int n = l.outputs;
+        float *a = net.input;
+        float *b = l.weights;
+        float *c = l.output;
+        gemm(0,1,m,n,k,1,a,k,b,k,1,c,n);
+    }
     if(l.batch_normalize){
         forward_batchnorm_layer(l, net);
     } else {
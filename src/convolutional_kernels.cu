@@ -280,6 +280,7 @@ void pull_convolutional_layer(layer l)
         cuda_pull_array(l.scales_gpu, l.scales, l.n);
         cuda_pull_array(l.rolling_mean_gpu, l.rolling_mean, l.n);
         cuda_pull_array(l.rolling_variance_gpu, l.rolling_variance, l.n);
+        fold_convolutional_epilogue(l);
     }
 }
 
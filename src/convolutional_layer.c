@@ -5,6 +5,10 @@
 #include "col2im.h"
 #include "blas.h"
 #include "gemm.h"
+#include "winograd.h"
+#include "quantize.h"
+#include "xnor.h"
+#include "half.h"
 #include <stdio.h>
 #include <time.h>
 
@@ -83,6 +87,11 @@ image get_convolutional_delta(convolutional_layer l)
     return float_to_image(l.out_w,l.out_h,l.out_c,l.delta);
 }
 
+static size_t get_im2col_size(layer l)
+{
+    return (size_t)l.out_h*l.out_w*l.size*l.size*l.c/l.groups*sizeof(float);
+}
+
 static size_t get_workspace_size(layer l){
 #ifdef CUDNN
     if(gpu_index >= 0){
@@ -115,7 +124,126 @@ static size_t get_workspace_size(layer l){
         return most;
     }
 #endif
-    return (size_t)l.out_h*l.out_w*l.size*l.size*l.c/l.groups*sizeof(float);
+#ifdef GPU
+    if(gpu_index >= 0) return get_im2col_size(l);
+#endif
+    if(l.weights_int8) return gemm_int8_workspace_size(l.out_w*l.out_h, l.size*l.size*l.c/l.groups, (size_t)l.c/l.groups*l.h*l.w);
+    if(l.winograd){
+        // Sized for either tile so falling back from F(4x3) never grows it.
+        size_t s2 = winograd_workspace_size(2, l.n, l.c, l.out_h, l.out_w);
+        size_t s4 = winograd_workspace_size(4, l.n, l.c, l.out_h, l.out_w);
+        return (s2 > s4) ? s2 : s4;
+    }
+    // The implicit GEMM only needs im2col for the backward pass
+    if(l.implicit_gemm && !l.delta) return 0;
+    return get_im2col_size(l);
+}
+
+void set_winograd_convolutional_layer(convolutional_layer *l, int tile)
+{
+    if(l->size != 3 || l->stride != 1 || l->groups != 1 || l->binary || l->xnor) tile = 0;
+    // Small outputs have too few tiles to amortize the larger transformed filters
+    if(l->out_h*l->out_w < 24*24) tile = 0;
+    if(tile && tile != 2) tile = 4;
+    l->winograd = tile;
+    if(!tile){
+        free(l->winograd_weights);
+        l->winograd_weights = 0;
+    } else {
+        if(!l->winograd_weights) l->winograd_weights = calloc(36*l->n*l->c, sizeof(float));
+        transform_winograd_weights(*l);
+    }
+    l->workspace_size = get_workspace_size(*l);
+}
+
+void transform_winograd_weights(convolutional_layer l)
+{
+    if(!l.winograd) return;
+    winograd_transform_weights(l.winograd, l.weights, l.n, l.c, l.winograd_weights);
+}
+
+// Keeps the weights in 16 bits for inference, the GEMM converts them while
+// packing. The float weights and their update buffer are released, mapped
+// weights stay in the mapping.
+// Winograd layers go back to the direct path, their transformed weights
+// would take more memory than the float ones.
+void set_convolutional_precision(convolutional_layer *l, PRECISION p)
+{
+    if(l->precision == p || l->xnor || l->weights_int8) return;
+    if(l->weights_half){
+        if(!l->weights){
+            l->weights = calloc(l->nweights, sizeof(float));
+            half_to_float(l->weights_half, l->nweights, l->weights, l->precision);
+        }
+        if(!l->weight_updates) l->weight_updates = calloc(l->nweights, sizeof(float));
+        free(l->weights_half);
+        l->weights_half = 0;
+    }
+    l->precision = p;
+    if(p == FP32) return;
+    if(l->winograd){
+        free(l->winograd_weights);
+        l->winograd_weights = 0;
+        l->winograd = 0;
+        l->workspace_size = get_workspace_size(*l);
+    }
+    free_packed_convolutional_weights(l);
+    l->weights_half = calloc(l->nweights, sizeof(uint16_t));
+    float_to_half(l->weights, l->nweights, l->weights_half, p);
+    free(l->weight_updates);
+    l->weight_updates = 0;
+    if(l->mapped) return;
+    free(l->weights);
+    l->weights = 0;
+}
+
+void pack_xnor_weights(convolutional_layer l)
+{
+    if(!l.xnor_weights) return;
+    xnor_pack_weights(l.weights, l.n, l.c, l.size, l.xnor_weights, l.xnor_scales, l.xnor_popcounts);
+}
+
+static float winograd_error(convolutional_layer l)
+{
+    int h = 8, w = 8;
+    int out_h = h + 2*l.pad - 2;
+    int out_w = w + 2*l.pad - 2;
+    int outputs = l.n*out_h*out_w;
+    float *im = calloc(l.c*h*w, sizeof(float));
+    float *ref = calloc(outputs, sizeof(float));
+    float *out = calloc(outputs, sizeof(float));
+    float *workspace = calloc(1, winograd_workspace_size(l.winograd, l.n, l.c, out_h, out_w));
+    unsigned int seed = 2463534242u;
+    int i;
+    for(i = 0; i < l.c*h*w; ++i){
+        seed = seed*1664525u + 1013904223u;
+        im[i] = (seed >> 8)/8388608.f - 1;
+    }
+    gemm_im2col_cpu(l.n, out_h*out_w, 9*l.c, 1, l.weights, 9*l.c, im, l.c, h, w, 3, 1, l.pad, 0, ref, out_h*out_w, 0);
+    winograd_conv_cpu(l.winograd, l.winograd_weights, l.n, im, l.c, h, w, l.pad, workspace, out, 0);
+    float err = 0, mag = 0;
+    for(i = 0; i < outputs; ++i){
+        float d = fabs(out[i] - ref[i]);
+        if(d > err) err = d;
+        if(fabs(ref[i]) > mag) mag = fabs(ref[i]);
+    }
+    free(im);
+    free(ref);
+    free(out);
+    free(workspace);
+    return (mag > 0) ? err/mag : 0;
+}
+
+void check_winograd_convolutional_layer(convolutional_layer *l, float tolerance)
+{
+    while(l->winograd){
+        float err = winograd_error(*l);
+        if(err <= tolerance) return;
+        fprintf(stderr, "Winograd F(%dx3) error %g above %g, ", l->winograd, err, tolerance);
+        set_winograd_convolutional_layer(l, (l->winograd == 4) ? 2 : 0);
+        if(l->winograd) fprintf(stderr, "trying F(2x3)\n");
+        else fprintf(stderr, "using direct convolution\n");
+    }
 }
 
 #ifdef GPU
@@ -178,7 +306,7 @@ void cudnn_convolutional_setup(layer *l)
 #endif
 #endif
 
-convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int n, int groups, int size, int stride, int padding, ACTIVATION activation, int batch_normalize, int binary, int xnor, int adam)
+convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int n, int groups, int size, int stride, int padding, ACTIVATION activation, int batch_normalize, int binary, int xnor, int adam, int inference)
 {
     int i;
     convolutional_layer l = {0};
@@ -196,12 +324,13 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int
     l.size = size;
     l.pad = padding;
     l.batch_normalize = batch_normalize;
+    l.implicit_gemm = (size == 3 || (size == 1 && stride == 2)) && (stride == 1 || stride == 2) && !binary && !xnor;
 
     l.weights = calloc(c/groups*n*size*size, sizeof(float));
-    l.weight_updates = calloc(c/groups*n*size*size, sizeof(float));
+    if(!inference) l.weight_updates = calloc(c/groups*n*size*size, sizeof(float));
 
     l.biases = calloc(n, sizeof(float));
-    l.bias_updates = calloc(n, sizeof(float));
+    if(!inference) l.bias_updates = calloc(n, sizeof(float));
 
     l.nweights = c/groups*n*size*size;
     l.nbiases = n;
@@ -211,7 +340,7 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int
     //printf("convscale %f\n", scale);
     //scale = .02;
     //for(i = 0; i < c*n*size*size; ++i) l.weights[i] = scale*rand_uniform(-1, 1);
-    for(i = 0; i < l.nweights; ++i) l.weights[i] = scale*rand_normal();
+    if(!inference) for(i = 0; i < l.nweights; ++i) l.weights[i] = scale*rand_normal();
     int out_w = convolutional_out_width(l);
     int out_h = convolutional_out_height(l);
     l.out_h = out_h;
@@ -221,7 +350,7 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int
     l.inputs = l.w * l.h * l.c;
 
     l.output = calloc(l.batch*l.outputs, sizeof(float));
-    l.delta  = calloc(l.batch*l.outputs, sizeof(float));
+    if(!inference) l.delta  = calloc(l.batch*l.outputs, sizeof(float));
 
     l.forward = forward_convolutional_layer;
     l.backward = backward_convolutional_layer;
@@ -234,27 +363,39 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int
     if(xnor){
         l.binary_weights = calloc(l.nweights, sizeof(float));
         l.binary_input = calloc(l.inputs*l.batch, sizeof(float));
+        if(groups == 1 && size*size <= 64){
+            l.xnor_weights = calloc(xnor_weights_size(n, c, size), sizeof(uint64_t));
+            l.xnor_scales = calloc(n, sizeof(float));
+            l.xnor_popcounts = calloc(n*size*size, sizeof(int));
+            pack_xnor_weights(l);
+        }
     }
 
     if(batch_normalize){
         l.scales = calloc(n, sizeof(float));
-        l.scale_updates = calloc(n, sizeof(float));
         for(i = 0; i < n; ++i){
             l.scales[i] = 1;
         }
 
-        l.mean = calloc(n, sizeof(float));
-        l.variance = calloc(n, sizeof(float));
-
-        l.mean_delta = calloc(n, sizeof(float));
-        l.variance_delta = calloc(n, sizeof(float));
-
         l.rolling_mean = calloc(n, sizeof(float));
         l.rolling_variance = calloc(n, sizeof(float));
-        l.x = calloc(l.batch*l.outputs, sizeof(float));
-        l.x_norm = calloc(l.batch*l.outputs, sizeof(float));
+        l.folded_scales = calloc(n, sizeof(float));
+        l.folded_biases = calloc(n, sizeof(float));
+        fold_convolutional_epilogue(l);
+        if(!inference){
+            l.scale_updates = calloc(n, sizeof(float));
+
+            l.mean = calloc(n, sizeof(float));
+            l.variance = calloc(n, sizeof(float));
+
+            l.mean_delta = calloc(n, sizeof(float));
+            l.variance_delta = calloc(n, sizeof(float));
+
+            l.x = calloc(l.batch*l.outputs, sizeof(float));
+            l.x_norm = calloc(l.batch*l.outputs, sizeof(float));
+        }
     }
-    if(adam){
+    if(adam && !inference){
         l.m = calloc(l.nweights, sizeof(float));
         l.v = calloc(l.nweights, sizeof(float));
         l.bias_m = calloc(n, sizeof(float));
@@ -347,10 +488,41 @@ void denormalize_convolutional_layer(convolutional_layer l)
     }
 }
 
+void fold_batchnorm_convolutional_layer(convolutional_layer *l)
+{
+    if(!l->batch_normalize) return;
+    int i, j;
+    int size = l->c/l->groups*l->size*l->size;
+    for(i = 0; i < l->n; ++i){
+        // Same normalization as forward_batchnorm_layer at inference
+        float scale = l->scales[i]/(sqrt(l->rolling_variance[i]) + .000001f);
+        for(j = 0; j < size; ++j){
+            l->weights[i*size + j] *= scale;
+        }
+        l->biases[i] -= l->rolling_mean[i] * scale;
+        l->scales[i] = 1;
+        l->rolling_mean[i] = 0;
+        l->rolling_variance[i] = 1;
+    }
+    l->batch_normalize = 0;
+    free(l->folded_scales);
+    free(l->folded_biases);
+    l->folded_scales = 0;
+    l->folded_biases = 0;
+    transform_winograd_weights(*l);
+    pack_xnor_weights(*l);
+    if(l->weights_packed) pack_convolutional_weights(l);
+#ifdef GPU
+    if(gpu_index >= 0){
+        push_convolutional_layer(*l);
+    }
+#endif
+}
+
 /*
 void test_convolutional_layer()
 {
-    convolutional_layer l = make_convolutional_layer(1, 5, 5, 3, 2, 5, 2, 1, LEAKY, 1, 0, 0, 0);
+    convolutional_layer l = make_convolutional_layer(1, 5, 5, 3, 2, 5, 2, 1, LEAKY, 1, 0, 0, 0, 0);
     l.batch_normalize = 1;
     float data[] = {1,1,1,1,1,
         1,1,1,1,1,
@@ -386,8 +558,8 @@ void resize_convolutional_layer(convolutional_layer *l, int w, int h)
     l->inputs = l->w * l->h * l->c;
 
     l->output = realloc(l->output, l->batch*l->outputs*sizeof(float));
-    l->delta  = realloc(l->delta,  l->batch*l->outputs*sizeof(float));
-    if(l->batch_normalize){
+    if(l->delta) l->delta  = realloc(l->delta,  l->batch*l->outputs*sizeof(float));
+    if(l->x){
         l->x = realloc(l->x, l->batch*l->outputs*sizeof(float));
         l->x_norm  = realloc(l->x_norm, l->batch*l->outputs*sizeof(float));
     }
@@ -447,37 +619,64 @@ void backward_bias(float *bias_updates, float *delta, int batch, int n, int size
     }
 }
 
-void forward_convolutional_layer(convolutional_layer l, network net)
+static void forward_convolutional_gemm(convolutional_layer l, network net, gemm_epilogue *e)
 {
     int i, j;
-
-    fill_cpu(l.outputs*l.batch, 0, l.output, 1);
-
-    if(l.xnor){
-        binarize_weights(l.weights, l.n, l.c/l.groups*l.size*l.size, l.binary_weights);
-        swap_binary(&l);
-        binarize_cpu(net.input, l.c*l.h*l.w*l.batch, l.binary_input);
-        net.input = l.binary_input;
-    }
-
     int m = l.n/l.groups;
     int k = l.size*l.size*l.c/l.groups;
     int n = l.out_w*l.out_h;
+    float beta = e ? 0 : 1;
     for(i = 0; i < l.batch; ++i){
+        if(l.winograd && !net.train){
+            winograd_conv_cpu(l.winograd, l.winograd_weights, l.n, net.input + i*l.inputs, l.c, l.h, l.w, l.pad, net.workspace, l.output + i*l.outputs, e);
+            continue;
+        }
         for(j = 0; j < l.groups; ++j){
             float *a = l.weights + j*l.nweights/l.groups;
+            float *ap = l.weights_packed + j*gemm_packed_a_size(m, k);
+            uint16_t *ah = l.weights_half + j*l.nweights/l.groups;
             float *b = net.workspace;
             float *c = l.output + (i*l.groups + j)*n*m;
             float *im =  net.input + (i*l.groups + j)*l.c/l.groups*l.h*l.w;
+            gemm_epilogue g, *ge = 0;
+            if(e){
+                g = *e;
+                if(g.scale) g.scale += j*m;
+                if(g.bias) g.bias += j*m;
+                ge = &g;
+            }
 
-            if (l.size == 1) {
-                b = im;
+            if (l.weights_packed && e) {
+                if (l.size == 1 && l.stride == 1) {
+                    gemm_prepacked_cpu(m,n,k,ap,im,n,beta,c,n,ge);
+                } else if (l.implicit_gemm) {
+                    gemm_im2col_prepacked_cpu(m,n,k,ap,im,l.c/l.groups,l.h,l.w,l.size,l.stride,l.pad,beta,c,n,ge);
+                } else {
+                    im2col_cpu(im, l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, b);
+                    gemm_prepacked_cpu(m,n,k,ap,b,n,beta,c,n,ge);
+                }
+            } else if (l.weights_half) {
+                if (l.size == 1 && l.stride == 1) {
+                    gemm_half_cpu(m,n,k,ah,k,l.precision,im,n,beta,c,n,ge);
+                } else {
+                    gemm_im2col_half_cpu(m,n,k,ah,k,l.precision,im,l.c/l.groups,l.h,l.w,l.size,l.stride,l.pad,beta,c,n,ge);
+                }
+            } else if (l.size == 1 && l.stride == 1) {
+                gemm_fused_cpu(0,0,m,n,k,1,a,k,im,n,beta,c,n,ge);
+            } else if (l.implicit_gemm) {
+                gemm_im2col_cpu(m,n,k,1,a,k,im,l.c/l.groups,l.h,l.w,l.size,l.stride,l.pad,beta,c,n,ge);
             } else {
                 im2col_cpu(im, l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, b);
+                gemm_fused_cpu(0,0,m,n,k,1,a,k,b,n,beta,c,n,ge);
             }
-            gemm(0,0,m,n,k,1,a,k,b,n,1,c,n);
         }
     }
+}
+
+static void forward_convolutional_unfused(convolutional_layer l, network net)
+{
+    fill_cpu(l.outputs*l.batch, 0, l.output, 1);
+    forward_convolutional_gemm(l, net, 0);
 
     if(l.batch_normalize){
         forward_batchnorm_layer(l, net);
@@ -486,15 +685,217 @@ void forward_convolutional_layer(convolutional_layer l, network net)
     }
 
     activate_array(l.output, l.outputs*l.batch, l.activation);
+}
+
+// Batch norm with rolling statistics folded into a scale and bias per
+// filter. Refreshed wherever the statistics change: on load, on update and
+// when pulled from the GPU.
+void fold_convolutional_epilogue(convolutional_layer l)
+{
+    if(!l.folded_scales) return;
+    int i;
+    for(i = 0; i < l.n; ++i){
+        l.folded_scales[i] = l.scales[i]/(sqrt(l.rolling_variance[i]) + .000001f);
+        l.folded_biases[i] = l.biases[i] - l.rolling_mean[i]*l.folded_scales[i];
+    }
+}
+
+// Inference only: bias, batch norm with rolling statistics and activation
+// are applied by the GEMM epilogue instead of separate passes over l.output.
+static gemm_epilogue convolutional_epilogue(convolutional_layer l)
+{
+    gemm_epilogue e;
+    e.scale = l.folded_scales;
+    e.bias = l.folded_biases ? l.folded_biases : l.biases;
+    e.activation = gemm_epilogue_supported(l.activation) ? l.activation : LINEAR;
+    return e;
+}
+
+static void forward_convolutional_fused(convolutional_layer l, network net)
+{
+    gemm_epilogue e = convolutional_epilogue(l);
+    // the scale is already in the packed weights
+    if(l.weights_packed) e.scale = 0;
+    forward_convolutional_gemm(l, net, &e);
+}
+
+void free_packed_convolutional_weights(convolutional_layer *l)
+{
+    free(l->weights_packed);
+    l->weights_packed = 0;
+}
+
+// Inference only: the weights packed into GEMM panels once, with batch norm
+// folded into the rows and biases, instead of on every forward. Layers that
+// run another kernel keep their weights as they are.
+void pack_convolutional_weights(convolutional_layer *l)
+{
+    free_packed_convolutional_weights(l);
+    if(!l->weights || l->winograd || l->weights_half || l->weights_int8 || l->binary || l->xnor) return;
+    if(!gemm_epilogue_supported(l->activation)) return;
+    int j;
+    int m = l->n/l->groups;
+    int k = l->size*l->size*l->c/l->groups;
+    size_t size = gemm_packed_a_size(m, k);
+    gemm_epilogue e = convolutional_epilogue(*l);
+    l->weights_packed = calloc(l->groups*size, sizeof(float));
+    for(j = 0; j < l->groups; ++j){
+        gemm_pack_a(m, k, l->weights + j*l->nweights/l->groups, k, e.scale ? e.scale + j*m : 0, l->weights_packed + j*size);
+    }
+}
+
+static void forward_convolutional_int8(convolutional_layer l, network net)
+{
+    int i, j;
+    int m = l.n/l.groups;
+    int k = l.size*l.size*l.c/l.groups;
+    int n = l.out_w*l.out_h;
+    gemm_epilogue e = convolutional_epilogue(l);
+    for(i = 0; i < l.batch; ++i){
+        for(j = 0; j < l.groups; ++j){
+            float *c = l.output + (i*l.groups + j)*n*m;
+            float *im =  net.input + (i*l.groups + j)*l.c/l.groups*l.h*l.w;
+            gemm_epilogue g = e;
+            if(g.scale) g.scale += j*m;
+            g.bias += j*m;
+            gemm_int8_im2col_cpu(m, n, k, l.weights_int8 + j*packed_weights_int8_size(m, k), l.weight_scales + j*m, l.weight_sums + j*m,
+                    im, l.input_scale, l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, c, n, &g, net.workspace);
+        }
+    }
+    if(!gemm_epilogue_supported(l.activation)) activate_array(l.output, l.outputs*l.batch, l.activation);
+}
+
+// Inference for xnor layers on sign bits, see xnor.c
+static void forward_convolutional_xnor(convolutional_layer l, network net)
+{
+    int i;
+    gemm_epilogue e = convolutional_epilogue(l);
+    for(i = 0; i < l.batch; ++i){
+        xnor_conv_cpu(l.n, l.xnor_weights, l.xnor_scales, l.xnor_popcounts,
+                net.input + i*l.inputs, l.c, l.h, l.w, l.size, l.stride, l.pad,
+                l.output + i*l.outputs, &e);
+    }
+    if(!gemm_epilogue_supported(l.activation)) activate_array(l.output, l.outputs*l.batch, l.activation);
+}
+
+void forward_convolutional_layer(convolutional_layer l, network net)
+{
+    if(l.xnor_weights && !net.train){
+        forward_convolutional_xnor(l, net);
+        return;
+    }
+    if(l.xnor){
+        binarize_weights(l.weights, l.n, l.c/l.groups*l.size*l.size, l.binary_weights);
+        swap_binary(&l);
+        binarize_cpu(net.input, l.c*l.h*l.w*l.batch, l.binary_input);
+        net.input = l.binary_input;
+    }
+
+    if(l.weights_int8 && !net.train){
+        forward_convolutional_int8(l, net);
+    } else if(!net.train && gemm_epilogue_supported(l.activation)){
+        forward_convolutional_fused(l, net);
+    } else {
+        forward_convolutional_unfused(l, net);
+    }
+
     if(l.binary || l.xnor) swap_binary(&l);
 }
 
+void benchmark_convolutional_epilogue(network *net, int iter)
+{
+    int i, j, t;
+    if(iter <= 0) iter = 10;
+    net->train = 0;
+    float *input = calloc(net->inputs*net->batch, sizeof(float));
+    double total_unfused = 0, total_fused = 0;
+    printf("layer  activation      unfused       fused  speedup   rel diff\n");
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type != CONVOLUTIONAL || l.xnor || !gemm_epilogue_supported(l.activation)) continue;
+        network state = *net;
+        state.input = realloc(input, l.inputs*l.batch*sizeof(float));
+        input = state.input;
+        for(j = 0; j < l.inputs*l.batch; ++j) input[j] = rand_uniform(0, 1);
+        float *fused = calloc(l.outputs*l.batch, sizeof(float));
+
+        double start = what_time_is_it_now();
+        for(t = 0; t < iter; ++t) forward_convolutional_unfused(l, state);
+        double unfused_time = (what_time_is_it_now() - start)/iter;
+        copy_cpu(l.outputs*l.batch, l.output, 1, fused, 1);
+
+        start = what_time_is_it_now();
+        for(t = 0; t < iter; ++t) forward_convolutional_fused(l, state);
+        double fused_time = (what_time_is_it_now() - start)/iter;
+
+        float diff = 0, mag = 0;
+        for(j = 0; j < l.outputs*l.batch; ++j){
+            float d = fabs(fused[j] - l.output[j]);
+            if(d > diff) diff = d;
+            if(fabs(fused[j]) > mag) mag = fabs(fused[j]);
+        }
+        if(mag > 0) diff /= mag;
+        free(fused);
+        printf("%5d  %-10s %9.3f ms %8.3f ms  %6.2fx  %g\n", i, get_activation_string(l.activation), unfused_time*1000, fused_time*1000, unfused_time/fused_time, diff);
+        total_unfused += unfused_time;
+        total_fused += fused_time;
+    }
+    printf("total             %9.3f ms %8.3f ms  %6.2fx\n", total_unfused*1000, total_fused*1000, total_unfused/total_fused);
+    free(input);
+}
+
+void benchmark_convolutional_xnor(network *net, int iter)
+{
+    int i, j, t;
+    if(iter <= 0) iter = 10;
+    net->train = 0;
+    float *input = calloc(net->inputs*net->batch, sizeof(float));
+    double total_float = 0, total_xnor = 0;
+    printf("XNOR kernel: %s\n", xnor_kernel_name());
+    printf("layer  input               float        xnor  speedup   rel diff\n");
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type != CONVOLUTIONAL || !l.xnor_weights) continue;
+        network state = *net;
+        state.input = realloc(input, l.inputs*l.batch*sizeof(float));
+        input = state.input;
+        for(j = 0; j < l.inputs*l.batch; ++j) input[j] = rand_uniform(-1, 1);
+        float *bits = calloc(l.outputs*l.batch, sizeof(float));
+        layer f = l;
+        f.xnor_weights = 0;
+
+        double start = what_time_is_it_now();
+        for(t = 0; t < iter; ++t) forward_convolutional_layer(f, state);
+        double float_time = (what_time_is_it_now() - start)/iter;
+        copy_cpu(l.outputs*l.batch, l.output, 1, bits, 1);
+
+        start = what_time_is_it_now();
+        for(t = 0; t < iter; ++t) forward_convolutional_layer(l, state);
+        double xnor_time = (what_time_is_it_now() - start)/iter;
+
+        float diff = 0, mag = 0;
+        for(j = 0; j < l.outputs*l.batch; ++j){
+            float d = fabs(bits[j] - l.output[j]);
+            if(d > diff) diff = d;
+            if(fabs(bits[j]) > mag) mag = fabs(bits[j]);
+        }
+        if(mag > 0) diff /= mag;
+        free(bits);
+        printf("%5d  %4d x%4d x%4d %9.3f ms %8.3f ms  %6.2fx  %g\n", i, l.w, l.h, l.c, float_time*1000, xnor_time*1000, float_time/xnor_time, diff);
+        total_float += float_time;
+        total_xnor += xnor_time;
+    }
+    if(total_xnor > 0) printf("total                 %9.3f ms %8.3f ms  %6.2fx\n", total_float*1000, total_xnor*1000, total_float/total_xnor);
+    free(input);
+}
+
 void backward_convolutional_layer(convolutional_layer l, network net)
 {
     int i, j;
     int m = l.n/l.groups;
     int n = l.size*l.size*l.c/l.groups;
     int k = l.out_w*l.out_h;
+    int direct = l.size == 1 && l.stride == 1;
 
     gradient_array(l.output, l.outputs*l.batch, l.activation, l.delta);
 
@@ -513,7 +914,7 @@ void backward_convolutional_layer(convolutional_layer l, network net)
             float *im  = net.input + (i*l.groups + j)*l.c/l.groups*l.h*l.w;
             float *imd = net.delta + (i*l.groups + j)*l.c/l.groups*l.h*l.w;
 
-            if(l.size == 1){
+            if(direct){
                 b = im;
             } else {
                 im2col_cpu(im, l.c/l.groups, l.h, l.w, 
@@ -526,13 +927,13 @@ void backward_convolutional_layer(convolutional_layer l, network net)
                 a = l.weights + j*l.nweights/l.groups;
                 b = l.delta + (i*l.groups + j)*m*k;
                 c = net.workspace;
-                if (l.size == 1) {
+                if (direct) {
                     c = imd;
                 }
 
                 gemm(1,0,n,k,m,1,a,n,b,k,0,c,k);
 
-                if (l.size != 1) {
+                if (!direct) {
                     col2im_cpu(net.workspace, l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, imd);
                 }
             }
@@ -558,6 +959,8 @@ void update_convolutional_layer(convolutional_layer l, update_args a)
     axpy_cpu(l.nweights, -decay*batch, l.weights, 1, l.weight_updates, 1);
     axpy_cpu(l.nweights, learning_rate/batch, l.weight_updates, 1, l.weights, 1);
     scal_cpu(l.nweights, momentum, l.weight_updates, 1);
+    pack_xnor_weights(l);
+    fold_convolutional_epilogue(l);
 }
 
 
@@ -25,8 +25,17 @@ void cudnn_convolutional_setup(layer *l);
 #endif
 #endif
 
-convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int n, int groups, int size, int stride, int padding, ACTIVATION activation, int batch_normalize, int binary, int xnor, int adam);
+convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int n, int groups, int size, int stride, int padding, ACTIVATION activation, int batch_normalize, int binary, int xnor, int adam, int inference);
 void resize_convolutional_layer(convolutional_layer *layer, int w, int h);
+void set_winograd_convolutional_layer(convolutional_layer *layer, int tile);
+void transform_winograd_weights(convolutional_layer layer);
+void check_winograd_convolutional_layer(convolutional_layer *layer, float tolerance);
+void pack_convolutional_weights(convolutional_layer *layer);
+void free_packed_convolutional_weights(convolutional_layer *layer);
+void fold_batchnorm_convolutional_layer(convolutional_layer *layer);
+void pack_xnor_weights(convolutional_layer layer);
+void fold_convolutional_epilogue(convolutional_layer layer);
+void set_convolutional_precision(convolutional_layer *layer, PRECISION p);
 void forward_convolutional_layer(const convolutional_layer layer, network net);
 void update_convolutional_layer(convolutional_layer layer, update_args a);
 image *visualize_convolutional_layer(convolutional_layer layer, char *window, image *prev_weights);
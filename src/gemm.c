@@ -1,9 +1,13 @@
 #include "gemm.h"
+#include "half.h"
+#include "parallel.h"
 #include "utils.h"
 #include "cuda.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
+#include <pthread.h>
 
 void gemm_bin(int M, int N, int K, float ALPHA, 
         char  *A, int lda, 
@@ -50,12 +54,14 @@ void time_random_matrix(int TA, int TB, int m, int k, int n)
 
     float *c = random_matrix(m,n);
     int i;
-    clock_t start = clock(), end;
-    for(i = 0; i<10; ++i){
+    int iter = 10;
+    double start = what_time_is_it_now();
+    for(i = 0; i<iter; ++i){
         gemm_cpu(TA,TB,m,n,k,1,a,lda,b,ldb,1,c,n);
     }
-    end = clock();
-    printf("Matrix Multiplication %dx%d * %dx%d, TA=%d, TB=%d: %lf ms\n",m,k,k,n, TA, TB, (float)(end-start)/CLOCKS_PER_SEC);
+    double seconds = what_time_is_it_now() - start;
+    double gflop = 2.*m*n*k*iter/1000000000.;
+    printf("Matrix Multiplication %dx%d * %dx%d, TA=%d, TB=%d: %lf s, %lf GFLOPS (%s)\n",m,k,k,n, TA, TB, seconds, gflop/seconds, gemm_cpu_kernel_name());
     free(a);
     free(b);
     free(c);
@@ -77,7 +83,6 @@ void gemm_nn(int M, int N, int K, float ALPHA,
         float *C, int ldc)
 {
     int i,j,k;
-    #pragma omp parallel for
     for(i = 0; i < M; ++i){
         for(k = 0; k < K; ++k){
             register float A_PART = ALPHA*A[i*lda+k];
@@ -94,7 +99,6 @@ void gemm_nt(int M, int N, int K, float ALPHA,
         float *C, int ldc)
 {
     int i,j,k;
-    #pragma omp parallel for
     for(i = 0; i < M; ++i){
         for(j = 0; j < N; ++j){
             register float sum = 0;
@@ -112,7 +116,6 @@ void gemm_tn(int M, int N, int K, float ALPHA,
         float *C, int ldc)
 {
     int i,j,k;
-    #pragma omp parallel for
     for(i = 0; i < M; ++i){
         for(k = 0; k < K; ++k){
             register float A_PART = ALPHA*A[k*lda+i];
@@ -129,7 +132,6 @@ void gemm_tt(int M, int N, int K, float ALPHA,
         float *C, int ldc)
 {
     int i,j,k;
-    #pragma omp parallel for
     for(i = 0; i < M; ++i){
         for(j = 0; j < N; ++j){
             register float sum = 0;
@@ -141,20 +143,24 @@ void gemm_tt(int M, int N, int K, float ALPHA,
     }
 }
 
-
-void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA, 
-        float *A, int lda, 
-        float *B, int ldb,
-        float BETA,
-        float *C, int ldc)
+static void gemm_scale_c(int M, int N, float BETA, float *C, int ldc)
 {
-    //printf("cpu: %d %d %d %d %d %f %d %d %f %d\n",TA, TB, M, N, K, ALPHA, lda, ldb, BETA, ldc);
     int i, j;
+    if(BETA == 1) return;
     for(i = 0; i < M; ++i){
         for(j = 0; j < N; ++j){
-            C[i*ldc + j] *= BETA;
+            C[i*ldc + j] = (BETA == 0) ? 0 : C[i*ldc + j]*BETA;
         }
     }
+}
+
+void gemm_cpu_reference(int TA, int TB, int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc)
+{
+    gemm_scale_c(M, N, BETA, C, ldc);
     if(!TA && !TB)
         gemm_nn(M, N, K, ALPHA,A,lda, B, ldb,C,ldc);
     else if(TA && !TB)
@@ -165,6 +171,675 @@ void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
         gemm_tt(M, N, K, ALPHA,A,lda, B, ldb,C,ldc);
 }
 
+// Packed-panel GEMM: A is packed into MR x KC micro-panels, B into KC x NR
+// micro-panels, and a register-tiled micro-kernel (picked once at runtime
+// from the CPU features, or forced with DARKNET_GEMM=<name>) computes one
+// MR x NR tile of C at a time.
+
+#define GEMM_MC 96
+#define GEMM_KC 256
+#define GEMM_NC 3072
+#define GEMM_MAX_MR 8
+#define GEMM_MAX_NR 32
+#define GEMM_ALIGN 64
+
+typedef void (*gemm_kernel_fn)(int kc, const float *a, const float *b, float *c, int ldc);
+
+typedef struct{
+    char *name;
+    int mr;
+    int nr;
+    gemm_kernel_fn kernel;
+    int (*supported)();
+} gemm_kernel;
+
+static int gemm_always_supported(){return 1;}
+
+static void gemm_kernel_generic(int kc, const float *a, const float *b, float *c, int ldc)
+{
+    float acc[4][8] = {{0}};
+    int p, i, j;
+    for(p = 0; p < kc; ++p){
+        for(i = 0; i < 4; ++i){
+            float ai = a[i];
+            for(j = 0; j < 8; ++j){
+                acc[i][j] += ai*b[j];
+            }
+        }
+        a += 4;
+        b += 8;
+    }
+    for(i = 0; i < 4; ++i){
+        for(j = 0; j < 8; ++j){
+            c[i*ldc + j] += acc[i][j];
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+static int gemm_avx2_supported()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+static int gemm_avx512_supported()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f");
+}
+
+#define AVX2_ROW(r) \
+    a0 = _mm256_broadcast_ss(a + r); \
+    c##r##0 = _mm256_fmadd_ps(a0, b0, c##r##0); \
+    c##r##1 = _mm256_fmadd_ps(a0, b1, c##r##1);
+
+#define AVX2_STORE(r) \
+    _mm256_storeu_ps(c + r*ldc,     _mm256_add_ps(_mm256_loadu_ps(c + r*ldc),     c##r##0)); \
+    _mm256_storeu_ps(c + r*ldc + 8, _mm256_add_ps(_mm256_loadu_ps(c + r*ldc + 8), c##r##1));
+
+__attribute__((target("avx2,fma")))
+static void gemm_kernel_avx2(int kc, const float *a, const float *b, float *c, int ldc)
+{
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+    __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+    __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+    __m256 a0, b0, b1;
+    int p;
+    for(p = 0; p < kc; ++p){
+        b0 = _mm256_load_ps(b);
+        b1 = _mm256_load_ps(b + 8);
+        AVX2_ROW(0) AVX2_ROW(1) AVX2_ROW(2)
+        AVX2_ROW(3) AVX2_ROW(4) AVX2_ROW(5)
+        a += 6;
+        b += 16;
+    }
+    AVX2_STORE(0) AVX2_STORE(1) AVX2_STORE(2)
+    AVX2_STORE(3) AVX2_STORE(4) AVX2_STORE(5)
+}
+
+#define AVX512_ROW(r) \
+    a0 = _mm512_set1_ps(a[r]); \
+    c##r##0 = _mm512_fmadd_ps(a0, b0, c##r##0); \
+    c##r##1 = _mm512_fmadd_ps(a0, b1, c##r##1);
+
+#define AVX512_STORE(r) \
+    _mm512_storeu_ps(c + r*ldc,      _mm512_add_ps(_mm512_loadu_ps(c + r*ldc),      c##r##0)); \
+    _mm512_storeu_ps(c + r*ldc + 16, _mm512_add_ps(_mm512_loadu_ps(c + r*ldc + 16), c##r##1));
+
+__attribute__((target("avx512f")))
+static void gemm_kernel_avx512(int kc, const float *a, const float *b, float *c, int ldc)
+{
+    __m512 c00 = _mm512_setzero_ps(), c01 = _mm512_setzero_ps();
+    __m512 c10 = _mm512_setzero_ps(), c11 = _mm512_setzero_ps();
+    __m512 c20 = _mm512_setzero_ps(), c21 = _mm512_setzero_ps();
+    __m512 c30 = _mm512_setzero_ps(), c31 = _mm512_setzero_ps();
+    __m512 c40 = _mm512_setzero_ps(), c41 = _mm512_setzero_ps();
+    __m512 c50 = _mm512_setzero_ps(), c51 = _mm512_setzero_ps();
+    __m512 c60 = _mm512_setzero_ps(), c61 = _mm512_setzero_ps();
+    __m512 c70 = _mm512_setzero_ps(), c71 = _mm512_setzero_ps();
+    __m512 a0, b0, b1;
+    int p;
+    for(p = 0; p < kc; ++p){
+        b0 = _mm512_load_ps(b);
+        b1 = _mm512_load_ps(b + 16);
+        AVX512_ROW(0) AVX512_ROW(1) AVX512_ROW(2) AVX512_ROW(3)
+        AVX512_ROW(4) AVX512_ROW(5) AVX512_ROW(6) AVX512_ROW(7)
+        a += 8;
+        b += 32;
+    }
+    AVX512_STORE(0) AVX512_STORE(1) AVX512_STORE(2) AVX512_STORE(3)
+    AVX512_STORE(4) AVX512_STORE(5) AVX512_STORE(6) AVX512_STORE(7)
+}
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+
+#define NEON_ROW(r, av, lane) \
+    c##r##0 = vfmaq_laneq_f32(c##r##0, b0, av, lane); \
+    c##r##1 = vfmaq_laneq_f32(c##r##1, b1, av, lane);
+
+#define NEON_STORE(r) \
+    vst1q_f32(c + r*ldc,     vaddq_f32(vld1q_f32(c + r*ldc),     c##r##0)); \
+    vst1q_f32(c + r*ldc + 4, vaddq_f32(vld1q_f32(c + r*ldc + 4), c##r##1));
+
+static void gemm_kernel_neon(int kc, const float *a, const float *b, float *c, int ldc)
+{
+    float32x4_t c00 = vdupq_n_f32(0), c01 = vdupq_n_f32(0);
+    float32x4_t c10 = vdupq_n_f32(0), c11 = vdupq_n_f32(0);
+    float32x4_t c20 = vdupq_n_f32(0), c21 = vdupq_n_f32(0);
+    float32x4_t c30 = vdupq_n_f32(0), c31 = vdupq_n_f32(0);
+    float32x4_t c40 = vdupq_n_f32(0), c41 = vdupq_n_f32(0);
+    float32x4_t c50 = vdupq_n_f32(0), c51 = vdupq_n_f32(0);
+    float32x4_t c60 = vdupq_n_f32(0), c61 = vdupq_n_f32(0);
+    float32x4_t c70 = vdupq_n_f32(0), c71 = vdupq_n_f32(0);
+    float32x4_t a0, a1, b0, b1;
+    int p;
+    for(p = 0; p < kc; ++p){
+        a0 = vld1q_f32(a);
+        a1 = vld1q_f32(a + 4);
+        b0 = vld1q_f32(b);
+        b1 = vld1q_f32(b + 4);
+        NEON_ROW(0, a0, 0) NEON_ROW(1, a0, 1) NEON_ROW(2, a0, 2) NEON_ROW(3, a0, 3)
+        NEON_ROW(4, a1, 0) NEON_ROW(5, a1, 1) NEON_ROW(6, a1, 2) NEON_ROW(7, a1, 3)
+        a += 8;
+        b += 8;
+    }
+    NEON_STORE(0) NEON_STORE(1) NEON_STORE(2) NEON_STORE(3)
+    NEON_STORE(4) NEON_STORE(5) NEON_STORE(6) NEON_STORE(7)
+}
+#endif
+
+static gemm_kernel gemm_kernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+    {"avx512", 8, 32, gemm_kernel_avx512, gemm_avx512_supported},
+    {"avx2", 6, 16, gemm_kernel_avx2, gemm_avx2_supported},
+#endif
+#if defined(__aarch64__)
+    {"neon", 8, 8, gemm_kernel_neon, gemm_always_supported},
+#endif
+    {"generic", 4, 8, gemm_kernel_generic, gemm_always_supported},
+};
+
+static gemm_kernel *gemm_selected = 0;
+static pthread_once_t gemm_select_once = PTHREAD_ONCE_INIT;
+
+static void gemm_select_kernel()
+{
+    int i;
+    int n = sizeof(gemm_kernels)/sizeof(gemm_kernels[0]);
+    char *force = getenv("DARKNET_GEMM");
+    for(i = 0; i < n; ++i){
+        if(!gemm_kernels[i].supported()) continue;
+        if(force && strcmp(force, gemm_kernels[i].name) != 0) continue;
+        gemm_selected = gemm_kernels + i;
+        return;
+    }
+    if(force) fprintf(stderr, "GEMM kernel %s not available, using default\n", force);
+    for(i = 0; i < n; ++i){
+        if(gemm_kernels[i].supported()){
+            gemm_selected = gemm_kernels + i;
+            return;
+        }
+    }
+}
+
+static gemm_kernel *get_gemm_kernel()
+{
+    pthread_once(&gemm_select_once, gemm_select_kernel);
+    return gemm_selected;
+}
+
+char *gemm_cpu_kernel_name()
+{
+    return get_gemm_kernel()->name;
+}
+
+static void pack_a(int TA, int mc, int kc, float ALPHA, float *A, int lda, int mr, float *pa)
+{
+    int i, p, ii;
+    for(i = 0; i < mc; i += mr){
+        int ib = (mc - i < mr) ? mc - i : mr;
+        for(p = 0; p < kc; ++p){
+            if(TA){
+                float *src = A + p*lda + i;
+                for(ii = 0; ii < ib; ++ii) pa[ii] = ALPHA*src[ii];
+            } else {
+                float *src = A + i*lda + p;
+                for(ii = 0; ii < ib; ++ii) pa[ii] = ALPHA*src[ii*lda];
+            }
+            for(; ii < mr; ++ii) pa[ii] = 0;
+            pa += mr;
+        }
+    }
+}
+
+// A stored as 16 bit rows, converted a row segment at a time
+static void pack_a_half(int mc, int kc, uint16_t *A, int lda, PRECISION precision, int mr, float *pa)
+{
+    float row[GEMM_KC];
+    int i, p, ii;
+    for(i = 0; i < mc; i += mr){
+        int ib = (mc - i < mr) ? mc - i : mr;
+        for(ii = 0; ii < mr; ++ii){
+            if(ii < ib) half_to_float(A + (size_t)(i + ii)*lda, kc, row, precision);
+            else memset(row, 0, kc*sizeof(float));
+            for(p = 0; p < kc; ++p) pa[p*mr + ii] = row[p];
+        }
+        pa += kc*mr;
+    }
+}
+
+static void pack_b(int TB, int kc, int nc, float *B, int ldb, int nr, float *pb)
+{
+    int j, p, jj;
+    for(j = 0; j < nc; j += nr){
+        int jb = (nc - j < nr) ? nc - j : nr;
+        for(p = 0; p < kc; ++p){
+            if(TB){
+                float *src = B + j*ldb + p;
+                for(jj = 0; jj < jb; ++jj) pb[jj] = src[jj*ldb];
+            } else {
+                float *src = B + p*ldb + j;
+                for(jj = 0; jj < jb; ++jj) pb[jj] = src[jj];
+            }
+            for(; jj < nr; ++jj) pb[jj] = 0;
+            pb += nr;
+        }
+    }
+}
+
+typedef struct{
+    float *im;
+    int channels, height, width;
+    int ksize, stride, pad;
+    int out_w;
+} im2col_args;
+
+// Packs rows [pc, pc+kc) and columns [jc, jc+nc) of the im2col matrix of
+// the image straight into B micro-panels, so the full matrix never exists.
+static void pack_b_im2col(im2col_args *g, int pc, int kc, int jc, int nc, int nr, float *pb)
+{
+    int j, p, jj;
+    int ks = g->ksize;
+    for(j = 0; j < nc; j += nr){
+        int jb = (nc - j < nr) ? nc - j : nr;
+        int oh0 = (jc + j) / g->out_w;
+        int ow0 = (jc + j) % g->out_w;
+        for(p = 0; p < kc; ++p){
+            int row = pc + p;
+            int kw = row % ks;
+            int kh = (row / ks) % ks;
+            int c = row / ks / ks;
+            float *src = g->im + c*g->height*g->width;
+            int oh = oh0, ow = ow0;
+            for(jj = 0; jj < jb; ++jj){
+                int ih = oh*g->stride - g->pad + kh;
+                int iw = ow*g->stride - g->pad + kw;
+                pb[jj] = (ih >= 0 && ih < g->height && iw >= 0 && iw < g->width) ? src[ih*g->width + iw] : 0;
+                if(++ow == g->out_w){
+                    ow = 0;
+                    ++oh;
+                }
+            }
+            for(; jj < nr; ++jj) pb[jj] = 0;
+            pb += nr;
+        }
+    }
+}
+
+int gemm_epilogue_supported(ACTIVATION a)
+{
+    return a == LEAKY || a == RELU || a == LINEAR || a == LOGISTIC;
+}
+
+#define EPILOGUE_LOOP(f) \
+    for(j = 0; j < cols; ++j) c[j] = f(c[j]*s + b);
+
+void apply_gemm_epilogue(gemm_epilogue *e, int row, int rows, int cols, float *C, int ldc)
+{
+    int i, j;
+    for(i = 0; i < rows; ++i){
+        float s = e->scale ? e->scale[row + i] : 1;
+        float b = e->bias ? e->bias[row + i] : 0;
+        float *c = C + i*ldc;
+        switch(e->activation){
+            case LEAKY:
+                EPILOGUE_LOOP(leaky_activate)
+                break;
+            case RELU:
+                EPILOGUE_LOOP(relu_activate)
+                break;
+            case LOGISTIC:
+                EPILOGUE_LOOP(logistic_activate)
+                break;
+            default:
+                EPILOGUE_LOOP(linear_activate)
+        }
+    }
+}
+
+typedef struct{
+    gemm_kernel *k;
+    int mc, nc, kc;
+    float *pa, *pb, *C;
+    int ldc;
+    gemm_epilogue *e;
+    int row;
+} gemm_macro_args;
+
+// Tiles are numbered down each NR column panel, so consecutive tiles share
+// their B panel.
+static void gemm_macro_tiles(void *ptr, int begin, int end)
+{
+    gemm_macro_args *g = ptr;
+    gemm_kernel *k = g->k;
+    int mr = k->mr;
+    int nr = k->nr;
+    int mtiles = (g->mc + mr - 1)/mr;
+    float tmp[GEMM_MAX_MR*GEMM_MAX_NR] __attribute__((aligned(GEMM_ALIGN)));
+    int t, i, j;
+    for(t = begin; t < end; ++t){
+        int ir = t%mtiles*mr;
+        int jr = t/mtiles*nr;
+        int ib = (g->mc - ir < mr) ? g->mc - ir : mr;
+        int jb = (g->nc - jr < nr) ? g->nc - jr : nr;
+        float *a = g->pa + ir*g->kc;
+        float *b = g->pb + jr*g->kc;
+        float *c = g->C + ir*g->ldc + jr;
+        if(ib == mr && jb == nr){
+            k->kernel(g->kc, a, b, c, g->ldc);
+        } else {
+            memset(tmp, 0, mr*nr*sizeof(float));
+            k->kernel(g->kc, a, b, tmp, nr);
+            for(i = 0; i < ib; ++i){
+                for(j = 0; j < jb; ++j){
+                    c[i*g->ldc + j] += tmp[i*nr + j];
+                }
+            }
+        }
+        if(g->e) apply_gemm_epilogue(g->e, g->row + ir, ib, jb, c, g->ldc);
+    }
+}
+
+// e is only passed for the last K block, when C holds final sums and each
+// tile is still in cache.
+static void gemm_macro_kernel(gemm_kernel *k, int mc, int nc, int kc, float *pa, float *pb, float *C, int ldc, gemm_epilogue *e, int row)
+{
+    gemm_macro_args g = {k, mc, nc, kc, pa, pb, C, ldc, e, row};
+    int tiles = (mc + k->mr - 1)/k->mr*((nc + k->nr - 1)/k->nr);
+    parallel_for(tiles, parallel_grain(k->mr*k->nr*kc), gemm_macro_tiles, &g);
+}
+
+typedef struct{
+    int TB;
+    float *B;
+    int ldb;
+    im2col_args *conv;
+    int pc, kc, jc, nc, nr;
+    float *pb;
+} gemm_pack_b_args;
+
+static void gemm_pack_b_panels(void *ptr, int begin, int end)
+{
+    gemm_pack_b_args *g = ptr;
+    int j = begin*g->nr;
+    int nc = ((end*g->nr < g->nc) ? end*g->nr : g->nc) - j;
+    int jc = g->jc + j;
+    float *pb = g->pb + (size_t)j*g->kc;
+    if(g->conv) pack_b_im2col(g->conv, g->pc, g->kc, jc, nc, g->nr, pb);
+    else pack_b(g->TB, g->kc, nc, g->TB ? g->B + jc*g->ldb + g->pc : g->B + g->pc*g->ldb + jc, g->ldb, g->nr, pb);
+}
+
+static void *gemm_aligned_alloc(size_t size)
+{
+    void *ptr = 0;
+    if(posix_memalign(&ptr, GEMM_ALIGN, size)) malloc_error();
+    return ptr;
+}
+
+static void gemm_cpu_packed(gemm_kernel *k, int TA, int TB, int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        uint16_t *A_half, PRECISION precision,
+        float *A_packed,
+        float *B, int ldb,
+        im2col_args *conv,
+        float BETA,
+        float *C, int ldc,
+        gemm_epilogue *e)
+{
+    gemm_scale_c(M, N, BETA, C, ldc);
+    if(M <= 0 || N <= 0) return;
+    if(K <= 0 || ALPHA == 0){
+        if(e) apply_gemm_epilogue(e, 0, M, N, C, ldc);
+        return;
+    }
+
+    int mr = k->mr;
+    int nr = k->nr;
+    int mcmax = (GEMM_MC/mr)*mr;
+    int ncmax = (N < GEMM_NC) ? ((N + nr - 1)/nr)*nr : GEMM_NC;
+    int kcmax = (K < GEMM_KC) ? K : GEMM_KC;
+    int mpad = (M + mr - 1)/mr*mr;
+    float *pa = A_packed ? 0 : gemm_aligned_alloc((size_t)mcmax*kcmax*sizeof(float));
+    float *pb = gemm_aligned_alloc((size_t)ncmax*kcmax*sizeof(float));
+
+    int jc, pc, ic;
+    for(jc = 0; jc < N; jc += ncmax){
+        int nc = (N - jc < ncmax) ? N - jc : ncmax;
+        for(pc = 0; pc < K; pc += kcmax){
+            int kc = (K - pc < kcmax) ? K - pc : kcmax;
+            gemm_pack_b_args g = {TB, B, ldb, conv, pc, kc, jc, nc, nr, pb};
+            parallel_for((nc + nr - 1)/nr, parallel_grain(nr*kc), gemm_pack_b_panels, &g);
+            for(ic = 0; ic < M; ic += mcmax){
+                int mc = (M - ic < mcmax) ? M - ic : mcmax;
+                float *a = pa;
+                if(A_packed) a = A_packed + (size_t)pc*mpad + (size_t)ic*kc;
+                else if(A_half) pack_a_half(mc, kc, A_half + (size_t)ic*lda + pc, lda, precision, mr, pa);
+                else pack_a(TA, mc, kc, ALPHA, TA ? A + pc*lda + ic : A + ic*lda + pc, lda, mr, pa);
+                gemm_macro_kernel(k, mc, nc, kc, a, pb, C + ic*ldc + jc, ldc, (pc + kc == K) ? e : 0, ic);
+            }
+        }
+    }
+    free(pa);
+    free(pb);
+}
+
+void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc)
+{
+    //printf("cpu: %d %d %d %d %d %f %d %d %f %d\n",TA, TB, M, N, K, ALPHA, lda, ldb, BETA, ldc);
+    gemm_fused_cpu(TA, TB, M, N, K, ALPHA, A, lda, B, ldb, BETA, C, ldc, 0);
+}
+
+void gemm_fused_cpu(int TA, int TB, int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc,
+        gemm_epilogue *e)
+{
+    gemm_kernel *k = get_gemm_kernel();
+    // Packing doesn't pay off for matrix-vector shapes, e.g. batch 1 connected
+    // layers, but partial tiles still beat the reference loops
+    if(M < 4 || N < 4){
+        gemm_cpu_reference(TA, TB, M, N, K, ALPHA, A, lda, B, ldb, BETA, C, ldc);
+        if(e) apply_gemm_epilogue(e, 0, M, N, C, ldc);
+        return;
+    }
+    gemm_cpu_packed(k, TA, TB, M, N, K, ALPHA, A, lda, 0, FP32, 0, B, ldb, 0, BETA, C, ldc, e);
+}
+
+void gemm_im2col_cpu(int M, int N, int K, float ALPHA,
+        float *A, int lda,
+        float *im, int channels, int height, int width,
+        int ksize, int stride, int pad,
+        float BETA,
+        float *C, int ldc,
+        gemm_epilogue *e)
+{
+    im2col_args g = {0};
+    g.im = im;
+    g.channels = channels;
+    g.height = height;
+    g.width = width;
+    g.ksize = ksize;
+    g.stride = stride;
+    g.pad = pad;
+    g.out_w = (width + 2*pad - ksize) / stride + 1;
+    gemm_cpu_packed(get_gemm_kernel(), 0, 0, M, N, K, ALPHA, A, lda, 0, FP32, 0, 0, N, &g, BETA, C, ldc, e);
+}
+
+void gemm_half_cpu(int M, int N, int K,
+        uint16_t *A, int lda, PRECISION precision,
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc,
+        gemm_epilogue *e)
+{
+    if(M < 4 || N < 4){
+        float *a = calloc((size_t)M*K, sizeof(float));
+        int i;
+        for(i = 0; i < M; ++i) half_to_float(A + (size_t)i*lda, K, a + (size_t)i*K, precision);
+        gemm_fused_cpu(0, 0, M, N, K, 1, a, K, B, ldb, BETA, C, ldc, e);
+        free(a);
+        return;
+    }
+    gemm_cpu_packed(get_gemm_kernel(), 0, 0, M, N, K, 1, 0, lda, A, precision, 0, B, ldb, 0, BETA, C, ldc, e);
+}
+
+void gemm_im2col_half_cpu(int M, int N, int K,
+        uint16_t *A, int lda, PRECISION precision,
+        float *im, int channels, int height, int width,
+        int ksize, int stride, int pad,
+        float BETA,
+        float *C, int ldc,
+        gemm_epilogue *e)
+{
+    im2col_args g = {0};
+    g.im = im;
+    g.channels = channels;
+    g.height = height;
+    g.width = width;
+    g.ksize = ksize;
+    g.stride = stride;
+    g.pad = pad;
+    g.out_w = (width + 2*pad - ksize) / stride + 1;
+    gemm_cpu_packed(get_gemm_kernel(), 0, 0, M, N, K, 1, 0, lda, A, precision, 0, 0, N, &g, BETA, C, ldc, e);
+}
+
+// A packed once into the panels gemm_cpu_packed walks: K blocks outermost,
+// each holding all of M in MR row panels. Rows are multiplied by scale if
+// given, which folds batch norm into convolution weights.
+size_t gemm_packed_a_size(int M, int K)
+{
+    int mr = get_gemm_kernel()->mr;
+    return (size_t)(M + mr - 1)/mr*mr*K;
+}
+
+void gemm_pack_a(int M, int K, float *A, int lda, float *scale, float *packed)
+{
+    int mr = get_gemm_kernel()->mr;
+    int mpad = (M + mr - 1)/mr*mr;
+    int kcmax = (K < GEMM_KC) ? K : GEMM_KC;
+    int pc, i, p, ii;
+    for(pc = 0; pc < K; pc += kcmax){
+        int kc = (K - pc < kcmax) ? K - pc : kcmax;
+        float *pa = packed + (size_t)pc*mpad;
+        pack_a(0, M, kc, 1, A + pc, lda, mr, pa);
+        if(!scale) continue;
+        for(i = 0; i < M; i += mr){
+            for(p = 0; p < kc; ++p){
+                for(ii = 0; ii < mr && i + ii < M; ++ii) pa[(size_t)i*kc + p*mr + ii] *= scale[i + ii];
+            }
+        }
+    }
+}
+
+void gemm_prepacked_cpu(int M, int N, int K,
+        float *A,
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc,
+        gemm_epilogue *e)
+{
+    gemm_cpu_packed(get_gemm_kernel(), 0, 0, M, N, K, 1, 0, 0, 0, FP32, A, B, ldb, 0, BETA, C, ldc, e);
+}
+
+void gemm_im2col_prepacked_cpu(int M, int N, int K,
+        float *A,
+        float *im, int channels, int height, int width,
+        int ksize, int stride, int pad,
+        float BETA,
+        float *C, int ldc,
+        gemm_epilogue *e)
+{
+    im2col_args g = {0};
+    g.im = im;
+    g.channels = channels;
+    g.height = height;
+    g.width = width;
+    g.ksize = ksize;
+    g.stride = stride;
+    g.pad = pad;
+    g.out_w = (width + 2*pad - ksize) / stride + 1;
+    gemm_cpu_packed(get_gemm_kernel(), 0, 0, M, N, K, 1, 0, 0, 0, FP32, A, 0, N, &g, BETA, C, ldc, e);
+}
+
+static double time_gemm_cpu(gemm_kernel *k, int TA, int TB, int m, int n, int kk, float *a, int lda, float *b, int ldb, float *c, int iter)
+{
+    int i;
+    double start = what_time_is_it_now();
+    for(i = 0; i < iter; ++i){
+        if(k) gemm_cpu_packed(k, TA, TB, m, n, kk, 1, a, lda, 0, FP32, 0, b, ldb, 0, 0, c, n, 0);
+        else gemm_cpu_reference(TA, TB, m, n, kk, 1, a, lda, b, ldb, 0, c, n);
+    }
+    return (what_time_is_it_now() - start)/iter;
+}
+
+void benchmark_gemm_shape(int TA, int TB, int m, int k, int n, int iter)
+{
+    float *a;
+    if(!TA) a = random_matrix(m,k);
+    else a = random_matrix(k,m);
+    int lda = (!TA)?k:m;
+    float *b;
+    if(!TB) b = random_matrix(k,n);
+    else b = random_matrix(n,k);
+    int ldb = (!TB)?n:k;
+    float *truth = calloc(m*n, sizeof(float));
+    float *c = calloc(m*n, sizeof(float));
+    double gflop = 2.*m*n*k/1000000000.;
+    int i, j;
+
+    double t = time_gemm_cpu(0, TA, TB, m, n, k, a, lda, b, ldb, truth, iter);
+    printf("%5d x %5d x %5d TA=%d TB=%d  %-10s %8.3f ms %8.2f GFLOPS\n", m, n, k, TA, TB, "reference", t*1000, gflop/t);
+    int nk = sizeof(gemm_kernels)/sizeof(gemm_kernels[0]);
+    for(j = 0; j < nk; ++j){
+        gemm_kernel *kern = gemm_kernels + j;
+        if(!kern->supported()) continue;
+        t = time_gemm_cpu(kern, TA, TB, m, n, k, a, lda, b, ldb, c, iter);
+        float err = 0;
+        for(i = 0; i < m*n; ++i){
+            float e = fabs(c[i] - truth[i])/(fabs(truth[i]) + 1);
+            if(e > err) err = e;
+        }
+        printf("%5d x %5d x %5d TA=%d TB=%d  %-10s %8.3f ms %8.2f GFLOPS  max rel err %g\n", m, n, k, TA, TB, kern->name, t*1000, gflop/t, err);
+    }
+    free(a);
+    free(b);
+    free(c);
+    free(truth);
+}
+
+void benchmark_gemm_cpu(int iter)
+{
+    if(iter <= 0) iter = 3;
+    printf("Using GEMM kernel: %s\n", gemm_cpu_kernel_name());
+    // Forward convolutions from yolov3-416 / yolov3-tiny
+    benchmark_gemm_shape(0,0,32,27,173056,iter);
+    benchmark_gemm_shape(0,0,64,288,43264,iter);
+    benchmark_gemm_shape(0,0,128,576,10816,iter);
+    benchmark_gemm_shape(0,0,64,128,10816,iter);
+    benchmark_gemm_shape(0,0,256,1152,2704,iter);
+    benchmark_gemm_shape(0,0,512,2304,676,iter);
+    benchmark_gemm_shape(0,0,1024,4608,169,iter);
+    benchmark_gemm_shape(0,0,255,1024,169,iter);
+    // Backward passes
+    benchmark_gemm_shape(0,1,256,2704,1152,iter);
+    benchmark_gemm_shape(1,0,1152,256,2704,iter);
+    benchmark_gemm_shape(1,1,100,300,200,iter);
+}
+
 #ifdef GPU
 
 #include <math.h>
@@ -1,5 +1,15 @@
 #ifndef GEMM_H
 #define GEMM_H
+#include <stdint.h>
+#include "activations.h"
+
+// Applied to C as the last K block of each tile is written:
+// C = activation(C*scale[row] + bias[row]), scale and bias may be null.
+typedef struct{
+    float *scale;
+    float *bias;
+    ACTIVATION activation;
+} gemm_epilogue;
 
 void gemm_bin(int M, int N, int K, float ALPHA, 
         char  *A, int lda, 
@@ -18,6 +28,69 @@ void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
         float BETA,
         float *C, int ldc);
 
+void gemm_cpu_reference(int TA, int TB, int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc);
+
+void gemm_fused_cpu(int TA, int TB, int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc,
+        gemm_epilogue *e);
+
+void gemm_im2col_cpu(int M, int N, int K, float ALPHA,
+        float *A, int lda,
+        float *im, int channels, int height, int width,
+        int ksize, int stride, int pad,
+        float BETA,
+        float *C, int ldc,
+        gemm_epilogue *e);
+
+// A is stored as fp16 or bf16 rows and converted while it is packed
+void gemm_half_cpu(int M, int N, int K,
+        uint16_t *A, int lda, PRECISION precision,
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc,
+        gemm_epilogue *e);
+
+void gemm_im2col_half_cpu(int M, int N, int K,
+        uint16_t *A, int lda, PRECISION precision,
+        float *im, int channels, int height, int width,
+        int ksize, int stride, int pad,
+        float BETA,
+        float *C, int ldc,
+        gemm_epilogue *e);
+
+// A prepacked with gemm_pack_a, valid for the kernel of this process
+size_t gemm_packed_a_size(int M, int K);
+void gemm_pack_a(int M, int K, float *A, int lda, float *scale, float *packed);
+
+void gemm_prepacked_cpu(int M, int N, int K,
+        float *A,
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc,
+        gemm_epilogue *e);
+
+void gemm_im2col_prepacked_cpu(int M, int N, int K,
+        float *A,
+        float *im, int channels, int height, int width,
+        int ksize, int stride, int pad,
+        float BETA,
+        float *C, int ldc,
+        gemm_epilogue *e);
+
+int gemm_epilogue_supported(ACTIVATION a);
+void apply_gemm_epilogue(gemm_epilogue *e, int row, int rows, int cols, float *C, int ldc);
+
+char *gemm_cpu_kernel_name();
+void benchmark_gemm_shape(int TA, int TB, int m, int k, int n, int iter);
+void benchmark_gemm_cpu(int iter);
+
 #ifdef GPU
 void gemm_gpu(int TA, int TB, int M, int N, int K, float ALPHA, 
         float *A_gpu, int lda, 
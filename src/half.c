@@ -0,0 +1,176 @@
+#include "half.h"
+
+#include <pthread.h>
+#include <string.h>
+
+// Conversions between float and 16 bit storage. fp16 is IEEE half
+// precision, bf16 the upper half of a float. Both round to nearest even.
+
+static inline uint32_t float_bits(float f)
+{
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+static inline float bits_float(uint32_t u)
+{
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static uint16_t float_to_fp16(float f)
+{
+    uint32_t u = float_bits(f);
+    uint16_t sign = (u >> 16) & 0x8000;
+    int exp = ((u >> 23) & 0xff) - 127 + 15;
+    uint32_t mant = u & 0x7fffff;
+    if(((u >> 23) & 0xff) == 0xff) return sign | 0x7c00 | (mant ? 0x200 : 0);
+    if(exp >= 31) return sign | 0x7c00;
+    if(exp <= 0){
+        if(exp < -10) return sign;
+        mant |= 0x800000;
+        int shift = 14 - exp;
+        uint32_t half = mant >> shift;
+        uint32_t rest = mant & ((1u << shift) - 1);
+        uint32_t mid = 1u << (shift - 1);
+        if(rest > mid || (rest == mid && (half & 1))) ++half;
+        return sign | half;
+    }
+    uint32_t half = ((uint32_t)exp << 10) | (mant >> 13);
+    uint32_t rest = mant & 0x1fff;
+    if(rest > 0x1000 || (rest == 0x1000 && (half & 1))) ++half;
+    return sign | half;
+}
+
+static float fp16_to_float(uint16_t h)
+{
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    int exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    if(exp == 0x1f) return bits_float(sign | 0x7f800000 | (mant << 13));
+    if(exp == 0){
+        if(!mant) return bits_float(sign);
+        while(!(mant & 0x400)){
+            mant <<= 1;
+            --exp;
+        }
+        ++exp;
+        mant &= 0x3ff;
+    }
+    return bits_float(sign | ((uint32_t)(exp + 127 - 15) << 23) | (mant << 13));
+}
+
+static uint16_t float_to_bf16(float f)
+{
+    uint32_t u = float_bits(f);
+    if((u & 0x7fffffff) > 0x7f800000) return (u >> 16) | 0x40;
+    return (u + 0x7fff + ((u >> 16) & 1)) >> 16;
+}
+
+static void to_fp16_generic(float *src, int n, uint16_t *dst)
+{
+    int i;
+    for(i = 0; i < n; ++i) dst[i] = float_to_fp16(src[i]);
+}
+
+static void from_fp16_generic(uint16_t *src, int n, float *dst)
+{
+    int i;
+    for(i = 0; i < n; ++i) dst[i] = fp16_to_float(src[i]);
+}
+
+static void to_bf16_generic(float *src, int n, uint16_t *dst)
+{
+    int i;
+    for(i = 0; i < n; ++i) dst[i] = float_to_bf16(src[i]);
+}
+
+static void from_bf16_generic(uint16_t *src, int n, float *dst)
+{
+    int i;
+    for(i = 0; i < n; ++i) dst[i] = bits_float((uint32_t)src[i] << 16);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__((target("avx,f16c")))
+static void to_fp16_f16c(float *src, int n, uint16_t *dst)
+{
+    int i;
+    for(i = 0; i + 8 <= n; i += 8){
+        _mm_storeu_si128((__m128i *)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+    }
+    to_fp16_generic(src + i, n - i, dst + i);
+}
+
+__attribute__((target("avx,f16c")))
+static void from_fp16_f16c(uint16_t *src, int n, float *dst)
+{
+    int i;
+    for(i = 0; i + 8 <= n; i += 8){
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((__m128i *)(src + i))));
+    }
+    from_fp16_generic(src + i, n - i, dst + i);
+}
+
+__attribute__((target("avx512f,avx512bf16")))
+static void to_bf16_avx512bf16(float *src, int n, uint16_t *dst)
+{
+    int i;
+    for(i = 0; i + 16 <= n; i += 16){
+        __m256bh h = _mm512_cvtneps_pbh(_mm512_loadu_ps(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), (__m256i)h);
+    }
+    to_bf16_generic(src + i, n - i, dst + i);
+}
+#endif
+
+typedef struct{
+    void (*to_fp16)(float *src, int n, uint16_t *dst);
+    void (*from_fp16)(uint16_t *src, int n, float *dst);
+    void (*to_bf16)(float *src, int n, uint16_t *dst);
+} half_conversions;
+
+static half_conversions conversions = {to_fp16_generic, from_fp16_generic, to_bf16_generic};
+static pthread_once_t conversions_once = PTHREAD_ONCE_INIT;
+
+static void select_conversions()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c")){
+        conversions.to_fp16 = to_fp16_f16c;
+        conversions.from_fp16 = from_fp16_f16c;
+    }
+    if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bf16")){
+        conversions.to_bf16 = to_bf16_avx512bf16;
+    }
+#endif
+}
+
+void float_to_half(float *src, int n, uint16_t *dst, PRECISION p)
+{
+    pthread_once(&conversions_once, select_conversions);
+    if(p == BF16) conversions.to_bf16(src, n, dst);
+    else conversions.to_fp16(src, n, dst);
+}
+
+void half_to_float(uint16_t *src, int n, float *dst, PRECISION p)
+{
+    pthread_once(&conversions_once, select_conversions);
+    // bf16 widens with a shift, which the compiler vectorizes on its own
+    if(p == BF16) from_bf16_generic(src, n, dst);
+    else conversions.from_fp16(src, n, dst);
+}
+
+PRECISION get_precision(char *s)
+{
+    if(strcmp(s, "fp32") == 0) return FP32;
+    if(strcmp(s, "fp16") == 0) return FP16;
+    if(strcmp(s, "bf16") == 0) return BF16;
+    fprintf(stderr, "Couldn't find precision %s, going with fp32\n", s);
+    return FP32;
+}
@@ -0,0 +1,10 @@
+#ifndef HALF_H
+#define HALF_H
+#include <stdint.h>
+#include "darknet.h"
+
+void float_to_half(float *src, int n, uint16_t *dst, PRECISION p);
+void half_to_float(uint16_t *src, int n, float *dst, PRECISION p);
+PRECISION get_precision(char *s);
+
+#endif
@@ -1,4 +1,5 @@
 #include "im2col.h"
+#include "parallel.h"
 #include <stdio.h>
 float im2col_get_pixel(float *im, int height, int width, int channels,
                         int row, int col, int channel, int pad)
@@ -11,18 +12,27 @@ float im2col_get_pixel(float *im, int height, int width, int channels,
     return im[col + width*(row + height*channel)];
 }
 
+typedef struct{
+    float *data_im;
+    int channels, height, width;
+    int ksize, stride, pad;
+    float *data_col;
+} im2col_cpu_args;
+
 //From Berkeley Vision's Caffe!
 //https://github.com/BVLC/caffe/blob/master/LICENSE
-void im2col_cpu(float* data_im,
-     int channels,  int height,  int width,
-     int ksize,  int stride, int pad, float* data_col) 
+static void im2col_cpu_rows(void *ptr, int begin, int end)
 {
+    im2col_cpu_args *a = ptr;
+    float *data_im = a->data_im;
+    float *data_col = a->data_col;
+    int channels = a->channels, height = a->height, width = a->width;
+    int ksize = a->ksize, stride = a->stride, pad = a->pad;
     int c,h,w;
     int height_col = (height + 2*pad - ksize) / stride + 1;
     int width_col = (width + 2*pad - ksize) / stride + 1;
 
-    int channels_col = channels * ksize * ksize;
-    for (c = 0; c < channels_col; ++c) {
+    for (c = begin; c < end; ++c) {
         int w_offset = c % ksize;
         int h_offset = (c / ksize) % ksize;
         int c_im = c / ksize / ksize;
@@ -38,3 +48,12 @@ void im2col_cpu(float* data_im,
     }
 }
 
+void im2col_cpu(float* data_im,
+     int channels,  int height,  int width,
+     int ksize,  int stride, int pad, float* data_col) 
+{
+    im2col_cpu_args a = {data_im, channels, height, width, ksize, stride, pad, data_col};
+    int height_col = (height + 2*pad - ksize) / stride + 1;
+    int width_col = (width + 2*pad - ksize) / stride + 1;
+    parallel_for(channels*ksize*ksize, parallel_grain(height_col*width_col), im2col_cpu_rows, &a);
+}
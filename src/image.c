@@ -4,6 +4,7 @@
 #include "cuda.h"
 #include <stdio.h>
 #include <math.h>
+#include <pthread.h>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -596,19 +597,7 @@ int show_image(image p, const char *name, int ms)
 void ipl_into_image(IplImage* src, image im)
 {
     unsigned char *data = (unsigned char *)src->imageData;
-    int h = src->height;
-    int w = src->width;
-    int c = src->nChannels;
-    int step = src->widthStep;
-    int i, j, k;
-
-    for(i = 0; i < h; ++i){
-        for(k= 0; k < c; ++k){
-            for(j = 0; j < w; ++j){
-                im.data[k*w*h + i*w + j] = data[i*step + j*c + k]/255.;
-            }
-        }
-    }
+    letterbox_bytes_into(data, src->width, src->height, src->nChannels, src->widthStep, 0, im);
 }
 
 image ipl_to_image(IplImage* src)
@@ -668,8 +657,7 @@ int fill_image_from_stream(CvCapture *cap, image im)
 {
     IplImage* src = cvQueryFrame(cap);
     if (!src) return 0;
-    ipl_into_image(src, im);
-    rgbgr_image(im);
+    letterbox_bytes_into((unsigned char *)src->imageData, src->width, src->height, src->nChannels, src->widthStep, im.c == 3, im);
     return 1;
 }
 
@@ -945,43 +933,6 @@ void composite_3d(char *f1, char *f2, char *out, int delta)
 #endif
 }
 
-void letterbox_image_into(image im, int w, int h, image boxed)
-{
-    int new_w = im.w;
-    int new_h = im.h;
-    if (((float)w/im.w) < ((float)h/im.h)) {
-        new_w = w;
-        new_h = (im.h * w)/im.w;
-    } else {
-        new_h = h;
-        new_w = (im.w * h)/im.h;
-    }
-    image resized = resize_image(im, new_w, new_h);
-    embed_image(resized, boxed, (w-new_w)/2, (h-new_h)/2); 
-    free_image(resized);
-}
-
-image letterbox_image(image im, int w, int h)
-{
-    int new_w = im.w;
-    int new_h = im.h;
-    if (((float)w/im.w) < ((float)h/im.h)) {
-        new_w = w;
-        new_h = (im.h * w)/im.w;
-    } else {
-        new_h = h;
-        new_w = (im.w * h)/im.h;
-    }
-    image resized = resize_image(im, new_w, new_h);
-    image boxed = make_image(w, h, im.c);
-    fill_image(boxed, .5);
-    //int i;
-    //for(i = 0; i < boxed.w*boxed.h*boxed.c; ++i) boxed.data[i] = 0;
-    embed_image(resized, boxed, (w-new_w)/2, (h-new_h)/2); 
-    free_image(resized);
-    return boxed;
-}
-
 image resize_max(image im, int max)
 {
     int w = im.w;
@@ -1348,9 +1299,273 @@ void saturate_exposure_image(image im, float sat, float exposure)
     constrain_image(im);
 }
 
+// Bilinear resizing one output row at a time, both directions in one go,
+// with the source columns and weights of every output column worked out
+// once per image. Sources are combined in the same order the two pass
+// version used, so the results are the same, except that the last row now
+// comes from the last source row, the way the last column always has.
+
+// dst[x] = wy0*(w0[x]*r0[x0[x]] + w1[x]*r0[x1[x]]) + wy1*(same on r1)
+typedef void (*resize_row_fn)(const float *r0, const float *r1, float wy0, float wy1,
+        const int *x0, const int *x1, const float *w0, const float *w1, int n, float *dst);
+
+static void resize_row_generic(const float *r0, const float *r1, float wy0, float wy1,
+        const int *x0, const int *x1, const float *w0, const float *w1, int n, float *dst)
+{
+    int x;
+    for(x = 0; x < n; ++x){
+        float a = w0[x]*r0[x0[x]] + w1[x]*r0[x1[x]];
+        float b = w0[x]*r1[x0[x]] + w1[x]*r1[x1[x]];
+        dst[x] = wy0*a + wy1*b;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+// no FMA, so it rounds like the scalar code
+__attribute__((target("avx2")))
+static void resize_row_avx2(const float *r0, const float *r1, float wy0, float wy1,
+        const int *x0, const int *x1, const float *w0, const float *w1, int n, float *dst)
+{
+    __m256 vy0 = _mm256_set1_ps(wy0);
+    __m256 vy1 = _mm256_set1_ps(wy1);
+    int x;
+    for(x = 0; x + 8 <= n; x += 8){
+        __m256i i0 = _mm256_loadu_si256((__m256i *)(x0 + x));
+        __m256i i1 = _mm256_loadu_si256((__m256i *)(x1 + x));
+        __m256 v0 = _mm256_loadu_ps(w0 + x);
+        __m256 v1 = _mm256_loadu_ps(w1 + x);
+        __m256 a = _mm256_add_ps(_mm256_mul_ps(v0, _mm256_i32gather_ps(r0, i0, 4)), _mm256_mul_ps(v1, _mm256_i32gather_ps(r0, i1, 4)));
+        __m256 b = _mm256_add_ps(_mm256_mul_ps(v0, _mm256_i32gather_ps(r1, i0, 4)), _mm256_mul_ps(v1, _mm256_i32gather_ps(r1, i1, 4)));
+        _mm256_storeu_ps(dst + x, _mm256_add_ps(_mm256_mul_ps(vy0, a), _mm256_mul_ps(vy1, b)));
+    }
+    resize_row_generic(r0, r1, wy0, wy1, x0 + x, x1 + x, w0 + x, w1 + x, n - x, dst + x);
+}
+#endif
+
+static resize_row_fn resize_row = resize_row_generic;
+static pthread_once_t resize_row_once = PTHREAD_ONCE_INIT;
+
+static void select_resize_row()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) resize_row = resize_row_avx2;
+#endif
+}
+
+static void resize_taps(int n, int src, int *i0, int *i1, float *w0, float *w1)
+{
+    int i;
+    float scale = (float)(src - 1) / (n - 1);
+    for(i = 0; i < n; ++i){
+        if(i == n-1 || src == 1){
+            i0[i] = i1[i] = src - 1;
+            w0[i] = 1;
+            w1[i] = 0;
+        } else {
+            float s = i*scale;
+            int is = (int) s;
+            float d = s - is;
+            i0[i] = is;
+            i1[i] = is + 1;
+            w0[i] = 1 - d;
+            w1[i] = d;
+        }
+    }
+}
+
+// Resizes im to w x h into out, starting at column dx and row dy
+static void resize_image_at(image im, int w, int h, image out, int dx, int dy)
+{
+    pthread_once(&resize_row_once, select_resize_row);
+    int x0[w], x1[w];
+    float w0[w], w1[w];
+    int y0[h], y1[h];
+    float v0[h], v1[h];
+    resize_taps(w, im.w, x0, x1, w0, w1);
+    resize_taps(h, im.h, y0, y1, v0, v1);
+    int k, r;
+    for(k = 0; k < im.c; ++k){
+        float *src = im.data + (size_t)k*im.w*im.h;
+        float *dst = out.data + ((size_t)k*out.h + dy)*out.w + dx;
+        for(r = 0; r < h; ++r){
+            resize_row(src + (size_t)y0[r]*im.w, src + (size_t)y1[r]*im.w, v0[r], v1[r], x0, x1, w0, w1, w, dst + (size_t)r*out.w);
+        }
+    }
+}
+
 image resize_image(image im, int w, int h)
 {
-    image resized = make_image(w, h, im.c);   
+    image resized = make_image(w, h, im.c);
+    resize_image_at(im, w, h, resized, 0, 0);
+    return resized;
+}
+
+static void letterbox_size(int im_w, int im_h, int w, int h, int *new_w, int *new_h)
+{
+    *new_w = im_w;
+    *new_h = im_h;
+    if (((float)w/im_w) < ((float)h/im_h)) {
+        *new_w = w;
+        *new_h = (im_h * w)/im_w;
+    } else {
+        *new_h = h;
+        *new_w = (im_w * h)/im_h;
+    }
+}
+
+// .5 around the new_w x new_h box at dx, dy
+static void fill_letterbox_border(image boxed, int new_w, int new_h, int dx, int dy)
+{
+    int k, r, x;
+    for(k = 0; k < boxed.c; ++k){
+        float *ch = boxed.data + (size_t)k*boxed.w*boxed.h;
+        for(r = 0; r < boxed.h; ++r){
+            float *row = ch + (size_t)r*boxed.w;
+            if(r < dy || r >= dy + new_h){
+                for(x = 0; x < boxed.w; ++x) row[x] = .5;
+                continue;
+            }
+            for(x = 0; x < dx; ++x) row[x] = .5;
+            for(x = dx + new_w; x < boxed.w; ++x) row[x] = .5;
+        }
+    }
+}
+
+// Letterboxes im into boxed, which must be w x h with im's channels: im
+// resized to fit, keeping its aspect ratio, and .5 around it. Nothing is
+// allocated, so it can fill a network's input directly.
+void letterbox_image_into(image im, int w, int h, image boxed)
+{
+    int new_w, new_h;
+    letterbox_size(im.w, im.h, w, h, &new_w, &new_h);
+    int dx = (w-new_w)/2;
+    int dy = (h-new_h)/2;
+    fill_letterbox_border(boxed, new_w, new_h, dx, dy);
+    resize_image_at(im, new_w, new_h, boxed, dx, dy);
+}
+
+// The same from 8 bit interleaved pixels, as stb and OpenCV hand them out,
+// with the byte to float scaling, the channel swap (swap_rb for BGR) and the
+// interleaved to planar transpose done on the way.
+
+static float byte_to_float[256];
+static pthread_once_t byte_to_float_once = PTHREAD_ONCE_INIT;
+
+static void make_byte_to_float()
+{
+    int i;
+    for(i = 0; i < 256; ++i) byte_to_float[i] = (float)i/255.;
+}
+
+// resize_row on bytes, x0 and x1 being byte offsets
+typedef void (*resize_bytes_row_fn)(const unsigned char *r0, const unsigned char *r1, float wy0, float wy1,
+        const int *x0, const int *x1, const float *w0, const float *w1, int n, float *dst);
+
+static void resize_bytes_row_generic(const unsigned char *r0, const unsigned char *r1, float wy0, float wy1,
+        const int *x0, const int *x1, const float *w0, const float *w1, int n, float *dst)
+{
+    int x;
+    for(x = 0; x < n; ++x){
+        float a = w0[x]*byte_to_float[r0[x0[x]]] + w1[x]*byte_to_float[r0[x1[x]]];
+        float b = w0[x]*byte_to_float[r1[x0[x]]] + w1[x]*byte_to_float[r1[x1[x]]];
+        dst[x] = wy0*a + wy1*b;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// Gathers 4 bytes from each offset and keeps the first, so it reads up to 3
+// bytes past the last one: only for rows with another row after them. The
+// floats come from the table too, as -Ofast would turn a division by 255
+// into a multiplication that rounds differently.
+__attribute__((target("avx2")))
+static void resize_bytes_row_avx2(const unsigned char *r0, const unsigned char *r1, float wy0, float wy1,
+        const int *x0, const int *x1, const float *w0, const float *w1, int n, float *dst)
+{
+    __m256 vy0 = _mm256_set1_ps(wy0);
+    __m256 vy1 = _mm256_set1_ps(wy1);
+    __m256i mask = _mm256_set1_epi32(0xff);
+    int x;
+#define BYTES_TO_FLOAT(r, i) _mm256_i32gather_ps(byte_to_float, _mm256_and_si256(_mm256_i32gather_epi32((const int *)(r), i, 1), mask), 4)
+    for(x = 0; x + 8 <= n; x += 8){
+        __m256i i0 = _mm256_loadu_si256((__m256i *)(x0 + x));
+        __m256i i1 = _mm256_loadu_si256((__m256i *)(x1 + x));
+        __m256 v0 = _mm256_loadu_ps(w0 + x);
+        __m256 v1 = _mm256_loadu_ps(w1 + x);
+        __m256 a = _mm256_add_ps(_mm256_mul_ps(v0, BYTES_TO_FLOAT(r0, i0)), _mm256_mul_ps(v1, BYTES_TO_FLOAT(r0, i1)));
+        __m256 b = _mm256_add_ps(_mm256_mul_ps(v0, BYTES_TO_FLOAT(r1, i0)), _mm256_mul_ps(v1, BYTES_TO_FLOAT(r1, i1)));
+        _mm256_storeu_ps(dst + x, _mm256_add_ps(_mm256_mul_ps(vy0, a), _mm256_mul_ps(vy1, b)));
+    }
+#undef BYTES_TO_FLOAT
+    resize_bytes_row_generic(r0, r1, wy0, wy1, x0 + x, x1 + x, w0 + x, w1 + x, n - x, dst + x);
+}
+#endif
+
+static resize_bytes_row_fn resize_bytes_row = resize_bytes_row_generic;
+
+static void select_resize_bytes_row()
+{
+    make_byte_to_float();
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) resize_bytes_row = resize_bytes_row_avx2;
+#endif
+}
+
+// data is w x h with c channels interleaved, rows step bytes apart. boxed
+// gets it letterboxed to boxed.w x boxed.h, as load, rgbgr_image (if
+// swap_rb) and letterbox_image_into would in turn; at the same size it is
+// just the conversion.
+void letterbox_bytes_into(unsigned char *data, int w, int h, int c, int step, int swap_rb, image boxed)
+{
+    pthread_once(&byte_to_float_once, select_resize_bytes_row);
+    int new_w, new_h;
+    letterbox_size(w, h, boxed.w, boxed.h, &new_w, &new_h);
+    int dx = (boxed.w-new_w)/2;
+    int dy = (boxed.h-new_h)/2;
+    fill_letterbox_border(boxed, new_w, new_h, dx, dy);
+    int x0[new_w], x1[new_w];
+    float w0[new_w], w1[new_w];
+    int y0[new_h], y1[new_h];
+    float v0[new_h], v1[new_h];
+    resize_taps(new_w, w, x0, x1, w0, w1);
+    resize_taps(new_h, h, y0, y1, v0, v1);
+    int i, k, r;
+    for(i = 0; i < new_w; ++i){
+        x0[i] *= c;
+        x1[i] *= c;
+    }
+    for(k = 0; k < c; ++k){
+        int src = (swap_rb && c >= 3 && k < 3) ? 2 - k : k;
+        float *dst = boxed.data + ((size_t)k*boxed.h + dy)*boxed.w + dx;
+        for(r = 0; r < new_h; ++r){
+            unsigned char *r0 = data + (size_t)y0[r]*step + src;
+            unsigned char *r1 = data + (size_t)y1[r]*step + src;
+            float *out = dst + (size_t)r*boxed.w;
+            if(new_w == w && new_h == h){
+                for(i = 0; i < w; ++i) out[i] = byte_to_float[r0[i*c]];
+            } else if(y1[r] < h-1){
+                resize_bytes_row(r0, r1, v0[r], v1[r], x0, x1, w0, w1, new_w, out);
+            } else {
+                resize_bytes_row_generic(r0, r1, v0[r], v1[r], x0, x1, w0, w1, new_w, out);
+            }
+        }
+    }
+}
+
+image letterbox_image(image im, int w, int h)
+{
+    image boxed = make_image(w, h, im.c);
+    letterbox_image_into(im, w, h, boxed);
+    return boxed;
+}
+
+// The two pass resize and letterbox these replace, for the benchmark
+static image resize_image_reference(image im, int w, int h)
+{
+    image resized = make_image(w, h, im.c);
     image part = make_image(w, im.h, im.c);
     int r, c, k;
     float w_scale = (float)(im.w - 1) / (w - 1);
@@ -1392,6 +1607,115 @@ image resize_image(image im, int w, int h)
     return resized;
 }
 
+static image letterbox_image_reference(image im, int w, int h)
+{
+    int new_w = im.w;
+    int new_h = im.h;
+    if (((float)w/im.w) < ((float)h/im.h)) {
+        new_w = w;
+        new_h = (im.h * w)/im.w;
+    } else {
+        new_h = h;
+        new_w = (im.w * h)/im.h;
+    }
+    image resized = resize_image_reference(im, new_w, new_h);
+    image boxed = make_image(w, h, im.c);
+    fill_image(boxed, .5);
+    embed_image(resized, boxed, (w-new_w)/2, (h-new_h)/2);
+    free_image(resized);
+    return boxed;
+}
+
+static void benchmark_letterbox_size(image im, int w, int h, int iter)
+{
+    int i;
+    image boxed = make_image(w, h, im.c);
+    image truth = letterbox_image_reference(im, w, h);
+    double t = what_time_is_it_now();
+    for(i = 0; i < iter; ++i){
+        image ref = letterbox_image_reference(im, w, h);
+        free_image(ref);
+    }
+    double ref = (what_time_is_it_now() - t)/iter;
+    t = what_time_is_it_now();
+    for(i = 0; i < iter; ++i) letterbox_image_into(im, w, h, boxed);
+    double fast = (what_time_is_it_now() - t)/iter;
+    float err = 0;
+    int differ = 0;
+    for(i = 0; i < w*h*im.c; ++i){
+        float e = fabs(boxed.data[i] - truth.data[i]);
+        if(e > 0) ++differ;
+        if(e > err) err = e;
+    }
+    printf("%4dx%4d -> %4dx%4d  reference %8.3f ms  into %8.3f ms  %5.1fx  %d values differ, max %g\n",
+            im.w, im.h, w, h, ref*1000, fast*1000, ref/fast, differ, err);
+    free_image(truth);
+    free_image(boxed);
+}
+
+// 8 bit BGR the way it was done before letterbox_bytes_into: to float,
+// then swapped, then letterboxed
+static image letterbox_bytes_reference(unsigned char *data, int w, int h, int c, int w_out, int h_out)
+{
+    int i, j, k;
+    image im = make_image(w, h, c);
+    for(k = 0; k < c; ++k){
+        for(j = 0; j < h; ++j){
+            for(i = 0; i < w; ++i){
+                im.data[i + w*j + w*h*k] = (float)data[k + c*i + c*w*j]/255.;
+            }
+        }
+    }
+    rgbgr_image(im);
+    image boxed = letterbox_image_reference(im, w_out, h_out);
+    free_image(im);
+    return boxed;
+}
+
+static void benchmark_letterbox_bytes_size(unsigned char *data, int w, int h, int c, int w_out, int h_out, int iter)
+{
+    int i;
+    image boxed = make_image(w_out, h_out, c);
+    image truth = letterbox_bytes_reference(data, w, h, c, w_out, h_out);
+    double t = what_time_is_it_now();
+    for(i = 0; i < iter; ++i){
+        image ref = letterbox_bytes_reference(data, w, h, c, w_out, h_out);
+        free_image(ref);
+    }
+    double ref = (what_time_is_it_now() - t)/iter;
+    t = what_time_is_it_now();
+    for(i = 0; i < iter; ++i) letterbox_bytes_into(data, w, h, c, w*c, 1, boxed);
+    double fast = (what_time_is_it_now() - t)/iter;
+    float err = 0;
+    int differ = 0;
+    for(i = 0; i < w_out*h_out*c; ++i){
+        float e = fabs(boxed.data[i] - truth.data[i]);
+        if(e > 0) ++differ;
+        if(e > err) err = e;
+    }
+    printf("%4dx%4d bytes -> %4dx%4d  reference %8.3f ms  fused %8.3f ms  %5.1fx  %d values differ, max %g\n",
+            w, h, w_out, h_out, ref*1000, fast*1000, ref/fast, differ, err);
+    free_image(truth);
+    free_image(boxed);
+}
+
+void benchmark_letterbox(int iter)
+{
+    if(iter <= 0) iter = 20;
+    int i;
+    image im = make_image(1920, 1080, 3);
+    for(i = 0; i < im.w*im.h*im.c; ++i) im.data[i] = rand_uniform(0, 1);
+    benchmark_letterbox_size(im, 416, 416, iter);
+    benchmark_letterbox_size(im, 608, 608, iter);
+    free_image(im);
+
+    unsigned char *data = calloc(1920*1080*3, 1);
+    for(i = 0; i < 1920*1080*3; ++i) data[i] = rand();
+    benchmark_letterbox_bytes_size(data, 1920, 1080, 3, 416, 416, iter);
+    benchmark_letterbox_bytes_size(data, 1920, 1080, 3, 608, 608, iter);
+    benchmark_letterbox_bytes_size(data, 1920, 1080, 3, 1920, 1080, iter);
+    free(data);
+}
 
 void test_resize(char *filename)
 {
@@ -1452,17 +1776,8 @@ image load_image_stb(char *filename, int channels)
         exit(0);
     }
     if(channels) c = channels;
-    int i,j,k;
     image im = make_image(w, h, c);
-    for(k = 0; k < c; ++k){
-        for(j = 0; j < h; ++j){
-            for(i = 0; i < w; ++i){
-                int dst_index = i + w*j + w*h*k;
-                int src_index = k + c*i + c*w*j;
-                im.data[dst_index] = (float)data[src_index]/255.;
-            }
-        }
-    }
+    letterbox_bytes_into(data, w, h, c, w*c, 0, im);
     free(data);
     return im;
 }
@@ -64,7 +64,7 @@ void resize_iseg_layer(layer *l, int w, int h)
     l->inputs = l->outputs;
 
     l->output = realloc(l->output, l->batch*l->outputs*sizeof(float));
-    l->delta = realloc(l->delta, l->batch*l->outputs*sizeof(float));
+    if(l->delta) l->delta = realloc(l->delta, l->batch*l->outputs*sizeof(float));
 
 #ifdef GPU
     cuda_free(l->delta_gpu);
@@ -82,7 +82,6 @@ void forward_iseg_layer(const layer l, network net)
     int i,b,j,k;
     int ids = l.extra;
     memcpy(l.output, net.input, l.outputs*l.batch*sizeof(float));
-    memset(l.delta, 0, l.outputs * l.batch * sizeof(float));
 
 #ifndef GPU
     for (b = 0; b < l.batch; ++b){
@@ -91,6 +90,9 @@ void forward_iseg_layer(const layer l, network net)
     }
 #endif
 
+    if(!net.train) return;
+    memset(l.delta, 0, l.outputs * l.batch * sizeof(float));
+
     for (b = 0; b < l.batch; ++b){
         // a priori, each pixel has no class
         for(i = 0; i < l.classes; ++i){
@@ -210,7 +212,7 @@ void forward_iseg_layer_gpu(const layer l, network net)
 
     cuda_pull_array(l.output_gpu, net.input, l.batch*l.inputs);
     forward_iseg_layer(l, net);
-    cuda_push_array(l.delta_gpu, l.delta, l.batch*l.outputs);
+    if(net.train) cuda_push_array(l.delta_gpu, l.delta, l.batch*l.outputs);
 }
 
 void backward_iseg_layer_gpu(const layer l, network net)
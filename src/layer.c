@@ -5,6 +5,10 @@
 
 void free_layer(layer l)
 {
+    if(l.mapped){
+        // owned by the network's weights mapping
+        l.biases = l.scales = l.weights = l.rolling_mean = l.rolling_variance = 0;
+    }
     if(l.type == DROPOUT){
         if(l.rand)           free(l.rand);
 #ifdef GPU
@@ -27,6 +31,17 @@ void free_layer(layer l)
     if(l.concat)             free(l.concat);
     if(l.concat_delta)       free(l.concat_delta);
     if(l.binary_weights)     free(l.binary_weights);
+    if(l.winograd_weights)   free(l.winograd_weights);
+    if(l.weights_int8)       free(l.weights_int8);
+    if(l.weight_scales)      free(l.weight_scales);
+    if(l.weight_sums)        free(l.weight_sums);
+    if(l.xnor_weights)       free(l.xnor_weights);
+    if(l.xnor_scales)        free(l.xnor_scales);
+    if(l.xnor_popcounts)     free(l.xnor_popcounts);
+    if(l.weights_half)       free(l.weights_half);
+    if(l.weights_packed)     free(l.weights_packed);
+    if(l.folded_scales)      free(l.folded_scales);
+    if(l.folded_biases)      free(l.folded_biases);
     if(l.biases)             free(l.biases);
     if(l.bias_updates)       free(l.bias_updates);
     if(l.scales)             free(l.scales);
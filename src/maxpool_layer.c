@@ -1,5 +1,6 @@
 #include "maxpool_layer.h"
 #include "cuda.h"
+#include "parallel.h"
 #include <stdio.h>
 
 image get_maxpool_image(maxpool_layer l)
@@ -18,7 +19,7 @@ image get_maxpool_delta(maxpool_layer l)
     return float_to_image(w,h,c,l.delta);
 }
 
-maxpool_layer make_maxpool_layer(int batch, int h, int w, int c, int size, int stride, int padding)
+maxpool_layer make_maxpool_layer(int batch, int h, int w, int c, int size, int stride, int padding, int inference)
 {
     maxpool_layer l = {0};
     l.type = MAXPOOL;
@@ -35,9 +36,9 @@ maxpool_layer make_maxpool_layer(int batch, int h, int w, int c, int size, int s
     l.size = size;
     l.stride = stride;
     int output_size = l.out_h * l.out_w * l.out_c * batch;
-    l.indexes = calloc(output_size, sizeof(int));
+    if(!inference) l.indexes = calloc(output_size, sizeof(int));
     l.output =  calloc(output_size, sizeof(float));
-    l.delta =   calloc(output_size, sizeof(float));
+    if(!inference) l.delta =   calloc(output_size, sizeof(float));
     l.forward = forward_maxpool_layer;
     l.backward = backward_maxpool_layer;
     #ifdef GPU
@@ -62,9 +63,9 @@ void resize_maxpool_layer(maxpool_layer *l, int w, int h)
     l->outputs = l->out_w * l->out_h * l->c;
     int output_size = l->outputs * l->batch;
 
-    l->indexes = realloc(l->indexes, output_size * sizeof(int));
+    if(l->indexes) l->indexes = realloc(l->indexes, output_size * sizeof(int));
     l->output = realloc(l->output, output_size * sizeof(float));
-    l->delta = realloc(l->delta, output_size * sizeof(float));
+    if(l->delta) l->delta = realloc(l->delta, output_size * sizeof(float));
 
     #ifdef GPU
     cuda_free((float *)l->indexes_gpu);
@@ -76,9 +77,16 @@ void resize_maxpool_layer(maxpool_layer *l, int w, int h)
     #endif
 }
 
-void forward_maxpool_layer(const maxpool_layer l, network net)
+typedef struct{
+    maxpool_layer l;
+    float *input;
+} maxpool_args;
+
+static void forward_maxpool_planes(void *ptr, int begin, int end)
 {
-    int b,i,j,k,m,n;
+    maxpool_args *a = ptr;
+    maxpool_layer l = a->l;
+    int p,b,i,j,k,m,n;
     int w_offset = -l.pad/2;
     int h_offset = -l.pad/2;
 
@@ -86,33 +94,39 @@ void forward_maxpool_layer(const maxpool_layer l, network net)
     int w = l.out_w;
     int c = l.c;
 
-    for(b = 0; b < l.batch; ++b){
-        for(k = 0; k < c; ++k){
-            for(i = 0; i < h; ++i){
-                for(j = 0; j < w; ++j){
-                    int out_index = j + w*(i + h*(k + c*b));
-                    float max = -FLT_MAX;
-                    int max_i = -1;
-                    for(n = 0; n < l.size; ++n){
-                        for(m = 0; m < l.size; ++m){
-                            int cur_h = h_offset + i*l.stride + n;
-                            int cur_w = w_offset + j*l.stride + m;
-                            int index = cur_w + l.w*(cur_h + l.h*(k + b*l.c));
-                            int valid = (cur_h >= 0 && cur_h < l.h &&
-                                         cur_w >= 0 && cur_w < l.w);
-                            float val = (valid != 0) ? net.input[index] : -FLT_MAX;
-                            max_i = (val > max) ? index : max_i;
-                            max   = (val > max) ? val   : max;
-                        }
+    for(p = begin; p < end; ++p){
+        b = p / c;
+        k = p % c;
+        for(i = 0; i < h; ++i){
+            for(j = 0; j < w; ++j){
+                int out_index = j + w*(i + h*(k + c*b));
+                float max = -FLT_MAX;
+                int max_i = -1;
+                for(n = 0; n < l.size; ++n){
+                    for(m = 0; m < l.size; ++m){
+                        int cur_h = h_offset + i*l.stride + n;
+                        int cur_w = w_offset + j*l.stride + m;
+                        int index = cur_w + l.w*(cur_h + l.h*(k + b*l.c));
+                        int valid = (cur_h >= 0 && cur_h < l.h &&
+                                     cur_w >= 0 && cur_w < l.w);
+                        float val = (valid != 0) ? a->input[index] : -FLT_MAX;
+                        max_i = (val > max) ? index : max_i;
+                        max   = (val > max) ? val   : max;
                     }
-                    l.output[out_index] = max;
-                    l.indexes[out_index] = max_i;
                 }
+                l.output[out_index] = max;
+                if(l.indexes) l.indexes[out_index] = max_i;
             }
         }
     }
 }
 
+void forward_maxpool_layer(const maxpool_layer l, network net)
+{
+    maxpool_args a = {l, net.input};
+    parallel_for(l.batch*l.c, parallel_grain(l.out_h*l.out_w*l.size*l.size), forward_maxpool_planes, &a);
+}
+
 void backward_maxpool_layer(const maxpool_layer l, network net)
 {
     int i;
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <time.h>
 #include <assert.h>
+#include <sys/mman.h>
 #include "network.h"
 #include "image.h"
 #include "data.h"
@@ -30,6 +31,7 @@
 #include "upsample_layer.h"
 #include "shortcut_layer.h"
 #include "parser.h"
+#include "parallel.h"
 #include "data.h"
 
 load_args get_base_args(network *net)
@@ -57,6 +59,19 @@ network *load_network(char *cfg, char *weights, int clear)
         load_weights(net, weights);
     }
     if(clear) (*net->seen) = 0;
+    set_network_precision(net, net->precision);
+    return net;
+}
+
+network *load_network_inference(char *cfg, char *weights)
+{
+    network *net = parse_network_cfg_inference(cfg);
+    if(weights && weights[0] != 0){
+        load_weights(net, weights);
+    }
+    net->train = 0;
+    set_network_precision(net, net->precision);
+    plan_network_memory(net);
     return net;
 }
 
@@ -194,11 +209,12 @@ void forward_network(network *netp)
     }
 #endif
     network net = *netp;
+    thread_pool *prev = set_thread_pool(net.pool);
     int i;
     for(i = 0; i < net.n; ++i){
         net.index = i;
         layer l = net.layers[i];
-        if(l.delta){
+        if(l.delta && net.train){
             fill_cpu(l.outputs * l.batch, 0, l.delta, 1);
         }
         l.forward(l, net);
@@ -207,6 +223,7 @@ void forward_network(network *netp)
             net.truth = l.output;
         }
     }
+    set_thread_pool(prev);
     calc_network_cost(netp);
 }
 
@@ -269,6 +286,7 @@ void backward_network(network *netp)
     }
 #endif
     network net = *netp;
+    thread_pool *pool = set_thread_pool(net.pool);
     int i;
     network orig = net;
     for(i = net.n-1; i >= 0; --i){
@@ -284,10 +302,13 @@ void backward_network(network *netp)
         net.index = i;
         l.backward(l, net);
     }
+    set_thread_pool(pool);
 }
 
 float train_network_datum(network *net)
 {
+    // training updates the float weights
+    set_network_precision(net, FP32);
     *net->seen += net->batch;
     net->train = 1;
     forward_network(net);
@@ -355,8 +376,151 @@ void set_batch_network(network *net, int b)
     }
 }
 
+void fold_batchnorm_network(network *net)
+{
+    int i;
+    for(i = 0; i < net->n; ++i){
+        if(net->layers[i].type == CONVOLUTIONAL){
+            fold_batchnorm_convolutional_layer(net->layers + i);
+        }
+    }
+}
+
+// Only the convolutional weights change storage; activations stay fp32.
+// load_network and load_network_inference apply the cfg's precision once,
+// networks built otherwise call this before predicting.
+void set_network_precision(network *net, PRECISION p)
+{
+    int i;
+#ifdef GPU
+    if(net->gpu_index >= 0) return;
+#endif
+    for(i = 0; i < net->n; ++i){
+        if(net->layers[i].type == CONVOLUTIONAL){
+            set_convolutional_precision(net->layers + i, p);
+        }
+    }
+}
+
+static int plannable_layer(LAYER_TYPE t)
+{
+    return t == CONVOLUTIONAL || t == CONNECTED || t == MAXPOOL || t == AVGPOOL
+        || t == ROUTE || t == SHORTCUT || t == UPSAMPLE || t == REORG
+        || t == BATCHNORM || t == ACTIVE || t == SOFTMAX || t == L2NORM
+        || t == YOLO || t == REGION;
+}
+
+static void unplan_network_memory(network *net)
+{
+    int i;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(l->output >= net->output_arena && l->output < net->output_arena + net->output_arena_size) l->output = 0;
+    }
+    free(net->output_arena);
+    net->output_arena = 0;
+    net->output_arena_size = 0;
+}
+
+// Inference only: layer outputs that are never alive at the same time share
+// buffers in one arena and deltas are released. An output is alive from its
+// layer to its last reader: the next layer, routes and shortcuts pointing at
+// it, and the end of the pass for detection heads and the network output.
+// Dropout layers alias their input.
+void plan_network_memory(network *net)
+{
+    int i, j, k;
+#ifdef GPU
+    if(net->gpu_index >= 0) return;
+#endif
+    if(net->output_arena) unplan_network_memory(net);
+    int n = net->n;
+    int *root = calloc(n, sizeof(int));
+    int *last = calloc(n, sizeof(int));
+    int *buffer = calloc(n, sizeof(int));
+    size_t *buffer_size = calloc(n, sizeof(size_t));
+    int *buffer_free = calloc(n, sizeof(int));
+    int buffers = 0;
+    size_t before = 0, after = 0;
+
+    int output_layer = n - 1;
+    while(output_layer > 0 && net->layers[output_layer].type == COST) --output_layer;
+    for(i = 0; i < n; ++i){
+        root[i] = (net->layers[i].type == DROPOUT && i > 0) ? root[i-1] : i;
+        last[i] = i;
+    }
+    for(i = 0; i < n; ++i){
+        layer l = net->layers[i];
+        if(i > 0 && last[root[i-1]] < i) last[root[i-1]] = i;
+        if(l.type == ROUTE){
+            for(k = 0; k < l.n; ++k) if(last[root[l.input_layers[k]]] < i) last[root[l.input_layers[k]]] = i;
+        } else if(l.type == SHORTCUT){
+            if(last[root[l.index]] < i) last[root[l.index]] = i;
+        }
+        if(l.type == YOLO || l.type == REGION || l.type == DETECTION || l.type == ISEG || i == output_layer){
+            last[root[i]] = n;
+        }
+    }
+
+    for(i = 0; i < n; ++i){
+        layer l = net->layers[i];
+        size_t size = (size_t)l.outputs*l.batch;
+        if(l.type == DROPOUT) continue;
+        before += size*(l.delta ? 2 : 1);
+        buffer[i] = -1;
+        if(!plannable_layer(l.type)){
+            after += size*(l.delta ? 2 : 1);
+            continue;
+        }
+        // smallest free buffer that fits, otherwise grow the largest free one
+        int best = -1;
+        for(j = 0; j < buffers; ++j){
+            if(buffer_free[j] >= i) continue;
+            if(best < 0) best = j;
+            else if(buffer_size[best] < size) best = (buffer_size[j] > buffer_size[best]) ? j : best;
+            else if(buffer_size[j] >= size && buffer_size[j] < buffer_size[best]) best = j;
+        }
+        if(best < 0) best = buffers++;
+        if(buffer_size[best] < size) buffer_size[best] = (size + 15)/16*16;
+        buffer_free[best] = last[i];
+        buffer[i] = best;
+    }
+
+    size_t *offset = calloc(buffers + 1, sizeof(size_t));
+    for(j = 0; j < buffers; ++j) offset[j+1] = offset[j] + buffer_size[j];
+    net->output_arena_size = offset[buffers];
+    net->output_arena = calloc(net->output_arena_size, sizeof(float));
+    after += net->output_arena_size;
+
+    for(i = 0; i < n; ++i){
+        layer *l = net->layers + i;
+        if(l->type == DROPOUT){
+            l->output = net->layers[root[i]].output;
+            l->delta = 0;
+            continue;
+        }
+        if(buffer[i] < 0) continue;
+        free(l->output);
+        free(l->delta);
+        l->output = net->output_arena + offset[buffer[i]];
+        l->delta = 0;
+    }
+    net->output = net->layers[output_layer].output;
+
+    fprintf(stderr, "Activation memory: %.1f MB -> %.1f MB, %d shared buffers\n", before*sizeof(float)/1e6, after*sizeof(float)/1e6, buffers);
+    free(root);
+    free(last);
+    free(buffer);
+    free(buffer_size);
+    free(buffer_free);
+    free(offset);
+}
+
 int resize_network(network *net, int w, int h)
 {
+    if(net->base) error("Cannot resize a network context");
+    int planned = net->output_arena != 0;
+    if(planned) unplan_network_memory(net);
 #ifdef GPU
     cuda_set_device(net->gpu_index);
     cuda_free(net->workspace);
@@ -415,8 +579,9 @@ int resize_network(network *net, int w, int h)
     net->output = out.output;
     free(net->input);
     free(net->truth);
+    net->truth = 0;
     net->input = calloc(net->inputs*net->batch, sizeof(float));
-    net->truth = calloc(net->truths*net->batch, sizeof(float));
+    if(!net->inference) net->truth = calloc(net->truths*net->batch, sizeof(float));
 #ifdef GPU
     if(gpu_index >= 0){
         cuda_free(net->input_gpu);
@@ -437,6 +602,7 @@ int resize_network(network *net, int w, int h)
     net->workspace = calloc(1, workspace_size);
     net->workspace_size = workspace_size;
 #endif
+    if(planned) plan_network_memory(net);
     //fprintf(stderr, " Done!\n");
     return 0;
 }
@@ -497,6 +663,7 @@ void top_predictions(network *net, int k, int *index)
     top_k(net->output, net->outputs, k, index);
 }
 
+#ifdef GPU
 float *network_predict_gpubuffer(network *net, float *input, int bufferDeviceNum)
 {
     network orig = *net;
@@ -509,26 +676,36 @@ float *network_predict_gpubuffer(network *net, float *input, int bufferDeviceNum
     *net = orig;
     return out;
 }
+#endif
 
+// Runs on a copy of *net, so contexts sharing weights (see
+// make_network_context) can predict concurrently
 float *network_predict(network *net, float *input)
 {
-    network orig = *net;
-    net->input = input;
-    net->truth = 0;
-    net->train = 0;
-    net->delta = 0;
-    forward_network(net);
-    float *out = net->output;
-    *net = orig;
-    return out;
+    network state = *net;
+    state.input = input;
+    state.truth = 0;
+    state.train = 0;
+    state.delta = 0;
+    forward_network(&state);
+    return state.output;
 }
 
-int num_detections(network *net, float thresh)
+// Detection layers of image b in the batch, by value with their outputs
+// pointing at that image
+static layer batch_layer(network *net, int i, int b)
+{
+    layer l = net->layers[i];
+    l.output += b*l.outputs;
+    return l;
+}
+
+static int batch_num_detections(network *net, int b, float thresh)
 {
     int i;
     int s = 0;
     for(i = 0; i < net->n; ++i){
-        layer l = net->layers[i];
+        layer l = batch_layer(net, i, b);
         if(l.type == YOLO){
             s += yolo_num_detections(l, thresh);
         }
@@ -539,11 +716,16 @@ int num_detections(network *net, float thresh)
     return s;
 }
 
-detection *make_network_boxes(network *net, float thresh, int *num)
+int num_detections(network *net, float thresh)
+{
+    return batch_num_detections(net, 0, thresh);
+}
+
+static detection *make_batch_boxes(network *net, int b, float thresh, int *num)
 {
     layer l = net->layers[net->n - 1];
     int i;
-    int nboxes = num_detections(net, thresh);
+    int nboxes = batch_num_detections(net, b, thresh);
     if(num) *num = nboxes;
     detection *dets = calloc(nboxes, sizeof(detection));
     for(i = 0; i < nboxes; ++i){
@@ -555,24 +737,36 @@ detection *make_network_boxes(network *net, float thresh, int *num)
     return dets;
 }
 
-void fill_network_boxes(network *net, int w, int h, float thresh, float hier, int *map, int relative, detection *dets)
+detection *make_network_boxes(network *net, float thresh, int *num)
+{
+    return make_batch_boxes(net, 0, thresh, num);
+}
+
+static int fill_batch_boxes(network *net, int b, int w, int h, float thresh, float hier, int *map, int relative, detection *dets)
 {
     int j;
+    int count = 0;
     for(j = 0; j < net->n; ++j){
-        layer l = net->layers[j];
+        layer l = batch_layer(net, j, b);
         if(l.type == YOLO){
-            int count = get_yolo_detections(l, w, h, net->w, net->h, thresh, map, relative, dets);
-            dets += count;
+            int n = get_yolo_detections(l, w, h, net->w, net->h, thresh, map, relative, dets + count);
+            count += n;
         }
         if(l.type == REGION){
-            get_region_detections(l, w, h, net->w, net->h, thresh, map, hier, relative, dets);
-            dets += l.w*l.h*l.n;
+            get_region_detections(l, w, h, net->w, net->h, thresh, map, hier, relative, dets + count);
+            count += l.w*l.h*l.n;
         }
         if(l.type == DETECTION){
-            get_detection_detections(l, w, h, thresh, dets);
-            dets += l.w*l.h*l.n;
+            get_detection_detections(l, w, h, thresh, dets + count);
+            count += l.w*l.h*l.n;
         }
     }
+    return count;
+}
+
+void fill_network_boxes(network *net, int w, int h, float thresh, float hier, int *map, int relative, detection *dets)
+{
+    fill_batch_boxes(net, 0, w, h, thresh, hier, map, relative, dets);
 }
 
 detection *get_network_boxes(network *net, int w, int h, float thresh, float hier, int *map, int relative, int *num)
@@ -582,6 +776,19 @@ detection *get_network_boxes(network *net, int w, int h, float thresh, float hie
     return dets;
 }
 
+// Detections for each of the first n images of the last batch, boxes scaled
+// to the size of ims[i]. nums gets the number of detections of each image.
+detection **get_network_boxes_batch(network *net, image *ims, int n, float thresh, float hier, int *map, int relative, int *nums)
+{
+    int b;
+    detection **dets = calloc(n, sizeof(detection *));
+    for(b = 0; b < n; ++b){
+        dets[b] = make_batch_boxes(net, b, thresh, nums + b);
+        fill_batch_boxes(net, b, ims[b].w, ims[b].h, thresh, hier, map, relative, dets[b]);
+    }
+    return dets;
+}
+
 void free_detections(detection *dets, int n)
 {
     int i;
@@ -592,14 +799,139 @@ void free_detections(detection *dets, int n)
     free(dets);
 }
 
+void free_detections_batch(detection **dets, int *nums, int n)
+{
+    int b;
+    for(b = 0; b < n; ++b){
+        free_detections(dets[b], nums[b]);
+    }
+    free(dets);
+}
+
+// Detections of one image kept between frames: the detection array, one
+// slab for every prob vector and one for every mask. Results are valid
+// until the next get_network_boxes_pooled or reset_detection_pool.
+static void reserve_detection_pool(detection_pool *pool, int n)
+{
+    int i;
+    free(pool->dets);
+    free(pool->probs);
+    free(pool->masks);
+    pool->dets = calloc(n, sizeof(detection));
+    pool->probs = calloc((size_t)n*pool->classes, sizeof(float));
+    pool->masks = pool->masks_per_box ? calloc((size_t)n*pool->masks_per_box, sizeof(float)) : 0;
+    pool->capacity = n;
+    pool->num = 0;
+    for(i = 0; i < n; ++i){
+        pool->dets[i].prob = pool->probs + (size_t)i*pool->classes;
+        if(pool->masks) pool->dets[i].mask = pool->masks + (size_t)i*pool->masks_per_box;
+    }
+}
+
+static int network_max_boxes(network *net)
+{
+    int i;
+    int boxes = 0;
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type == YOLO || l.type == DETECTION || l.type == REGION){
+            boxes += l.w*l.h*l.n;
+        }
+    }
+    return boxes;
+}
+
+// Sized for every box the network can produce at its current resolution
+detection_pool *make_detection_pool(network *net)
+{
+    layer l = net->layers[net->n - 1];
+    detection_pool *pool = calloc(1, sizeof(detection_pool));
+    pool->classes = l.classes;
+    pool->masks_per_box = (l.coords > 4) ? l.coords - 4 : 0;
+    reserve_detection_pool(pool, network_max_boxes(net));
+    return pool;
+}
+
+// Clears the detections in use, which sorting may have reordered, and
+// points them back at their own slab entries
+void reset_detection_pool(detection_pool *pool)
+{
+    int i;
+    memset(pool->dets, 0, pool->num*sizeof(detection));
+    memset(pool->probs, 0, (size_t)pool->num*pool->classes*sizeof(float));
+    if(pool->masks) memset(pool->masks, 0, (size_t)pool->num*pool->masks_per_box*sizeof(float));
+    for(i = 0; i < pool->num; ++i){
+        pool->dets[i].prob = pool->probs + (size_t)i*pool->classes;
+        if(pool->masks) pool->dets[i].mask = pool->masks + (size_t)i*pool->masks_per_box;
+    }
+    pool->num = 0;
+}
+
+// get_network_boxes for image b of the last batch, into the pool. With room
+// for every box the outputs are scanned once, without counting first. The
+// pool only grows if the network was resized since it was made.
+detection *get_network_boxes_pooled(network *net, detection_pool *pool, int b, int w, int h, float thresh, float hier, int *map, int relative, int *num)
+{
+    reset_detection_pool(pool);
+    int boxes = network_max_boxes(net);
+    if(boxes > pool->capacity) reserve_detection_pool(pool, boxes);
+    int nboxes = fill_batch_boxes(net, b, w, h, thresh, hier, map, relative, pool->dets);
+    pool->num = nboxes;
+    if(num) *num = nboxes;
+    return pool->dets;
+}
+
+void free_detection_pool(detection_pool *pool)
+{
+    free(pool->dets);
+    free(pool->probs);
+    free(pool->masks);
+    free(pool);
+}
+
+// Batch 2 run on an image and its mirror image, averaged into image 0 of
+// every detection layer, as validate_detector_flip does
+void avg_flipped_network(network *net)
+{
+    int i;
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.batch < 2) continue;
+        if(l.type == YOLO) avg_flipped_yolo(l);
+        if(l.type == REGION) avg_flipped_region(l);
+    }
+}
+
 float *network_predict_image(network *net, image im)
 {
-    int resize = im.w != net->w || im.h != net->h;
-    image imr = resize ? letterbox_image(im, net->w, net->h) : im;
     set_batch_network(net, 1);
-    float *p = network_predict(net, imr.data);
-    if(resize)
-    free_image(imr);
+    if(im.w == net->w && im.h == net->h) return network_predict(net, im.data);
+    image boxed = {net->w, net->h, net->c, net->input};
+    letterbox_image_into(im, net->w, net->h, boxed);
+    return network_predict(net, net->input);
+}
+
+// Runs the first n images as one batch, letterboxing those that aren't the
+// network's size. n can be at most the batch the network was built for,
+// whose outputs hold image b at l.output + b*l.outputs.
+float *network_predict_batch(network *net, image *ims, int n)
+{
+    int i;
+    int batch = net->batch;
+    if(n > batch) error("network_predict_batch: more images than the network's batch");
+    for(i = 0; i < n; ++i){
+        image im = ims[i];
+        float *input = net->input + i*net->inputs;
+        if(im.w != net->w || im.h != net->h){
+            image boxed = {net->w, net->h, net->c, input};
+            letterbox_image_into(im, net->w, net->h, boxed);
+        } else {
+            memcpy(input, im.data, net->inputs*sizeof(float));
+        }
+    }
+    if(n != batch) set_batch_network(net, n);
+    float *p = network_predict(net, net->input);
+    if(n != batch) set_batch_network(net, batch);
     return p;
 }
 
@@ -734,9 +1066,16 @@ float network_accuracy_multi(network *net, data d, int n)
 void free_network(network *net)
 {
     int i;
+    if(net->base){
+        free_network_context(net);
+        return;
+    }
+    if(net->output_arena) unplan_network_memory(net);
     for(i = 0; i < net->n; ++i){
         free_layer(net->layers[i]);
     }
+    if(net->weights_map) munmap(net->weights_map, net->weights_map_size);
+    free_thread_pool(net->pool);
     free(net->layers);
     if(net->input) free(net->input);
     if(net->truth) free(net->truth);
@@ -759,6 +1098,109 @@ void free_network(network *net)
     free(net);
 }
 
+static float *context_buffer(float *p, size_t n)
+{
+    return p ? calloc(n, sizeof(float)) : 0;
+}
+
+// A network that shares net's weights but has its own layer outputs, scratch
+// buffers, input and workspace, one per thread that runs network_predict.
+// Inference on the CPU only. net must outlive its contexts and must not be
+// resized, trained or change precision while they exist.
+network *make_network_context(network *net)
+{
+    int i, j;
+    if(net->base) net = net->base;
+#ifdef GPU
+    if(net->gpu_index >= 0) error("Network contexts are CPU only");
+#endif
+    network *ctx = calloc(1, sizeof(network));
+    *ctx = *net;
+    ctx->base = net;
+    ctx->layers = calloc(net->n, sizeof(layer));
+    ctx->cost = calloc(1, sizeof(float));
+    ctx->input = calloc(net->inputs*net->batch, sizeof(float));
+    ctx->truth = 0;
+    ctx->delta = 0;
+    ctx->train = 0;
+    ctx->workspace = net->workspace_size ? calloc(1, net->workspace_size) : 0;
+    ctx->weights_map = 0;
+    ctx->weights_map_size = 0;
+    if(net->output_arena) ctx->output_arena = calloc(net->output_arena_size, sizeof(float));
+
+    for(i = 0; i < net->n; ++i){
+        layer *b = net->layers + i;
+        layer *l = ctx->layers + i;
+        size_t size = (size_t)b->outputs*b->batch;
+        *l = *b;
+        if(l->type == RNN || l->type == GRU || l->type == LSTM || l->type == CRNN){
+            error("Recurrent layers keep their state in the network, they can't have contexts");
+        }
+        l->delta = 0;
+        l->output = 0;
+        if(net->output_arena && b->output >= net->output_arena && b->output < net->output_arena + net->output_arena_size){
+            l->output = ctx->output_arena + (b->output - net->output_arena);
+        }
+        // dropout layers alias their input
+        for(j = 0; j < i && !l->output; ++j){
+            if(b->output == net->layers[j].output) l->output = ctx->layers[j].output;
+        }
+        if(!l->output) l->output = calloc(size, sizeof(float));
+
+        l->indexes = b->indexes ? calloc(size, sizeof(int)) : 0;
+        l->binary_input = context_buffer(b->binary_input, (size_t)b->inputs*b->batch);
+        // binary_weights is scratch that binarize_weights fills, only packed
+        // xnor layers never touch it
+        if(b->binary_weights && !b->xnor_weights) l->binary_weights = context_buffer(b->binary_weights, b->nweights);
+        if(l->type == NORMALIZATION){
+            l->squared = context_buffer(b->squared, size);
+            l->norms = context_buffer(b->norms, size);
+        }
+        if(l->type == L2NORM) l->scales = context_buffer(b->scales, size);
+    }
+    layer out = get_network_output_layer(ctx);
+    ctx->output = out.output;
+    return ctx;
+}
+
+// Frees only what make_network_context allocated
+void free_network_context(network *ctx)
+{
+    int i, j;
+    network *net = ctx->base;
+    for(i = 0; i < ctx->n; ++i){
+        layer *b = net->layers + i;
+        layer *l = ctx->layers + i;
+        int shared = l->output >= ctx->output_arena && l->output < ctx->output_arena + ctx->output_arena_size;
+        for(j = 0; j < i && !shared; ++j) shared = l->output == ctx->layers[j].output;
+        if(!shared) free(l->output);
+        free(l->indexes);
+        free(l->binary_input);
+        if(l->binary_weights != b->binary_weights) free(l->binary_weights);
+        if(l->squared != b->squared) free(l->squared);
+        if(l->norms != b->norms) free(l->norms);
+        if(l->scales != b->scales) free(l->scales);
+    }
+    if(ctx->pool != net->pool) free_thread_pool(ctx->pool);
+    free(ctx->output_arena);
+    free(ctx->layers);
+    free(ctx->cost);
+    free(ctx->input);
+    free(ctx->workspace);
+    free(ctx);
+}
+
+// threads 0 shares the process wide pool, 1 runs layers on the calling
+// thread only. Networks in one process should split the cores between them.
+// Contexts use their network's pool unless given their own.
+void set_network_threads(network *net, int threads, char *cpus, int pin)
+{
+    if(!net->base || net->pool != net->base->pool) free_thread_pool(net->pool);
+    net->pool = 0;
+    if(threads || cpus || pin) net->pool = make_thread_pool(threads, cpus, pin);
+    net->threads = net->pool ? thread_pool_size(net->pool) : 0;
+}
+
 // Some day...
 // ^ What the hell is this comment for?
 
@@ -0,0 +1,816 @@
+#include "nms.h"
+#include "box.h"
+#include "utils.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+// Greedy non-maximum suppression over candidates: a detection, a score and
+// a group, where boxes only suppress boxes of their own group. Per class
+// NMS puts every class in a group of its own (the class offset trick, on
+// group ids instead of shifted coordinates so the IoUs are the ones box_iou
+// computes) and runs once instead of once per class, and batches add the
+// image to the group.
+//
+// Candidates are sorted as an index array and their boxes kept as arrays of
+// corners, areas and groups in score order. Large sets are bucketed by box
+// center on a grid per group, so a box only meets the ones that can
+// overlap it.
+
+#define NMS_GRID_MIN 512
+#define NMS_GRID_MAX 64
+#define NMS_GRID_CELL 16
+
+typedef struct{
+    float score;
+    int index;
+} nms_order;
+
+typedef struct{
+    int det;
+    int image;
+    int class;
+    int group;
+    float score;
+} nms_candidate;
+
+typedef struct{
+    float *x1, *y1, *x2, *y2, *area, *group;
+    int *rank;
+} nms_boxes;
+
+typedef struct{
+    float x1, y1, x2, y2, area, group;
+} nms_query;
+
+// Marks suppressed[b->rank[p]] for boxes p in [start, end) of the query's
+// group whose IoU with the query is over thresh
+typedef void (*nms_kernel_fn)(nms_boxes *b, int start, int end, nms_query q, float thresh, unsigned char *suppressed);
+
+static void nms_kernel_generic(nms_boxes *b, int start, int end, nms_query q, float thresh, unsigned char *suppressed)
+{
+    int p;
+    for(p = start; p < end; ++p){
+        if(b->group[p] != q.group) continue;
+        float w = (q.x2 < b->x2[p] ? q.x2 : b->x2[p]) - (q.x1 > b->x1[p] ? q.x1 : b->x1[p]);
+        float h = (q.y2 < b->y2[p] ? q.y2 : b->y2[p]) - (q.y1 > b->y1[p] ? q.y1 : b->y1[p]);
+        float inter = (w < 0 || h < 0) ? 0 : w*h;
+        if(inter/(q.area + b->area[p] - inter) > thresh) suppressed[b->rank[p]] = 1;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+// no FMA, so the products and sums round like the scalar code
+__attribute__((target("avx")))
+static void nms_kernel_avx(nms_boxes *b, int start, int end, nms_query q, float thresh, unsigned char *suppressed)
+{
+    __m256 qx1 = _mm256_set1_ps(q.x1);
+    __m256 qy1 = _mm256_set1_ps(q.y1);
+    __m256 qx2 = _mm256_set1_ps(q.x2);
+    __m256 qy2 = _mm256_set1_ps(q.y2);
+    __m256 qarea = _mm256_set1_ps(q.area);
+    __m256 qgroup = _mm256_set1_ps(q.group);
+    __m256 t = _mm256_set1_ps(thresh);
+    __m256 zero = _mm256_setzero_ps();
+    int p;
+    for(p = start; p + 8 <= end; p += 8){
+        __m256 w = _mm256_sub_ps(_mm256_min_ps(qx2, _mm256_loadu_ps(b->x2 + p)), _mm256_max_ps(qx1, _mm256_loadu_ps(b->x1 + p)));
+        __m256 h = _mm256_sub_ps(_mm256_min_ps(qy2, _mm256_loadu_ps(b->y2 + p)), _mm256_max_ps(qy1, _mm256_loadu_ps(b->y1 + p)));
+        __m256 valid = _mm256_and_ps(_mm256_cmp_ps(w, zero, _CMP_GE_OQ), _mm256_cmp_ps(h, zero, _CMP_GE_OQ));
+        __m256 inter = _mm256_and_ps(valid, _mm256_mul_ps(w, h));
+        __m256 uni = _mm256_sub_ps(_mm256_add_ps(qarea, _mm256_loadu_ps(b->area + p)), inter);
+        __m256 hit = _mm256_cmp_ps(_mm256_div_ps(inter, uni), t, _CMP_GT_OQ);
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_loadu_ps(b->group + p), qgroup, _CMP_EQ_OQ));
+        unsigned mask = _mm256_movemask_ps(hit);
+        while(mask){
+            suppressed[b->rank[p + __builtin_ctz(mask)]] = 1;
+            mask &= mask - 1;
+        }
+    }
+    nms_kernel_generic(b, p, end, q, thresh, suppressed);
+}
+#endif
+
+static nms_kernel_fn nms_kernel = nms_kernel_generic;
+static pthread_once_t nms_kernel_once = PTHREAD_ONCE_INIT;
+
+static void select_nms_kernel()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx")) nms_kernel = nms_kernel_avx;
+#endif
+}
+
+static int nms_order_comparator(const void *pa, const void *pb)
+{
+    nms_order *a = (nms_order *)pa;
+    nms_order *b = (nms_order *)pb;
+    if(a->score > b->score) return -1;
+    if(a->score < b->score) return 1;
+    return a->index - b->index;
+}
+
+static nms_boxes make_nms_boxes(int n)
+{
+    nms_boxes b;
+    b.x1 = calloc(n, sizeof(float));
+    b.y1 = calloc(n, sizeof(float));
+    b.x2 = calloc(n, sizeof(float));
+    b.y2 = calloc(n, sizeof(float));
+    b.area = calloc(n, sizeof(float));
+    b.group = calloc(n, sizeof(float));
+    b.rank = calloc(n, sizeof(int));
+    return b;
+}
+
+static void free_nms_boxes(nms_boxes b)
+{
+    free(b.x1);
+    free(b.y1);
+    free(b.x2);
+    free(b.y2);
+    free(b.area);
+    free(b.group);
+    free(b.rank);
+}
+
+static void set_nms_box(nms_boxes *b, int p, box a, int group, int rank)
+{
+    b->x1[p] = a.x - a.w/2;
+    b->y1[p] = a.y - a.h/2;
+    b->x2[p] = a.x + a.w/2;
+    b->y2[p] = a.y + a.h/2;
+    b->area[p] = a.w*a.h;
+    b->group[p] = group;
+    b->rank[p] = rank;
+}
+
+static nms_query nms_box_query(nms_boxes *b, int p)
+{
+    nms_query q = {b->x1[p], b->y1[p], b->x2[p], b->y2[p], b->area[p], b->group[p]};
+    return q;
+}
+
+static void nms_linear(nms_boxes *b, int n, float thresh, unsigned char *suppressed)
+{
+    int i;
+    for(i = 0; i < n; ++i){
+        if(suppressed[i]) continue;
+        nms_kernel(b, i + 1, n, nms_box_query(b, i), thresh, suppressed);
+    }
+}
+
+static int nms_cell(float v, float min, float scale, int g)
+{
+    int c = (v - min)*scale;
+    return c < 0 ? 0 : (c >= g ? g - 1 : c);
+}
+
+// -Ofast assumes away infinities and NaNs, so test the exponent bits
+static int nms_finite(float f)
+{
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return (u & 0x7f800000) != 0x7f800000;
+}
+
+// Boxes with an infinite or NaN corner or area get an IoU of 0 or NaN with
+// anything, so they neither suppress nor get suppressed
+static int nms_box_finite(nms_boxes *b, int i)
+{
+    return nms_finite(b->x1[i]) && nms_finite(b->x2[i]) && nms_finite(b->y1[i]) && nms_finite(b->y2[i]) && nms_finite(b->area[i]);
+}
+
+// b is in score order. Boxes are copied into per group, per cell slices,
+// each in score order, and a box only meets the slices that hold centers
+// within reach of it: an overlapping box's center is at most the largest
+// half size away from the query's edges.
+static void nms_grid(nms_boxes *b, int n, int groups, float thresh, unsigned char *suppressed)
+{
+    int i, p;
+    int finite = 0;
+    float minx = 0, maxx = 0, miny = 0, maxy = 0;
+    float halfw = 0, halfh = 0;
+    unsigned char *skip = calloc(n, 1);
+    for(i = 0; i < n; ++i){
+        if(!nms_box_finite(b, i)){
+            skip[i] = 1;
+            continue;
+        }
+        if(!finite++){
+            minx = b->x1[i];
+            maxx = b->x2[i];
+            miny = b->y1[i];
+            maxy = b->y2[i];
+        }
+        if(b->x1[i] < minx) minx = b->x1[i];
+        if(b->x2[i] > maxx) maxx = b->x2[i];
+        if(b->y1[i] < miny) miny = b->y1[i];
+        if(b->y2[i] > maxy) maxy = b->y2[i];
+        if((b->x2[i] - b->x1[i])/2 > halfw) halfw = (b->x2[i] - b->x1[i])/2;
+        if((b->y2[i] - b->y1[i])/2 > halfh) halfh = (b->y2[i] - b->y1[i])/2;
+    }
+    // about NMS_GRID_CELL boxes a cell, and cells no smaller than the
+    // largest box so a query looks at 3x3 of them or so
+    int g = sqrt((float)finite/groups/NMS_GRID_CELL);
+    if(halfw > 0 && g > (maxx - minx)/(2*halfw)) g = (maxx - minx)/(2*halfw);
+    if(halfh > 0 && g > (maxy - miny)/(2*halfh)) g = (maxy - miny)/(2*halfh);
+    if(g < 1) g = 1;
+    if(g > NMS_GRID_MAX) g = NMS_GRID_MAX;
+    float sx = (maxx > minx) ? g/(maxx - minx) : 0;
+    float sy = (maxy > miny) ? g/(maxy - miny) : 0;
+    halfw = halfw*1.001f + 1e-6f*(maxx - minx);
+    halfh = halfh*1.001f + 1e-6f*(maxy - miny);
+
+    int keys = groups*g*g;
+    int *start = calloc(keys + 1, sizeof(int));
+    int *key = calloc(n, sizeof(int));
+    for(i = 0; i < n; ++i){
+        if(skip[i]) continue;
+        int cx = nms_cell((b->x1[i] + b->x2[i])/2, minx, sx, g);
+        int cy = nms_cell((b->y1[i] + b->y2[i])/2, miny, sy, g);
+        key[i] = ((int)b->group[i]*g + cy)*g + cx;
+        ++start[key[i] + 1];
+    }
+    for(i = 0; i < keys; ++i) start[i + 1] += start[i];
+    int *fill = calloc(keys, sizeof(int));
+    memcpy(fill, start, keys*sizeof(int));
+    nms_boxes s = make_nms_boxes(n);
+    for(i = 0; i < n; ++i){
+        if(skip[i]) continue;
+        p = fill[key[i]]++;
+        s.x1[p] = b->x1[i];
+        s.y1[p] = b->y1[i];
+        s.x2[p] = b->x2[i];
+        s.y2[p] = b->y2[i];
+        s.area[p] = b->area[i];
+        s.group[p] = b->group[i];
+        s.rank[p] = i;
+    }
+
+    for(i = 0; i < n; ++i){
+        if(suppressed[i] || skip[i]) continue;
+        nms_query q = nms_box_query(b, i);
+        int x0 = nms_cell(q.x1 - halfw, minx, sx, g);
+        int x1 = nms_cell(q.x2 + halfw, minx, sx, g);
+        int y0 = nms_cell(q.y1 - halfh, miny, sy, g);
+        int y1 = nms_cell(q.y2 + halfh, miny, sy, g);
+        int x, y;
+        for(y = y0; y <= y1; ++y){
+            for(x = x0; x <= x1; ++x){
+                int k = ((int)q.group*g + y)*g + x;
+                int lo = start[k], hi = start[k + 1];
+                // first box of the slice ranked after the query
+                while(lo < hi){
+                    int mid = (lo + hi)/2;
+                    if(s.rank[mid] <= i) lo = mid + 1;
+                    else hi = mid;
+                }
+                nms_kernel(&s, lo, start[k + 1], q, thresh, suppressed);
+            }
+        }
+    }
+    free_nms_boxes(s);
+    free(fill);
+    free(key);
+    free(start);
+    free(skip);
+}
+
+// Sorts the candidates by score and marks the suppressed ones, in the
+// candidates' own order
+static void nms_candidates(detection **dets, nms_candidate *c, int n, int groups, float thresh, unsigned char *suppressed)
+{
+    int i;
+    if(n <= 0) return;
+    pthread_once(&nms_kernel_once, select_nms_kernel);
+    nms_order *order = calloc(n, sizeof(nms_order));
+    for(i = 0; i < n; ++i){
+        order[i].score = c[i].score;
+        order[i].index = i;
+    }
+    qsort(order, n, sizeof(nms_order), nms_order_comparator);
+    nms_boxes b = make_nms_boxes(n);
+    for(i = 0; i < n; ++i){
+        nms_candidate e = c[order[i].index];
+        set_nms_box(&b, i, dets[e.image][e.det].bbox, e.group, i);
+    }
+    unsigned char *ranked = calloc(n, 1);
+    if(n >= NMS_GRID_MIN && thresh >= 0) nms_grid(&b, n, groups, thresh, ranked);
+    else nms_linear(&b, n, thresh, ranked);
+    for(i = 0; i < n; ++i) suppressed[order[i].index] = ranked[i];
+    free(ranked);
+    free_nms_boxes(b);
+    free(order);
+}
+
+// Candidates of every image: one per detection, or one per class with a
+// nonzero probability. Detections with no objectness take no part.
+static nms_candidate *make_nms_candidates(detection **dets, int *nums, int images, int classes, int per_class, int *n)
+{
+    int b, i, k;
+    int count = 0;
+    for(b = 0; b < images; ++b){
+        for(i = 0; i < nums[b]; ++i){
+            if(dets[b][i].objectness == 0) continue;
+            if(!per_class){
+                ++count;
+                continue;
+            }
+            for(k = 0; k < classes; ++k) if(dets[b][i].prob[k] != 0) ++count;
+        }
+    }
+    nms_candidate *c = calloc(count, sizeof(nms_candidate));
+    count = 0;
+    for(b = 0; b < images; ++b){
+        for(i = 0; i < nums[b]; ++i){
+            detection d = dets[b][i];
+            if(d.objectness == 0) continue;
+            for(k = 0; k < (per_class ? classes : 1); ++k){
+                if(per_class && d.prob[k] == 0) continue;
+                nms_candidate e = {i, b, k, per_class ? b*classes + k : b, per_class ? d.prob[k] : d.objectness};
+                c[count++] = e;
+            }
+        }
+    }
+    *n = count;
+    return c;
+}
+
+static void suppress_nms_candidates(detection **dets, nms_candidate *c, int n, int classes, int per_class, unsigned char *suppressed)
+{
+    int i;
+    for(i = 0; i < n; ++i){
+        if(!suppressed[i]) continue;
+        detection *d = dets[c[i].image] + c[i].det;
+        if(per_class){
+            d->prob[c[i].class] = 0;
+        } else {
+            d->objectness = 0;
+            memset(d->prob, 0, classes*sizeof(float));
+        }
+    }
+}
+
+// NMS on each image of a batch in one pass. per_class works like
+// do_nms_sort, otherwise like do_nms_obj without reordering the detections.
+void do_nms_batch(detection **dets, int *nums, int images, int classes, float thresh, int per_class)
+{
+    int n = 0;
+    nms_candidate *c = make_nms_candidates(dets, nums, images, classes, per_class, &n);
+    unsigned char *suppressed = calloc(n, 1);
+    nms_candidates(dets, c, n, per_class ? images*classes : images, thresh, suppressed);
+    suppress_nms_candidates(dets, c, n, classes, per_class, suppressed);
+    free(suppressed);
+    free(c);
+}
+
+// Detections come back sorted by objectness, the ones without any last
+void do_nms_obj(detection *dets, int total, int classes, float thresh)
+{
+    int i;
+    int n = 0;
+    nms_candidate *c = make_nms_candidates(&dets, &total, 1, classes, 0, &n);
+    unsigned char *suppressed = calloc(n, 1);
+    nms_candidates(&dets, c, n, 1, thresh, suppressed);
+
+    nms_order *order = calloc(n, sizeof(nms_order));
+    for(i = 0; i < n; ++i){
+        order[i].score = c[i].score;
+        order[i].index = c[i].det;
+    }
+    qsort(order, n, sizeof(nms_order), nms_order_comparator);
+    suppress_nms_candidates(&dets, c, n, classes, 0, suppressed);
+    detection *sorted = calloc(total, sizeof(detection));
+    int last = total;
+    for(i = 0; i < n; ++i) sorted[i] = dets[order[i].index];
+    for(i = 0; i < n; ++i) dets[c[i].det].sort_class = -2;
+    for(i = total - 1; i >= 0; --i) if(dets[i].sort_class != -2) sorted[--last] = dets[i];
+    memcpy(dets, sorted, total*sizeof(detection));
+    for(i = 0; i < total; ++i) dets[i].sort_class = -1;
+    free(sorted);
+    free(order);
+    free(suppressed);
+    free(c);
+}
+
+void do_nms_sort(detection *dets, int total, int classes, float thresh)
+{
+    int i;
+    do_nms_batch(&dets, &total, 1, classes, thresh, 1);
+    for(i = 0; i < total; ++i) if(dets[i].objectness != 0) dets[i].sort_class = classes - 1;
+}
+
+// Soft-NMS: rather than dropping the boxes a kept box overlaps, their
+// scores decay with the overlap and they go once under thresh. Scores move
+// as it runs, so every step looks for the best box left in the group.
+static float soft_nms_decay(float iou, detection_params p)
+{
+    if(p.nms_kind == GAUSSIAN_SOFT_NMS) return expf(-iou*iou/p.sigma);
+    return iou > p.nms ? 1 - iou : 1;
+}
+
+static float nms_iou(nms_boxes *b, int p, nms_query q)
+{
+    float w = (q.x2 < b->x2[p] ? q.x2 : b->x2[p]) - (q.x1 > b->x1[p] ? q.x1 : b->x1[p]);
+    float h = (q.y2 < b->y2[p] ? q.y2 : b->y2[p]) - (q.y1 > b->y1[p] ? q.y1 : b->y1[p]);
+    float inter = (w < 0 || h < 0) ? 0 : w*h;
+    float u = q.area + b->area[p] - inter;
+    return u > 0 ? inter/u : 0;
+}
+
+// boxes [start, end) of b are one group in score order
+static void soft_nms_group(nms_boxes *b, int start, int end, float *score, float thresh, detection_params p)
+{
+    int i, j;
+    int n = 0;
+    int *live = calloc(end - start, sizeof(int));
+    for(i = start; i < end; ++i){
+        if(!nms_box_finite(b, i)) continue;
+        if(score[i] < thresh) score[i] = 0;
+        else live[n++] = i;
+    }
+    while(n > 0){
+        int best = 0;
+        for(j = 1; j < n; ++j) if(score[live[j]] > score[live[best]]) best = j;
+        nms_query q = nms_box_query(b, live[best]);
+        int left = 0;
+        for(j = 0; j < n; ++j){
+            int k = live[j];
+            if(j == best) continue;
+            float iou = nms_iou(b, k, q);
+            // most pairs do not overlap, and expf is not free
+            if(iou > 0) score[k] *= soft_nms_decay(iou, p);
+            if(score[k] < thresh) score[k] = 0;
+            else live[left++] = k;
+        }
+        n = left;
+    }
+    free(live);
+}
+
+// Decays the candidates' scores, in their own order
+static void soft_nms_candidates(detection **dets, nms_candidate *c, int n, int groups, float thresh, detection_params p, float *scores)
+{
+    int i;
+    if(n <= 0) return;
+    nms_order *order = calloc(n, sizeof(nms_order));
+    for(i = 0; i < n; ++i){
+        order[i].score = c[i].score;
+        order[i].index = i;
+    }
+    qsort(order, n, sizeof(nms_order), nms_order_comparator);
+    int *start = calloc(groups + 1, sizeof(int));
+    for(i = 0; i < n; ++i) ++start[c[i].group + 1];
+    for(i = 0; i < groups; ++i) start[i + 1] += start[i];
+    int *fill = calloc(groups, sizeof(int));
+    memcpy(fill, start, groups*sizeof(int));
+    int *perm = calloc(n, sizeof(int));
+    for(i = 0; i < n; ++i) perm[fill[c[order[i].index].group]++] = order[i].index;
+
+    nms_boxes b = make_nms_boxes(n);
+    float *score = calloc(n, sizeof(float));
+    for(i = 0; i < n; ++i){
+        nms_candidate e = c[perm[i]];
+        set_nms_box(&b, i, dets[e.image][e.det].bbox, e.group, i);
+        score[i] = e.score;
+    }
+    for(i = 0; i < groups; ++i) soft_nms_group(&b, start[i], start[i + 1], score, thresh, p);
+    for(i = 0; i < n; ++i) scores[perm[i]] = score[i];
+    free(score);
+    free_nms_boxes(b);
+    free(perm);
+    free(fill);
+    free(start);
+    free(order);
+}
+
+// Per class it decays that class's probability, otherwise the objectness
+// and all the class probabilities with it
+void do_soft_nms(detection *dets, int total, int classes, float thresh, detection_params p)
+{
+    int i, k;
+    int n = 0;
+    nms_candidate *c = make_nms_candidates(&dets, &total, 1, classes, p.per_class, &n);
+    float *scores = calloc(n, sizeof(float));
+    soft_nms_candidates(&dets, c, n, p.per_class ? classes : 1, thresh, p, scores);
+    for(i = 0; i < n; ++i){
+        detection *d = dets + c[i].det;
+        if(p.per_class){
+            d->prob[c[i].class] = scores[i];
+            continue;
+        }
+        float scale = scores[i]/c[i].score;
+        d->objectness = scores[i];
+        for(k = 0; k < classes; ++k){
+            d->prob[k] *= scale;
+            if(d->prob[k] <= thresh) d->prob[k] = 0;
+        }
+    }
+    free(scores);
+    free(c);
+}
+
+// Keeps the best top_k labels of each class and the max_detections boxes
+// with the best labels, zeroing the probabilities of the rest. A box counts
+// once however many of its labels are kept.
+static void limit_detections(detection *dets, int total, int classes, float thresh, int top_k, int max_detections)
+{
+    int i, k;
+    int n = 0;
+    for(i = 0; i < total; ++i) for(k = 0; k < classes; ++k) if(dets[i].prob[k] > thresh) ++n;
+    nms_order *order = calloc(n, sizeof(nms_order));
+    n = 0;
+    for(i = 0; i < total; ++i){
+        for(k = 0; k < classes; ++k){
+            if(dets[i].prob[k] <= thresh) continue;
+            order[n].score = dets[i].prob[k];
+            order[n].index = i*classes + k;
+            ++n;
+        }
+    }
+    qsort(order, n, sizeof(nms_order), nms_order_comparator);
+    int *count = calloc(classes, sizeof(int));
+    char *kept = calloc(total, sizeof(char));
+    int boxes = 0;
+    for(i = 0; i < n; ++i){
+        int j = order[i].index/classes;
+        k = order[i].index%classes;
+        if(top_k > 0 && count[k] >= top_k){
+            dets[j].prob[k] = 0;
+            continue;
+        }
+        if(!kept[j]){
+            if(max_detections > 0 && boxes >= max_detections){
+                dets[j].prob[k] = 0;
+                continue;
+            }
+            kept[j] = 1;
+            ++boxes;
+        }
+        ++count[k];
+    }
+    free(kept);
+    free(count);
+    free(order);
+}
+
+// The caller's nms and nms_per_class, where the cfg left them out
+void default_detection_params(detection_params *p, float nms, int per_class)
+{
+    if(p->nms < 0) p->nms = nms;
+    if(p->per_class < 0) p->per_class = per_class;
+}
+
+// The NMS the params ask for, then the output limits. nms <= 0 skips greedy
+// NMS; soft-NMS runs whenever nms_kind asks for it.
+void postprocess_detections(detection *dets, int total, int classes, detection_params p)
+{
+    if(p.nms_kind != GREEDY_NMS) do_soft_nms(dets, total, classes, p.thresh, p);
+    else if(p.nms > 0 && p.per_class) do_nms_sort(dets, total, classes, p.nms);
+    else if(p.nms > 0) do_nms_obj(dets, total, classes, p.nms);
+    if(p.top_k > 0 || p.max_detections > 0) limit_detections(dets, total, classes, p.thresh, p.top_k, p.max_detections);
+}
+
+// The best class of every detection over thresh as (box, class, score),
+// highest score first. out needs room for total of them.
+int compact_detections(detection *dets, int total, int classes, float thresh, compact_detection *out)
+{
+    int i, k;
+    int n = 0;
+    nms_order *order = calloc(total, sizeof(nms_order));
+    for(i = 0; i < total; ++i){
+        int best = 0;
+        for(k = 1; k < classes; ++k) if(dets[i].prob[k] > dets[i].prob[best]) best = k;
+        if(classes <= 0 || dets[i].prob[best] <= thresh) continue;
+        order[n].score = dets[i].prob[best];
+        order[n].index = i*classes + best;
+        ++n;
+    }
+    qsort(order, n, sizeof(nms_order), nms_order_comparator);
+    for(i = 0; i < n; ++i){
+        out[i].bbox = dets[order[i].index/classes].bbox;
+        out[i].class_id = order[i].index%classes;
+        out[i].score = order[i].score;
+    }
+    free(order);
+    return n;
+}
+
+NMS_KIND get_nms_kind(char *s)
+{
+    if(strcmp(s, "greedy") == 0) return GREEDY_NMS;
+    if(strcmp(s, "linear") == 0) return LINEAR_SOFT_NMS;
+    if(strcmp(s, "gaussian") == 0) return GAUSSIAN_SOFT_NMS;
+    fprintf(stderr, "Couldn't find nms_kind %s, going with greedy\n", s);
+    return GREEDY_NMS;
+}
+
+// The quadratic NMS that do_nms_obj and do_nms_sort replace, to check them
+// against
+
+static int nms_comparator(const void *pa, const void *pb)
+{
+    detection a = *(detection *)pa;
+    detection b = *(detection *)pb;
+    float diff = 0;
+    if(b.sort_class >= 0){
+        diff = a.prob[b.sort_class] - b.prob[b.sort_class];
+    } else {
+        diff = a.objectness - b.objectness;
+    }
+    if(diff < 0) return 1;
+    else if(diff > 0) return -1;
+    return 0;
+}
+
+static void nms_obj_reference(detection *dets, int total, int classes, float thresh)
+{
+    int i, j, k;
+    k = total-1;
+    for(i = 0; i <= k; ++i){
+        if(dets[i].objectness == 0){
+            detection swap = dets[i];
+            dets[i] = dets[k];
+            dets[k] = swap;
+            --k;
+            --i;
+        }
+    }
+    total = k+1;
+
+    for(i = 0; i < total; ++i){
+        dets[i].sort_class = -1;
+    }
+
+    qsort(dets, total, sizeof(detection), nms_comparator);
+    for(i = 0; i < total; ++i){
+        if(dets[i].objectness == 0) continue;
+        box a = dets[i].bbox;
+        for(j = i+1; j < total; ++j){
+            if(dets[j].objectness == 0) continue;
+            box b = dets[j].bbox;
+            if (box_iou(a, b) > thresh){
+                dets[j].objectness = 0;
+                for(k = 0; k < classes; ++k){
+                    dets[j].prob[k] = 0;
+                }
+            }
+        }
+    }
+}
+
+static void nms_sort_reference(detection *dets, int total, int classes, float thresh)
+{
+    int i, j, k;
+    k = total-1;
+    for(i = 0; i <= k; ++i){
+        if(dets[i].objectness == 0){
+            detection swap = dets[i];
+            dets[i] = dets[k];
+            dets[k] = swap;
+            --k;
+            --i;
+        }
+    }
+    total = k+1;
+
+    for(k = 0; k < classes; ++k){
+        for(i = 0; i < total; ++i){
+            dets[i].sort_class = k;
+        }
+        qsort(dets, total, sizeof(detection), nms_comparator);
+        for(i = 0; i < total; ++i){
+            if(dets[i].prob[k] == 0) continue;
+            box a = dets[i].bbox;
+            for(j = i+1; j < total; ++j){
+                box b = dets[j].bbox;
+                if (box_iou(a, b) > thresh){
+                    dets[j].prob[k] = 0;
+                }
+            }
+        }
+    }
+}
+
+static detection *make_nms_benchmark_set(int n, int classes)
+{
+    int i;
+    detection *dets = calloc(n, sizeof(detection));
+    for(i = 0; i < n; ++i){
+        dets[i].bbox.x = rand_uniform(0, 1);
+        dets[i].bbox.y = rand_uniform(0, 1);
+        dets[i].bbox.w = rand_uniform(.01, .1);
+        dets[i].bbox.h = rand_uniform(.01, .1);
+        dets[i].classes = classes;
+        dets[i].prob = calloc(classes, sizeof(float));
+        dets[i].objectness = rand_uniform(.005, 1);
+        dets[i].prob[rand()%classes] = dets[i].objectness*rand_uniform(.5, 1);
+        if(rand()%2) dets[i].prob[rand()%classes] = dets[i].objectness*rand_uniform(0, .5);
+    }
+    return dets;
+}
+
+static detection *copy_nms_benchmark_set(detection *dets, int n, int classes)
+{
+    int i;
+    detection *copy = calloc(n, sizeof(detection));
+    for(i = 0; i < n; ++i){
+        copy[i] = dets[i];
+        copy[i].prob = calloc(classes, sizeof(float));
+        memcpy(copy[i].prob, dets[i].prob, classes*sizeof(float));
+    }
+    return copy;
+}
+
+static int nms_box_comparator(const void *pa, const void *pb)
+{
+    box a = ((detection *)pa)->bbox;
+    box b = ((detection *)pb)->bbox;
+    if(a.x != b.x) return a.x < b.x ? -1 : 1;
+    if(a.y != b.y) return a.y < b.y ? -1 : 1;
+    if(a.w != b.w) return a.w < b.w ? -1 : 1;
+    if(a.h != b.h) return a.h < b.h ? -1 : 1;
+    return 0;
+}
+
+// number of detections whose scores differ, both sets in any order
+static int nms_mismatches(detection *a, detection *b, int n, int classes)
+{
+    int i;
+    int diff = 0;
+    qsort(a, n, sizeof(detection), nms_box_comparator);
+    qsort(b, n, sizeof(detection), nms_box_comparator);
+    for(i = 0; i < n; ++i){
+        if(a[i].objectness != b[i].objectness || memcmp(a[i].prob, b[i].prob, classes*sizeof(float))) ++diff;
+    }
+    return diff;
+}
+
+static int nms_survivors(detection *dets, int n, int classes)
+{
+    int i, k;
+    int count = 0;
+    for(i = 0; i < n; ++i) for(k = 0; k < classes; ++k) if(dets[i].prob[k] != 0) ++count;
+    return count;
+}
+
+static void free_nms_benchmark_set(detection *dets, int n)
+{
+    int i;
+    for(i = 0; i < n; ++i) free(dets[i].prob);
+    free(dets);
+}
+
+static double time_nms(void (*nms)(detection *, int, int, float), detection *dets, int n, int classes, float thresh, int iter, detection **out)
+{
+    int i;
+    double best = 0;
+    for(i = 0; i < iter; ++i){
+        detection *copy = copy_nms_benchmark_set(dets, n, classes);
+        double start = what_time_is_it_now();
+        nms(copy, n, classes, thresh);
+        double t = what_time_is_it_now() - start;
+        if(i == 0 || t < best) best = t;
+        if(i == iter - 1) *out = copy;
+        else free_nms_benchmark_set(copy, n);
+    }
+    return best;
+}
+
+static void benchmark_nms_set(int n, int iter)
+{
+    int classes = 20;
+    float thresh = .45;
+    int m;
+    detection *dets = make_nms_benchmark_set(n, classes);
+    for(m = 0; m < 2; ++m){
+        void (*nms)(detection *, int, int, float) = m ? do_nms_sort : do_nms_obj;
+        void (*reference)(detection *, int, int, float) = m ? nms_sort_reference : nms_obj_reference;
+        detection *fast = 0, *slow = 0;
+        double t = time_nms(nms, dets, n, classes, thresh, iter, &fast);
+        printf("%6d boxes  %-4s %10.3f ms  %6d kept", n, m ? "sort" : "obj", t*1000, nms_survivors(fast, n, classes));
+        // the reference is quadratic, and per class at that
+        if(n <= 10000){
+            double r = time_nms(reference, dets, n, classes, thresh, 1, &slow);
+            printf("  reference %10.3f ms  %5.1fx  %d mismatches", r*1000, r/t, nms_mismatches(fast, slow, n, classes));
+            free_nms_benchmark_set(slow, n);
+        }
+        printf("\n");
+        free_nms_benchmark_set(fast, n);
+    }
+    free_nms_benchmark_set(dets, n);
+}
+
+void benchmark_nms(int iter)
+{
+    if(iter <= 0) iter = 3;
+    benchmark_nms_set(1000, iter);
+    benchmark_nms_set(10000, iter);
+    benchmark_nms_set(100000, iter);
+}
@@ -0,0 +1,7 @@
+#ifndef NMS_H
+#define NMS_H
+#include "darknet.h"
+
+NMS_KIND get_nms_kind(char *s);
+
+#endif
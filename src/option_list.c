@@ -73,6 +73,7 @@ void option_insert(list *l, char *key, char *val)
     p->key = key;
     p->val = val;
     p->used = 0;
+    p->index = 0;
     list_insert(l, p);
 }
 
@@ -88,8 +89,70 @@ void option_unused(list *l)
     }
 }
 
+// Open addressing index over the options of a cfg section, kept on its
+// first option by the parser, which owns both. The first of duplicate keys
+// wins, as with a scan of the list. Lists without an index, or that grew
+// since it was built, are scanned.
+struct option_index{
+    int size;
+    unsigned mask;
+    kvp *slots[];
+};
+
+static unsigned option_hash(char *key)
+{
+    unsigned h = 2166136261u;
+    while(*key){
+        h ^= (unsigned char)*key++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void index_options(list *l)
+{
+    if(!l->front) return;
+    unsigned slots = 8;
+    while(slots < 2*l->size) slots *= 2;
+    option_index *index = calloc(1, sizeof(option_index) + slots*sizeof(kvp *));
+    index->size = l->size;
+    index->mask = slots - 1;
+    node *n = l->front;
+    while(n){
+        kvp *p = (kvp *)n->val;
+        unsigned i = option_hash(p->key) & index->mask;
+        while(index->slots[i] && strcmp(index->slots[i]->key, p->key) != 0) i = (i + 1) & index->mask;
+        if(!index->slots[i]) index->slots[i] = p;
+        n = n->next;
+    }
+    kvp *first = (kvp *)l->front->val;
+    free(first->index);
+    first->index = index;
+}
+
+void free_option_index(list *l)
+{
+    if(!l->front) return;
+    kvp *first = (kvp *)l->front->val;
+    free(first->index);
+    first->index = 0;
+}
+
 char *option_find(list *l, char *key)
 {
+    option_index *index = l->front ? ((kvp *)l->front->val)->index : 0;
+    if(index && index->size == l->size){
+        unsigned i = option_hash(key) & index->mask;
+        while(index->slots[i]){
+            kvp *p = index->slots[i];
+            if(strcmp(p->key, key) == 0){
+                p->used = 1;
+                return p->val;
+            }
+            i = (i + 1) & index->mask;
+        }
+        return 0;
+    }
     node *n = l->front;
     while(n){
         kvp *p = (kvp *)n->val;
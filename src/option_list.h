@@ -2,10 +2,13 @@
 #define OPTION_LIST_H
 #include "list.h"
 
+typedef struct option_index option_index;
+
 typedef struct{
     char *key;
     char *val;
     int used;
+    option_index *index;
 } kvp;
 
 
@@ -15,5 +18,7 @@ char *option_find(list *l, char *key);
 float option_find_float(list *l, char *key, float def);
 float option_find_float_quiet(list *l, char *key, float def);
 void option_unused(list *l);
+void index_options(list *l);
+void free_option_index(list *l);
 
 #endif
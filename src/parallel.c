@@ -0,0 +1,296 @@
+#define _GNU_SOURCE
+#include "parallel.h"
+#include "utils.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Persistent pool for intra-layer parallelism. parallel_for splits [0, n)
+// evenly over the workers, the caller being worker 0. Each takes grain
+// sized chunks off the front of its own range; once that is empty it steals
+// the back half of someone else's. Workers spin for a while after a job
+// before sleeping, since layers post jobs back to back.
+
+#define PARALLEL_SPIN 256
+
+typedef struct{
+    pthread_spinlock_t lock;
+    int begin;
+    int end;
+} __attribute__((aligned(64))) parallel_range;
+
+typedef struct{
+    thread_pool *pool;
+    int id;
+    pthread_t thread;
+} pool_worker;
+
+struct thread_pool{
+    int threads;
+    pool_worker *workers;
+    parallel_range *ranges;
+
+    // held by the thread posting a job; concurrent callers run inline
+    pthread_mutex_t submit;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    unsigned generation;
+    int active;
+    int stop;
+
+    parallel_fn fn;
+    void *arg;
+    int grain;
+};
+
+static __thread thread_pool *current_pool = 0;
+static __thread int parallel_depth = 0;
+
+static thread_pool *default_pool = 0;
+static pthread_once_t default_pool_once = PTHREAD_ONCE_INIT;
+
+static inline void spin_pause()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static int take_range(parallel_range *r, int grain, int *begin, int *end)
+{
+    pthread_spin_lock(&r->lock);
+    int left = r->end - r->begin;
+    if(left > 0){
+        *begin = r->begin;
+        *end = (left > grain) ? r->begin + grain : r->end;
+        r->begin = *end;
+    }
+    pthread_spin_unlock(&r->lock);
+    return left > 0;
+}
+
+static int steal_range(thread_pool *p, int id)
+{
+    int i;
+    for(i = 1; i < p->threads; ++i){
+        parallel_range *v = p->ranges + (id + i) % p->threads;
+        int begin = 0, end = 0;
+        pthread_spin_lock(&v->lock);
+        int left = v->end - v->begin;
+        if(left > 0){
+            begin = (left > p->grain) ? v->begin + left/2 : v->begin;
+            end = v->end;
+            v->end = begin;
+        }
+        pthread_spin_unlock(&v->lock);
+        if(begin < end){
+            parallel_range *r = p->ranges + id;
+            pthread_spin_lock(&r->lock);
+            r->begin = begin;
+            r->end = end;
+            pthread_spin_unlock(&r->lock);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void run_worker(thread_pool *p, int id)
+{
+    int begin, end;
+    ++parallel_depth;
+    do{
+        while(take_range(p->ranges + id, p->grain, &begin, &end)) p->fn(p->arg, begin, end);
+    } while(steal_range(p, id));
+    --parallel_depth;
+}
+
+static void *pool_worker_thread(void *ptr)
+{
+    pool_worker *w = ptr;
+    thread_pool *p = w->pool;
+    unsigned seen = 0;
+    for(;;){
+        int i;
+        for(i = 0; i < PARALLEL_SPIN && __atomic_load_n(&p->generation, __ATOMIC_ACQUIRE) == seen; ++i) spin_pause();
+        pthread_mutex_lock(&p->mutex);
+        while(p->generation == seen && !p->stop) pthread_cond_wait(&p->wake, &p->mutex);
+        if(p->stop){
+            pthread_mutex_unlock(&p->mutex);
+            return 0;
+        }
+        seen = p->generation;
+        pthread_mutex_unlock(&p->mutex);
+
+        run_worker(p, w->id);
+
+        pthread_mutex_lock(&p->mutex);
+        if(__atomic_sub_fetch(&p->active, 1, __ATOMIC_RELEASE) == 0) pthread_cond_signal(&p->done);
+        pthread_mutex_unlock(&p->mutex);
+    }
+}
+
+// DARKNET_THREADS sets the size of the pool shared by networks without
+// their own, all online cpus by default
+static void make_default_thread_pool()
+{
+    char *s = getenv("DARKNET_THREADS");
+    default_pool = make_thread_pool(s ? atoi(s) : 0, 0, 0);
+}
+
+void parallel_for(int n, int grain, parallel_fn fn, void *arg)
+{
+    if(n <= 0) return;
+    if(grain < 1) grain = 1;
+    thread_pool *p = current_pool;
+    if(!p){
+        pthread_once(&default_pool_once, make_default_thread_pool);
+        p = default_pool;
+    }
+    if(p->threads < 2 || n <= grain || parallel_depth || pthread_mutex_trylock(&p->submit)){
+        fn(arg, 0, n);
+        return;
+    }
+    int t = p->threads;
+    int i;
+    p->fn = fn;
+    p->arg = arg;
+    p->grain = grain;
+    for(i = 0; i < t; ++i){
+        p->ranges[i].begin = (long)n*i/t;
+        p->ranges[i].end = (long)n*(i + 1)/t;
+    }
+    pthread_mutex_lock(&p->mutex);
+    __atomic_store_n(&p->active, t - 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&p->generation, p->generation + 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&p->wake);
+    pthread_mutex_unlock(&p->mutex);
+
+    run_worker(p, 0);
+
+    for(i = 0; i < PARALLEL_SPIN && __atomic_load_n(&p->active, __ATOMIC_ACQUIRE); ++i) spin_pause();
+    pthread_mutex_lock(&p->mutex);
+    while(p->active) pthread_cond_wait(&p->done, &p->mutex);
+    pthread_mutex_unlock(&p->mutex);
+    pthread_mutex_unlock(&p->submit);
+}
+
+// cpus is a list like "0-3,8,10-11"
+static int parse_cpu_list(char *s, int *cpus, int max)
+{
+    int n = 0;
+    while(s && *s){
+        char *next;
+        int first = strtol(s, &next, 10);
+        int last = first;
+        if(next == s) break;
+        if(*next == '-') last = strtol(next + 1, &next, 10);
+        for(; first <= last && n < max; ++first) cpus[n++] = first;
+        s = (*next == ',') ? next + 1 : 0;
+    }
+    return n;
+}
+
+char *numa_node_cpus(int node)
+{
+    char path[256];
+    char buf[4096] = {0};
+    sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *fp = fopen(path, "r");
+    if(!fp){
+        fprintf(stderr, "Couldn't find NUMA node %d, not restricting threads\n", node);
+        return 0;
+    }
+    if(!fgets(buf, sizeof(buf), fp)) buf[0] = 0;
+    fclose(fp);
+    strip(buf);
+    return copy_string(buf);
+}
+
+// Workers 1..threads-1 are created here, the thread calling parallel_for
+// is worker 0. With cpus the workers are restricted to those cpus, with pin
+// each is bound to one of them in turn.
+thread_pool *make_thread_pool(int threads, char *cpus, int pin)
+{
+    int ncpus = 0;
+    int *cpu = 0;
+    int i;
+    if(cpus || pin){
+        int max = sysconf(_SC_NPROCESSORS_CONF);
+        cpu = calloc(max, sizeof(int));
+        if(cpus) ncpus = parse_cpu_list(cpus, cpu, max);
+        else for(ncpus = 0; ncpus < max; ++ncpus) cpu[ncpus] = ncpus;
+    }
+    if(threads < 1) threads = ncpus ? ncpus : sysconf(_SC_NPROCESSORS_ONLN);
+    if(threads < 1) threads = 1;
+
+    thread_pool *p = calloc(1, sizeof(thread_pool));
+    p->threads = threads;
+    if(posix_memalign((void **)&p->ranges, 64, threads*sizeof(parallel_range))) malloc_error();
+    for(i = 0; i < threads; ++i){
+        pthread_spin_init(&p->ranges[i].lock, PTHREAD_PROCESS_PRIVATE);
+        p->ranges[i].begin = p->ranges[i].end = 0;
+    }
+    pthread_mutex_init(&p->submit, 0);
+    pthread_mutex_init(&p->mutex, 0);
+    pthread_cond_init(&p->wake, 0);
+    pthread_cond_init(&p->done, 0);
+    p->workers = calloc(threads, sizeof(pool_worker));
+    for(i = 1; i < threads; ++i){
+        pool_worker *w = p->workers + i;
+        pthread_attr_t attr;
+        w->pool = p;
+        w->id = i;
+        pthread_attr_init(&attr);
+#ifdef __linux__
+        if(ncpus){
+            cpu_set_t set;
+            int j;
+            CPU_ZERO(&set);
+            if(pin) CPU_SET(cpu[i % ncpus], &set);
+            else for(j = 0; j < ncpus; ++j) CPU_SET(cpu[j], &set);
+            pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        }
+#endif
+        if(pthread_create(&w->thread, &attr, pool_worker_thread, w)) error("Thread creation failed");
+        pthread_attr_destroy(&attr);
+    }
+    free(cpu);
+    return p;
+}
+
+void free_thread_pool(thread_pool *p)
+{
+    int i;
+    if(!p) return;
+    pthread_mutex_lock(&p->mutex);
+    p->stop = 1;
+    pthread_cond_broadcast(&p->wake);
+    pthread_mutex_unlock(&p->mutex);
+    for(i = 1; i < p->threads; ++i) pthread_join(p->workers[i].thread, 0);
+    for(i = 0; i < p->threads; ++i) pthread_spin_destroy(&p->ranges[i].lock);
+    pthread_mutex_destroy(&p->submit);
+    pthread_mutex_destroy(&p->mutex);
+    pthread_cond_destroy(&p->wake);
+    pthread_cond_destroy(&p->done);
+    free(p->ranges);
+    free(p->workers);
+    free(p);
+}
+
+int thread_pool_size(thread_pool *p)
+{
+    return p ? p->threads : 1;
+}
+
+thread_pool *set_thread_pool(thread_pool *pool)
+{
+    thread_pool *prev = current_pool;
+    current_pool = pool;
+    return prev;
+}
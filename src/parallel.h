@@ -0,0 +1,26 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+#include "darknet.h"
+
+// Roughly the number of elements of simple per-element work worth handing
+// to another thread
+#define PARALLEL_GRAIN 16384
+
+// Runs fn over [0, n) in chunks of at least grain on the calling thread's
+// pool. fn must be safe to call concurrently on disjoint ranges.
+typedef void (*parallel_fn)(void *arg, int begin, int end);
+void parallel_for(int n, int grain, parallel_fn fn, void *arg);
+
+// grain for n items that each cost about cost elements of work
+static inline int parallel_grain(int cost)
+{
+    return (cost >= PARALLEL_GRAIN || cost <= 0) ? 1 : PARALLEL_GRAIN/cost;
+}
+
+// Pool used by parallel_for on this thread, 0 for the process default.
+// Returns the previous one.
+thread_pool *set_thread_pool(thread_pool *pool);
+
+char *numa_node_cpus(int node);
+
+#endif
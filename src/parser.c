@@ -2,6 +2,11 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "activation_layer.h"
 #include "logistic_layer.h"
@@ -35,6 +40,9 @@
 #include "shortcut_layer.h"
 #include "softmax_layer.h"
 #include "lstm_layer.h"
+#include "half.h"
+#include "nms.h"
+#include "parallel.h"
 #include "utils.h"
 
 typedef struct{
@@ -42,7 +50,29 @@ typedef struct{
     list *options;
 }section;
 
-list *read_cfg(char *filename);
+// A cfg file read in one pass: its text, sections and options each live in
+// one block that the section and option lists point into, and each section
+// keeps an index of its options. Files are cached by path and read again
+// when they change on disk. Only the text and sections are cached: layers
+// are built on every parse, since each network owns its buffers.
+// read_cfg hands out &sections, which free_cfg maps back to its file.
+typedef struct cfg_file{
+    list sections;
+    char *filename;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    char *text;
+    section *section_block;
+    kvp *option_block;
+    int noptions;
+    pthread_mutex_t lock;
+    struct cfg_file *next;
+} cfg_file;
+
+static cfg_file *lock_cfg(char *filename);
+static void unlock_cfg(cfg_file *c);
 
 LAYER_TYPE string_to_layer_type(char * type)
 {
@@ -86,22 +116,6 @@ LAYER_TYPE string_to_layer_type(char * type)
     return BLANK;
 }
 
-void free_section(section *s)
-{
-    free(s->type);
-    node *n = s->options->front;
-    while(n){
-        kvp *pair = (kvp *)n->val;
-        free(pair->key);
-        free(pair);
-        node *next = n->next;
-        free(n);
-        n = next;
-    }
-    free(s->options);
-    free(s);
-}
-
 void parse_data(char *data, float *a, int n)
 {
     int i;
@@ -199,9 +213,14 @@ convolutional_layer parse_convolutional(list *options, size_params params)
     int binary = option_find_int_quiet(options, "binary", 0);
     int xnor = option_find_int_quiet(options, "xnor", 0);
 
-    convolutional_layer layer = make_convolutional_layer(batch,h,w,c,n,groups,size,stride,padding,activation, batch_normalize, binary, xnor, params.net->adam);
+    convolutional_layer layer = make_convolutional_layer(batch,h,w,c,n,groups,size,stride,padding,activation, batch_normalize, binary, xnor, params.net->adam, params.net->inference);
     layer.flipped = option_find_int_quiet(options, "flipped", 0);
     layer.dot = option_find_float_quiet(options, "dot", 0);
+    int winograd = option_find_int_quiet(options, "winograd", params.net->winograd);
+#ifdef GPU
+    if(params.net->gpu_index >= 0) winograd = 0;
+#endif
+    if(winograd) set_winograd_convolutional_layer(&layer, winograd);
 
     return layer;
 }
@@ -263,14 +282,14 @@ layer parse_connected(list *options, size_params params)
     ACTIVATION activation = get_activation(activation_s);
     int batch_normalize = option_find_int_quiet(options, "batch_normalize", 0);
 
-    layer l = make_connected_layer(params.batch, params.inputs, output, activation, batch_normalize, params.net->adam);
+    layer l = make_connected_layer(params.batch, params.inputs, output, activation, batch_normalize, params.net->adam, params.net->inference);
     return l;
 }
 
 layer parse_softmax(list *options, size_params params)
 {
     int groups = option_find_int_quiet(options, "groups",1);
-    layer l = make_softmax_layer(params.batch, params.inputs, groups);
+    layer l = make_softmax_layer(params.batch, params.inputs, groups, params.net->inference);
     l.temperature = option_find_float_quiet(options, "temperature", 1);
     char *tree_file = option_find_str(options, "tree", 0);
     if (tree_file) l.softmax_tree = read_tree(tree_file);
@@ -311,7 +330,7 @@ layer parse_yolo(list *options, size_params params)
 
     char *a = option_find_str(options, "mask", 0);
     int *mask = parse_yolo_mask(a, &num);
-    layer l = make_yolo_layer(params.batch, params.w, params.h, num, total, mask, classes);
+    layer l = make_yolo_layer(params.batch, params.w, params.h, num, total, mask, classes, params.net->inference);
     assert(l.outputs == params.inputs);
 
     l.max_boxes = option_find_int_quiet(options, "max",90);
@@ -320,6 +339,7 @@ layer parse_yolo(list *options, size_params params)
     l.ignore_thresh = option_find_float(options, "ignore_thresh", .5);
     l.truth_thresh = option_find_float(options, "truth_thresh", 1);
     l.random = option_find_int_quiet(options, "random", 0);
+    l.top_classes = option_find_int_quiet(options, "top_classes", 0);
 
     char *map_file = option_find_str(options, "map", 0);
     if (map_file) l.map = read_map(map_file);
@@ -356,7 +376,7 @@ layer parse_region(list *options, size_params params)
     int classes = option_find_int(options, "classes", 20);
     int num = option_find_int(options, "num", 1);
 
-    layer l = make_region_layer(params.batch, params.w, params.h, num, classes, coords);
+    layer l = make_region_layer(params.batch, params.w, params.h, num, classes, coords, params.net->inference);
     assert(l.outputs == params.inputs);
 
     l.log = option_find_int_quiet(options, "log", 0);
@@ -476,7 +496,7 @@ layer parse_reorg(list *options, size_params params)
     batch=params.batch;
     if(!(h && w && c)) error("Layer before reorg layer must output image.");
 
-    layer layer = make_reorg_layer(batch,w,h,c,stride,reverse, flatten, extra);
+    layer layer = make_reorg_layer(batch,w,h,c,stride,reverse, flatten, extra, params.net->inference);
     return layer;
 }
 
@@ -493,7 +513,7 @@ maxpool_layer parse_maxpool(list *options, size_params params)
     batch=params.batch;
     if(!(h && w && c)) error("Layer before maxpool layer must output image.");
 
-    maxpool_layer layer = make_maxpool_layer(batch,h,w,c,size,stride,padding);
+    maxpool_layer layer = make_maxpool_layer(batch,h,w,c,size,stride,padding,params.net->inference);
     return layer;
 }
 
@@ -506,7 +526,7 @@ avgpool_layer parse_avgpool(list *options, size_params params)
     batch=params.batch;
     if(!(h && w && c)) error("Layer before avgpool layer must output image.");
 
-    avgpool_layer layer = make_avgpool_layer(batch,w,h,c);
+    avgpool_layer layer = make_avgpool_layer(batch,w,h,c,params.net->inference);
     return layer;
 }
 
@@ -532,7 +552,7 @@ layer parse_normalization(list *options, size_params params)
 
 layer parse_batchnorm(list *options, size_params params)
 {
-    layer l = make_batchnorm_layer(params.batch, params.w, params.h, params.c);
+    layer l = make_batchnorm_layer(params.batch, params.w, params.h, params.c, params.net->inference);
     return l;
 }
 
@@ -545,7 +565,7 @@ layer parse_shortcut(list *options, size_params params, network *net)
     int batch = params.batch;
     layer from = net->layers[index];
 
-    layer s = make_shortcut_layer(batch, index, params.w, params.h, params.c, from.out_w, from.out_h, from.out_c);
+    layer s = make_shortcut_layer(batch, index, params.w, params.h, params.c, from.out_w, from.out_h, from.out_c, params.net->inference);
 
     char *activation_s = option_find_str(options, "activation", "linear");
     ACTIVATION activation = get_activation(activation_s);
@@ -593,7 +613,7 @@ layer parse_upsample(list *options, size_params params, network *net)
 {
 
     int stride = option_find_int(options, "stride",2);
-    layer l = make_upsample_layer(params.batch, params.w, params.h, params.c, stride);
+    layer l = make_upsample_layer(params.batch, params.w, params.h, params.c, stride, params.net->inference);
     l.scale = option_find_float_quiet(options, "scale", 1);
     return l;
 }
@@ -620,7 +640,7 @@ route_layer parse_route(list *options, size_params params, network *net)
     }
     int batch = params.batch;
 
-    route_layer layer = make_route_layer(batch, n, layers, sizes);
+    route_layer layer = make_route_layer(batch, n, layers, sizes, params.net->inference);
 
     convolutional_layer first = net->layers[layers[0]];
     layer.out_w = first.out_w;
@@ -665,6 +685,28 @@ void parse_net_options(list *options, network *net)
     net->batch *= net->time_steps;
     net->subdivisions = subdivs;
     net->random = option_find_int_quiet(options, "random", 0);
+    net->winograd = option_find_int_quiet(options, "winograd", 0);
+    net->winograd_tolerance = option_find_float_quiet(options, "winograd_tolerance", .001);
+    char *precision_s = option_find_str(options, "precision", 0);
+    net->precision = precision_s ? get_precision(precision_s) : FP32;
+    net->prepack = option_find_int_quiet(options, "prepack", -1);
+    net->detection.thresh = option_find_float_quiet(options, "thresh", .5);
+    char *nms_kind_s = option_find_str(options, "nms_kind", 0);
+    net->detection.nms_kind = nms_kind_s ? get_nms_kind(nms_kind_s) : GREEDY_NMS;
+    net->detection.nms = option_find_float_quiet(options, "nms", -1);
+    net->detection.sigma = option_find_float_quiet(options, "nms_sigma", .5);
+    net->detection.per_class = option_find_int_quiet(options, "nms_per_class", -1);
+    net->detection.top_k = option_find_int_quiet(options, "top_k", 0);
+    net->detection.max_detections = option_find_int_quiet(options, "max_detections", 0);
+
+    int threads = option_find_int_quiet(options, "threads", 0);
+    int numa_node = option_find_int_quiet(options, "numa_node", -1);
+    int pin = option_find_int_quiet(options, "thread_pin", 0);
+    char *cpus = option_find_str(options, "thread_cpus", 0);
+    char *node_cpus = (!cpus && numa_node >= 0) ? numa_node_cpus(numa_node) : 0;
+    if(node_cpus) cpus = node_cpus;
+    if(threads || cpus || pin) set_network_threads(net, threads, cpus, pin);
+    free(node_cpus);
 
     net->adam = option_find_int_quiet(options, "adam", 0);
     if(net->adam){
@@ -739,13 +781,19 @@ int is_network(section *s)
             || strcmp(s->type, "[network]")==0);
 }
 
-network *parse_network_cfg(char *filename)
+static network *parse_network(char *filename, int inference)
 {
-    list *sections = read_cfg(filename);
+    cfg_file *cfg = lock_cfg(filename);
+    list *sections = &cfg->sections;
     node *n = sections->front;
     if(!n) error("Config file has no sections");
     network *net = make_network(sections->size - 1);
     net->gpu_index = gpu_index;
+    net->inference = inference;
+#ifdef GPU
+    // push_* and pull_* mirror the training buffers between host and device
+    if(net->gpu_index >= 0) net->inference = 0;
+#endif
     size_params params;
 
     section *s = (section *)n->val;
@@ -764,7 +812,6 @@ network *parse_network_cfg(char *filename)
     size_t workspace_size = 0;
     n = n->next;
     int count = 0;
-    free_section(s);
     fprintf(stderr, "layer     filters    size              input                output\n");
     while(n){
         params.index = count;
@@ -850,7 +897,6 @@ network *parse_network_cfg(char *filename)
         option_unused(options);
         net->layers[count] = l;
         if (l.workspace_size > workspace_size) workspace_size = l.workspace_size;
-        free_section(s);
         n = n->next;
         ++count;
         if(n){
@@ -860,14 +906,14 @@ network *parse_network_cfg(char *filename)
             params.inputs = l.outputs;
         }
     }
-    free_list(sections);
+    unlock_cfg(cfg);
     layer out = get_network_output_layer(net);
     net->outputs = out.outputs;
     net->truths = out.outputs;
     if(net->layers[net->n-1].truths) net->truths = net->layers[net->n-1].truths;
     net->output = out.output;
     net->input = calloc(net->inputs*net->batch, sizeof(float));
-    net->truth = calloc(net->truths*net->batch, sizeof(float));
+    if(!net->inference) net->truth = calloc(net->truths*net->batch, sizeof(float));
 #ifdef GPU
     net->output_gpu = out.output_gpu;
     net->input_gpu = cuda_make_array(net->input, net->inputs*net->batch);
@@ -878,49 +924,181 @@ network *parse_network_cfg(char *filename)
 #ifdef GPU
         if(gpu_index >= 0){
             net->workspace = cuda_make_array(0, (workspace_size-1)/sizeof(float)+1);
+            net->workspace_size = (workspace_size-1)/sizeof(float)+1;
         }else {
             net->workspace = calloc(1, workspace_size);
+            net->workspace_size = workspace_size;
         }
 #else
         net->workspace = calloc(1, workspace_size);
+        net->workspace_size = workspace_size;
 #endif
     }
     return net;
 }
 
-list *read_cfg(char *filename)
+network *parse_network_cfg(char *filename)
+{
+    return parse_network(filename, 0);
+}
+
+// Only the buffers forward_network needs at inference are allocated, no
+// deltas, updates, batch norm statistics or optimizer state.
+network *parse_network_cfg_inference(char *filename)
 {
-    FILE *file = fopen(filename, "r");
+    return parse_network(filename, 1);
+}
+
+static void read_cfg_file(cfg_file *c, char *filename)
+{
+    FILE *file = fopen(filename, "rb");
     if(file == 0) file_error(filename);
-    char *line;
+    fseek(file, 0, SEEK_END);
+    size_t size = ftell(file);
+    rewind(file);
+    c->text = malloc(size + 1);
+    size = fread(c->text, 1, size, file);
+    c->text[size] = '\0';
+    fclose(file);
+
+    size_t i;
+    int lines = 1;
+    for(i = 0; i < size; ++i) if(c->text[i] == '\n') ++lines;
+    c->section_block = calloc(lines, sizeof(section));
+    c->option_block = calloc(lines, sizeof(kvp));
+    c->noptions = 0;
+
     int nu = 0;
-    list *options = make_list();
     section *current = 0;
-    while((line=fgetl(file)) != 0){
+    char *line = c->text;
+    while(line){
+        char *next = strchr(line, '\n');
+        if(next) *next++ = '\0';
         ++ nu;
         strip(line);
         switch(line[0]){
             case '[':
-                current = malloc(sizeof(section));
-                list_insert(options, current);
-                current->options = make_list();
+                current = c->section_block + c->sections.size;
                 current->type = line;
+                current->options = make_list();
+                list_insert(&c->sections, current);
                 break;
             case '\0':
             case '#':
             case ';':
-                free(line);
                 break;
             default:
-                if(!read_option(line, current->options)){
-                    fprintf(stderr, "Config file error line %d, could parse: %s\n", nu, line);
-                    free(line);
+                {
+                    kvp *p = c->option_block + c->noptions;
+                    char *val = strchr(line, '=');
+                    if(val) *val++ = '\0';
+                    if(!current || (val && !*val)){
+                        fprintf(stderr, "Config file error line %d, could parse: %s\n", nu, line);
+                        break;
+                    }
+                    p->key = line;
+                    p->val = val;
+                    list_insert(current->options, p);
+                    ++c->noptions;
                 }
                 break;
         }
+        line = next;
     }
-    fclose(file);
-    return options;
+    node *n;
+    for(n = c->sections.front; n; n = n->next) index_options(((section *)n->val)->options);
+}
+
+static void free_cfg_contents(cfg_file *c)
+{
+    if(!c->text) return;
+    node *n = c->sections.front;
+    while(n){
+        node *next = n->next;
+        list *options = ((section *)n->val)->options;
+        free_option_index(options);
+        free_list(options);
+        free(n);
+        n = next;
+    }
+    memset(&c->sections, 0, sizeof(list));
+    free(c->section_block);
+    free(c->option_block);
+    free(c->text);
+    c->text = 0;
+}
+
+static cfg_file *cfg_cache = 0;
+static pthread_mutex_t cfg_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Uncached, the sections belong to the caller until free_cfg
+list *read_cfg(char *filename)
+{
+    cfg_file *c = calloc(1, sizeof(cfg_file));
+    read_cfg_file(c, filename);
+    return &c->sections;
+}
+
+void free_cfg(list *sections)
+{
+    if(!sections) return;
+    cfg_file *c = (cfg_file *)sections;
+    free_cfg_contents(c);
+    free(c);
+}
+
+// The cached file for filename, locked and up to date, with all its options
+// marked unused. Parses of the same file take turns.
+static cfg_file *lock_cfg(char *filename)
+{
+    struct stat st;
+    if(stat(filename, &st)) file_error(filename);
+    pthread_mutex_lock(&cfg_cache_lock);
+    cfg_file *c = cfg_cache;
+    while(c && strcmp(c->filename, filename) != 0) c = c->next;
+    if(!c){
+        c = calloc(1, sizeof(cfg_file));
+        c->filename = copy_string(filename);
+        pthread_mutex_init(&c->lock, 0);
+        c->next = cfg_cache;
+        cfg_cache = c;
+    }
+    pthread_mutex_unlock(&cfg_cache_lock);
+
+    pthread_mutex_lock(&c->lock);
+    // Nanoseconds too, or a rewrite of the same size within a second is missed
+    if(!c->text || c->dev != st.st_dev || c->ino != st.st_ino || c->size != st.st_size
+            || c->mtime.tv_sec != st.st_mtim.tv_sec || c->mtime.tv_nsec != st.st_mtim.tv_nsec){
+        free_cfg_contents(c);
+        read_cfg_file(c, filename);
+        c->dev = st.st_dev;
+        c->ino = st.st_ino;
+        c->size = st.st_size;
+        c->mtime = st.st_mtim;
+    }
+    int i;
+    for(i = 0; i < c->noptions; ++i) c->option_block[i].used = 0;
+    return c;
+}
+
+static void unlock_cfg(cfg_file *c)
+{
+    pthread_mutex_unlock(&c->lock);
+}
+
+// Not safe while another thread is parsing a network
+void free_network_cfg_cache()
+{
+    pthread_mutex_lock(&cfg_cache_lock);
+    while(cfg_cache){
+        cfg_file *c = cfg_cache;
+        cfg_cache = c->next;
+        free_cfg_contents(c);
+        pthread_mutex_destroy(&c->lock);
+        free(c->filename);
+        free(c);
+    }
+    pthread_mutex_unlock(&cfg_cache_lock);
 }
 
 void save_convolutional_weights_binary(layer l, FILE *fp)
@@ -973,6 +1151,13 @@ void save_convolutional_weights(layer l, FILE *fp)
         fwrite(l.rolling_mean, sizeof(float), l.n, fp);
         fwrite(l.rolling_variance, sizeof(float), l.n, fp);
     }
+    if(l.weights_half){
+        float *weights = calloc(num, sizeof(float));
+        half_to_float(l.weights_half, num, weights, l.precision);
+        fwrite(weights, sizeof(float), num, fp);
+        free(weights);
+        return;
+    }
     fwrite(l.weights, sizeof(float), num, fp);
 }
 
@@ -1095,19 +1280,41 @@ void transpose_matrix(float *a, int rows, int cols)
     free(transpose);
 }
 
-void load_connected_weights(layer l, FILE *fp, int transpose)
+// A layer's range of a .weights file, read with pread on a descriptor the
+// loader threads share, straight into the layer's arrays.
+typedef struct{
+    int fd;
+    off_t offset;
+    char *filename;
+} weights_file;
+
+static size_t read_weights(void *ptr, size_t size, size_t n, weights_file *wf)
+{
+    size_t bytes = size*n;
+    size_t got = 0;
+    while(got < bytes){
+        ssize_t r = pread(wf->fd, (char *)ptr + got, bytes - got, wf->offset + got);
+        if(r < 0) file_error(wf->filename);
+        if(r == 0) break;
+        got += r;
+    }
+    wf->offset += bytes;
+    return got/size;
+}
+
+void load_connected_weights(layer l, weights_file *wf, int transpose)
 {
-    fread(l.biases, sizeof(float), l.outputs, fp);
-    fread(l.weights, sizeof(float), l.outputs*l.inputs, fp);
+    read_weights(l.biases, sizeof(float), l.outputs, wf);
+    read_weights(l.weights, sizeof(float), l.outputs*l.inputs, wf);
     if(transpose){
         transpose_matrix(l.weights, l.inputs, l.outputs);
     }
     //printf("Biases: %f mean %f variance\n", mean_array(l.biases, l.outputs), variance_array(l.biases, l.outputs));
     //printf("Weights: %f mean %f variance\n", mean_array(l.weights, l.outputs*l.inputs), variance_array(l.weights, l.outputs*l.inputs));
     if (l.batch_normalize && (!l.dontloadscales)){
-        fread(l.scales, sizeof(float), l.outputs, fp);
-        fread(l.rolling_mean, sizeof(float), l.outputs, fp);
-        fread(l.rolling_variance, sizeof(float), l.outputs, fp);
+        read_weights(l.scales, sizeof(float), l.outputs, wf);
+        read_weights(l.rolling_mean, sizeof(float), l.outputs, wf);
+        read_weights(l.rolling_variance, sizeof(float), l.outputs, wf);
         //printf("Scales: %f mean %f variance\n", mean_array(l.scales, l.outputs), variance_array(l.scales, l.outputs));
         //printf("rolling_mean: %f mean %f variance\n", mean_array(l.rolling_mean, l.outputs), variance_array(l.rolling_mean, l.outputs));
         //printf("rolling_variance: %f mean %f variance\n", mean_array(l.rolling_variance, l.outputs), variance_array(l.rolling_variance, l.outputs));
@@ -1119,11 +1326,11 @@ void load_connected_weights(layer l, FILE *fp, int transpose)
 #endif
 }
 
-void load_batchnorm_weights(layer l, FILE *fp)
+void load_batchnorm_weights(layer l, weights_file *wf)
 {
-    fread(l.scales, sizeof(float), l.c, fp);
-    fread(l.rolling_mean, sizeof(float), l.c, fp);
-    fread(l.rolling_variance, sizeof(float), l.c, fp);
+    read_weights(l.scales, sizeof(float), l.c, wf);
+    read_weights(l.rolling_mean, sizeof(float), l.c, wf);
+    read_weights(l.rolling_variance, sizeof(float), l.c, wf);
 #ifdef GPU
     if(gpu_index >= 0){
         push_batchnorm_layer(l);
@@ -1131,29 +1338,30 @@ void load_batchnorm_weights(layer l, FILE *fp)
 #endif
 }
 
-void load_convolutional_weights_binary(layer l, FILE *fp)
+void load_convolutional_weights_binary(layer l, weights_file *wf)
 {
-    fread(l.biases, sizeof(float), l.n, fp);
+    read_weights(l.biases, sizeof(float), l.n, wf);
     if (l.batch_normalize && (!l.dontloadscales)){
-        fread(l.scales, sizeof(float), l.n, fp);
-        fread(l.rolling_mean, sizeof(float), l.n, fp);
-        fread(l.rolling_variance, sizeof(float), l.n, fp);
+        read_weights(l.scales, sizeof(float), l.n, wf);
+        read_weights(l.rolling_mean, sizeof(float), l.n, wf);
+        read_weights(l.rolling_variance, sizeof(float), l.n, wf);
     }
     int size = l.c*l.size*l.size;
     int i, j, k;
     for(i = 0; i < l.n; ++i){
         float mean = 0;
-        fread(&mean, sizeof(float), 1, fp);
+        read_weights(&mean, sizeof(float), 1, wf);
         for(j = 0; j < size/8; ++j){
             int index = i*size + j*8;
             unsigned char c = 0;
-            fread(&c, sizeof(char), 1, fp);
+            read_weights(&c, sizeof(char), 1, wf);
             for(k = 0; k < 8; ++k){
                 if (j*8 + k >= size) break;
                 l.weights[index + k] = (c & 1<<k) ? mean : -mean;
             }
         }
     }
+    pack_xnor_weights(l);
 #ifdef GPU
     if(gpu_index >= 0){
         push_convolutional_layer(l);
@@ -1161,19 +1369,19 @@ void load_convolutional_weights_binary(layer l, FILE *fp)
 #endif
 }
 
-void load_convolutional_weights(layer l, FILE *fp)
+void load_convolutional_weights(layer l, weights_file *wf)
 {
     if(l.binary){
-        //load_convolutional_weights_binary(l, fp);
+        //load_convolutional_weights_binary(l, wf);
         //return;
     }
     if(l.numload) l.n = l.numload;
     int num = l.c/l.groups*l.n*l.size*l.size;
-    fread(l.biases, sizeof(float), l.n, fp);
+    read_weights(l.biases, sizeof(float), l.n, wf);
     if (l.batch_normalize && (!l.dontloadscales)){
-        fread(l.scales, sizeof(float), l.n, fp);
-        fread(l.rolling_mean, sizeof(float), l.n, fp);
-        fread(l.rolling_variance, sizeof(float), l.n, fp);
+        read_weights(l.scales, sizeof(float), l.n, wf);
+        read_weights(l.rolling_mean, sizeof(float), l.n, wf);
+        read_weights(l.rolling_variance, sizeof(float), l.n, wf);
         if(0){
             int i;
             for(i = 0; i < l.n; ++i){
@@ -1201,11 +1409,14 @@ void load_convolutional_weights(layer l, FILE *fp)
             printf("\n");
         }
     }
-    fread(l.weights, sizeof(float), num, fp);
+    read_weights(l.weights, sizeof(float), num, wf);
     //if(l.c == 3) scal_cpu(num, 1./256, l.weights, 1);
     if (l.flipped) {
         transpose_matrix(l.weights, l.c*l.size*l.size, l.n);
     }
+    transform_winograd_weights(l);
+    pack_xnor_weights(l);
+    fold_convolutional_epilogue(l);
     //if (l.binary) binarize_weights(l.weights, l.n, l.c*l.size*l.size, l.weights);
 #ifdef GPU
     if(gpu_index >= 0){
@@ -1215,6 +1426,394 @@ void load_convolutional_weights(layer l, FILE *fp)
 }
 
 
+// Mapped weights: a versioned container whose tensors start on 64 byte
+// boundaries, so a loader can mmap the file and point the layers straight
+// into it. The mapping is private, layers that change their weights in
+// place (folding, fine tuning) get their own copy of the pages they touch
+// and the rest stays shared in the page cache between processes.
+//
+// header: mapped_header, 64 bytes
+// table:  mapped_header.tensors mapped_tensor entries
+// data:   float tensors, each aligned to MAPPED_ALIGN
+
+#define MAPPED_MAGIC "DNMAPWTS"
+#define MAPPED_VERSION 1
+#define MAPPED_ALIGN 64
+
+typedef enum{
+    MAPPED_BIASES, MAPPED_SCALES, MAPPED_ROLLING_MEAN, MAPPED_ROLLING_VARIANCE, MAPPED_WEIGHTS, MAPPED_TENSOR_TYPES
+} MAPPED_TENSOR;
+
+typedef struct{
+    char magic[8];
+    uint32_t version;
+    uint32_t tensors;
+    uint64_t seen;
+    uint64_t size;
+    uint32_t endian;
+    char reserved[28];
+} mapped_header;
+
+typedef struct{
+    int32_t layer;
+    int32_t type;
+    uint64_t offset;
+    uint64_t count;
+    uint64_t reserved;
+} mapped_tensor;
+
+// the layer field holding a tensor and its length, 0 if the layer has none
+static float **mapped_tensor_field(layer *l, MAPPED_TENSOR t, size_t *count)
+{
+    if(l->type == CONVOLUTIONAL || l->type == DECONVOLUTIONAL || l->type == CONNECTED){
+        int n = (l->type == CONNECTED) ? l->outputs : l->n;
+        *count = n;
+        if(t == MAPPED_BIASES) return &l->biases;
+        if(t == MAPPED_WEIGHTS){
+            *count = (l->type == CONNECTED) ? (size_t)l->outputs*l->inputs : (size_t)l->nweights;
+            return &l->weights;
+        }
+        if(!l->batch_normalize) return 0;
+    } else if(l->type == BATCHNORM){
+        *count = l->c;
+        if(t == MAPPED_BIASES || t == MAPPED_WEIGHTS) return 0;
+    } else {
+        return 0;
+    }
+    if(t == MAPPED_SCALES) return &l->scales;
+    if(t == MAPPED_ROLLING_MEAN) return &l->rolling_mean;
+    if(t == MAPPED_ROLLING_VARIANCE) return &l->rolling_variance;
+    return 0;
+}
+
+static int unmappable_layer(layer l)
+{
+    return l.type == LOCAL || l.type == RNN || l.type == GRU || l.type == LSTM || l.type == CRNN;
+}
+
+void save_weights_mapped(network *net, char *filename)
+{
+    int i, t;
+    size_t count = 0;
+    mapped_header header = {{0}};
+    memcpy(header.magic, MAPPED_MAGIC, 8);
+    header.version = MAPPED_VERSION;
+    header.seen = *net->seen;
+    header.endian = 0x01020304;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(unmappable_layer(*l)) error("Mapped weights hold convolutional, connected and batchnorm layers only");
+        if(l->weights_int8 && !l->weights) error("Can't save int8 quantized weights");
+#ifdef GPU
+        if(net->gpu_index >= 0){
+            if(l->type == CONVOLUTIONAL || l->type == DECONVOLUTIONAL) pull_convolutional_layer(*l);
+            if(l->type == CONNECTED) pull_connected_layer(*l);
+            if(l->type == BATCHNORM) pull_batchnorm_layer(*l);
+        }
+#endif
+        for(t = 0; t < MAPPED_TENSOR_TYPES; ++t){
+            if(mapped_tensor_field(l, t, &count)) ++header.tensors;
+        }
+    }
+    mapped_tensor *table = calloc(header.tensors, sizeof(mapped_tensor));
+    size_t offset = sizeof(mapped_header) + header.tensors*sizeof(mapped_tensor);
+    int k = 0;
+    for(i = 0; i < net->n; ++i){
+        for(t = 0; t < MAPPED_TENSOR_TYPES; ++t){
+            if(!mapped_tensor_field(net->layers + i, t, &count)) continue;
+            offset = (offset + MAPPED_ALIGN - 1)/MAPPED_ALIGN*MAPPED_ALIGN;
+            table[k].layer = i;
+            table[k].type = t;
+            table[k].offset = offset;
+            table[k].count = count;
+            offset += count*sizeof(float);
+            ++k;
+        }
+    }
+    header.size = offset;
+
+    fprintf(stderr, "Saving mapped weights to %s\n", filename);
+    FILE *fp = fopen(filename, "wb");
+    if(!fp) file_error(filename);
+    fwrite(&header, sizeof(mapped_header), 1, fp);
+    fwrite(table, sizeof(mapped_tensor), header.tensors, fp);
+    char zeros[MAPPED_ALIGN] = {0};
+    for(k = 0; k < header.tensors; ++k){
+        layer *l = net->layers + table[k].layer;
+        float *data = *mapped_tensor_field(l, table[k].type, &count);
+        float *converted = 0;
+        if(table[k].type == MAPPED_WEIGHTS && l->weights_half){
+            converted = calloc(count, sizeof(float));
+            half_to_float(l->weights_half, count, converted, l->precision);
+            data = converted;
+        }
+        fwrite(zeros, 1, table[k].offset - ftell(fp), fp);
+        fwrite(data, sizeof(float), count, fp);
+        free(converted);
+    }
+    fclose(fp);
+    free(table);
+}
+
+static void finish_mapped_layer(network *net, int i)
+{
+    layer *l = net->layers + i;
+    if(l->type == CONVOLUTIONAL || l->type == DECONVOLUTIONAL){
+        transform_winograd_weights(*l);
+        if(l->winograd) check_winograd_convolutional_layer(l, net->winograd_tolerance);
+        pack_xnor_weights(*l);
+        fold_convolutional_epilogue(*l);
+    }
+#ifdef GPU
+    if(gpu_index >= 0){
+        if(l->type == CONVOLUTIONAL || l->type == DECONVOLUTIONAL) push_convolutional_layer(*l);
+        if(l->type == CONNECTED) push_connected_layer(*l);
+        if(l->type == BATCHNORM) push_batchnorm_layer(*l);
+    }
+#endif
+}
+
+// floats a layer takes up in a .weights file
+static size_t layer_weights_size(layer l)
+{
+    if(l.dontload) return 0;
+    if(l.type == CONVOLUTIONAL || l.type == DECONVOLUTIONAL){
+        size_t n = l.numload ? l.numload : l.n;
+        size_t size = n + n*(l.c/(l.groups ? l.groups : 1))*l.size*l.size;
+        if(l.batch_normalize && !l.dontloadscales) size += 3*n;
+        return size;
+    }
+    if(l.type == CONNECTED){
+        size_t size = l.outputs + (size_t)l.outputs*l.inputs;
+        if(l.batch_normalize && !l.dontloadscales) size += 3*l.outputs;
+        return size;
+    }
+    if(l.type == BATCHNORM) return 3*l.c;
+    if(l.type == CRNN || l.type == RNN){
+        return layer_weights_size(*l.input_layer) + layer_weights_size(*l.self_layer) + layer_weights_size(*l.output_layer);
+    }
+    if(l.type == LSTM){
+        return layer_weights_size(*l.wi) + layer_weights_size(*l.wf) + layer_weights_size(*l.wo) + layer_weights_size(*l.wg)
+            + layer_weights_size(*l.ui) + layer_weights_size(*l.uf) + layer_weights_size(*l.uo) + layer_weights_size(*l.ug);
+    }
+    if(l.type == GRU){
+        return layer_weights_size(*l.wz) + layer_weights_size(*l.wr) + layer_weights_size(*l.wh)
+            + layer_weights_size(*l.uz) + layer_weights_size(*l.ur) + layer_weights_size(*l.uh);
+    }
+    if(l.type == LOCAL) return l.outputs + (size_t)l.size*l.size*l.c*l.n*l.out_w*l.out_h;
+    return 0;
+}
+
+static void load_layer_weights(network *net, int i, weights_file *wf, int transpose)
+{
+    layer l = net->layers[i];
+    if(l.type == CONVOLUTIONAL || l.type == DECONVOLUTIONAL){
+        load_convolutional_weights(l, wf);
+        if(l.winograd) check_winograd_convolutional_layer(net->layers + i, net->winograd_tolerance);
+    }
+    if(l.type == CONNECTED){
+        load_connected_weights(l, wf, transpose);
+    }
+    if(l.type == BATCHNORM){
+        load_batchnorm_weights(l, wf);
+    }
+    if(l.type == CRNN){
+        load_convolutional_weights(*(l.input_layer), wf);
+        load_convolutional_weights(*(l.self_layer), wf);
+        load_convolutional_weights(*(l.output_layer), wf);
+    }
+    if(l.type == RNN){
+        load_connected_weights(*(l.input_layer), wf, transpose);
+        load_connected_weights(*(l.self_layer), wf, transpose);
+        load_connected_weights(*(l.output_layer), wf, transpose);
+    }
+    if (l.type == LSTM) {
+        load_connected_weights(*(l.wi), wf, transpose);
+        load_connected_weights(*(l.wf), wf, transpose);
+        load_connected_weights(*(l.wo), wf, transpose);
+        load_connected_weights(*(l.wg), wf, transpose);
+        load_connected_weights(*(l.ui), wf, transpose);
+        load_connected_weights(*(l.uf), wf, transpose);
+        load_connected_weights(*(l.uo), wf, transpose);
+        load_connected_weights(*(l.ug), wf, transpose);
+    }
+    if (l.type == GRU) {
+        load_connected_weights(*(l.wz), wf, transpose);
+        load_connected_weights(*(l.wr), wf, transpose);
+        load_connected_weights(*(l.wh), wf, transpose);
+        load_connected_weights(*(l.uz), wf, transpose);
+        load_connected_weights(*(l.ur), wf, transpose);
+        load_connected_weights(*(l.uh), wf, transpose);
+    }
+    if(l.type == LOCAL){
+        int locations = l.out_w*l.out_h;
+        int size = l.size*l.size*l.c*l.n*locations;
+        read_weights(l.biases, sizeof(float), l.outputs, wf);
+        read_weights(l.weights, sizeof(float), size, wf);
+#ifdef GPU
+        if(gpu_index >= 0){
+            push_local_layer(l);
+        }
+#endif
+    }
+}
+
+// Inference networks come out of the loader ready to run: weights in the
+// precision the cfg asks for, or packed for the GEMM with batch norm folded
+// in. Packing keeps a second copy of the weights, so by default mapped
+// weights are left alone (prepack=1 packs them too, prepack=0 packs nothing).
+static void prepare_inference_layer(network *net, int i)
+{
+    layer *l = net->layers + i;
+    if(!net->inference || l->type != CONVOLUTIONAL) return;
+    if(net->precision != FP32) set_convolutional_precision(l, net->precision);
+    else if(net->prepack > 0 || (net->prepack < 0 && !l->mapped)) pack_convolutional_weights(l);
+}
+
+typedef struct{
+    int index;
+    size_t offset;
+    size_t size;
+} layer_job;
+
+typedef struct{
+    network *net;
+    char *filename;
+    int fd;
+    int transpose;
+    layer_job *jobs;
+    int n;
+    int next;
+} layer_loader;
+
+static int layer_job_comparator(const void *a, const void *b)
+{
+    size_t x = ((layer_job *)a)->size;
+    size_t y = ((layer_job *)b)->size;
+    return (x < y) - (x > y);
+}
+
+static void load_layer_job(layer_loader *a, layer_job job)
+{
+    weights_file wf = {a->fd, job.offset, a->filename};
+    load_layer_weights(a->net, job.index, &wf, a->transpose);
+}
+
+// Loads layers from a .weights file, or finishes the layers of a mapping
+// when there is no file.
+static void *layer_loader_thread(void *ptr)
+{
+    layer_loader *a = (layer_loader *)ptr;
+    int k;
+    while((k = __sync_fetch_and_add(&a->next, 1)) < a->n){
+        layer_job job = a->jobs[k];
+        if(a->fd < 0) finish_mapped_layer(a->net, job.index);
+        else if(job.size) load_layer_job(a, job);
+        prepare_inference_layer(a->net, job.index);
+    }
+    return 0;
+}
+
+// Layers are handed out largest first so one big layer doesn't finish last.
+// With a GPU everything stays on the calling thread, which owns the context.
+static void run_layer_loader(layer_loader *a)
+{
+    qsort(a->jobs, a->n, sizeof(layer_job), layer_job_comparator);
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+#ifdef GPU
+    if(a->net->gpu_index >= 0) threads = 1;
+#endif
+    if(threads > 16) threads = 16;
+    if(threads > a->n) threads = a->n;
+    if(threads <= 1){
+        layer_loader_thread(a);
+        return;
+    }
+    int t;
+    pthread_t *thr = calloc(threads, sizeof(pthread_t));
+    for(t = 0; t < threads; ++t){
+        if(pthread_create(thr + t, 0, layer_loader_thread, a)) error("Thread creation failed");
+    }
+    for(t = 0; t < threads; ++t){
+        pthread_join(thr[t], 0);
+    }
+    free(thr);
+}
+
+// Layers that load part of their weights (numload, dontloadscales) get a
+// copy, the others point into the mapping.
+static void load_weights_mapped(network *net, char *filename, int start, int cutoff)
+{
+    if(net->weights_map) error("Network already has mapped weights");
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) file_error(filename);
+    struct stat st;
+    fstat(fd, &st);
+    size_t size = st.st_size;
+    char *map = size >= sizeof(mapped_header) ? mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if(map == MAP_FAILED) file_error(filename);
+
+    mapped_header *header = (mapped_header *)map;
+    mapped_tensor *table = (mapped_tensor *)(map + sizeof(mapped_header));
+    if(header->version != MAPPED_VERSION) error("Unsupported mapped weights version");
+    if(header->endian != 0x01020304) error("Mapped weights were written with a different byte order");
+    if(header->size > size || sizeof(mapped_header) + (size_t)header->tensors*sizeof(mapped_tensor) > size){
+        error("Mapped weights file is truncated");
+    }
+    *net->seen = header->seen;
+
+    int *touched = calloc(net->n, sizeof(int));
+    int k, i;
+    for(k = 0; k < header->tensors; ++k){
+        mapped_tensor e = table[k];
+        if(e.layer < start || e.layer >= cutoff) continue;
+        if(e.layer >= net->n || e.type < 0 || e.type >= MAPPED_TENSOR_TYPES) error("Mapped weights don't match the network");
+        layer *l = net->layers + e.layer;
+        if(l->dontload) continue;
+        size_t count = 0;
+        float **field = mapped_tensor_field(l, e.type, &count);
+        if(!field || count != e.count || e.offset % MAPPED_ALIGN || e.offset + count*sizeof(float) > size){
+            error("Mapped weights don't match the network");
+        }
+        float *data = (float *)(map + e.offset);
+        touched[e.layer] = 1;
+        int numload = (l->type == CONVOLUTIONAL || l->type == DECONVOLUTIONAL) ? l->numload : 0;
+        if(numload || l->dontloadscales){
+            if(l->dontloadscales && e.type != MAPPED_BIASES && e.type != MAPPED_WEIGHTS) continue;
+            if(numload) count = count/l->n*numload;
+            memcpy(*field, data, count*sizeof(float));
+            continue;
+        }
+        free(*field);
+        *field = data;
+        l->mapped = 1;
+    }
+    layer_loader a = {0};
+    a.net = net;
+    a.fd = -1;
+    a.jobs = calloc(net->n, sizeof(layer_job));
+    for(i = 0; i < net->n; ++i){
+        if(!touched[i]) continue;
+        a.jobs[a.n].index = i;
+        a.jobs[a.n].size = layer_weights_size(net->layers[i]);
+        ++a.n;
+    }
+    run_layer_loader(&a);
+    free(a.jobs);
+    free(touched);
+    net->weights_map = map;
+    net->weights_map_size = size;
+}
+
+static int is_mapped_weights(FILE *fp)
+{
+    char magic[8];
+    int mapped = fread(magic, 1, 8, fp) == 8 && memcmp(magic, MAPPED_MAGIC, 8) == 0;
+    rewind(fp);
+    return mapped;
+}
+
 void load_weights_upto(network *net, char *filename, int start, int cutoff)
 {
 #ifdef GPU
@@ -1226,6 +1825,12 @@ void load_weights_upto(network *net, char *filename, int start, int cutoff)
     fflush(stdout);
     FILE *fp = fopen(filename, "rb");
     if(!fp) file_error(filename);
+    if(is_mapped_weights(fp)){
+        fclose(fp);
+        load_weights_mapped(net, filename, start, cutoff);
+        fprintf(stderr, "Done!\n");
+        return;
+    }
 
     int major;
     int minor;
@@ -1243,66 +1848,27 @@ void load_weights_upto(network *net, char *filename, int start, int cutoff)
     int transpose = (major > 1000) || (minor > 1000);
 
     int i;
+    size_t offset = ftell(fp);
+    layer_loader a = {0};
+    a.net = net;
+    a.filename = filename;
+    a.transpose = transpose;
+    a.jobs = calloc(net->n, sizeof(layer_job));
     for(i = start; i < net->n && i < cutoff; ++i){
-        layer l = net->layers[i];
-        if (l.dontload) continue;
-        if(l.type == CONVOLUTIONAL || l.type == DECONVOLUTIONAL){
-            load_convolutional_weights(l, fp);
-        }
-        if(l.type == CONNECTED){
-            load_connected_weights(l, fp, transpose);
-        }
-        if(l.type == BATCHNORM){
-            load_batchnorm_weights(l, fp);
-        }
-        if(l.type == CRNN){
-            load_convolutional_weights(*(l.input_layer), fp);
-            load_convolutional_weights(*(l.self_layer), fp);
-            load_convolutional_weights(*(l.output_layer), fp);
-        }
-        if(l.type == RNN){
-            load_connected_weights(*(l.input_layer), fp, transpose);
-            load_connected_weights(*(l.self_layer), fp, transpose);
-            load_connected_weights(*(l.output_layer), fp, transpose);
-        }
-        if (l.type == LSTM) {
-            load_connected_weights(*(l.wi), fp, transpose);
-            load_connected_weights(*(l.wf), fp, transpose);
-            load_connected_weights(*(l.wo), fp, transpose);
-            load_connected_weights(*(l.wg), fp, transpose);
-            load_connected_weights(*(l.ui), fp, transpose);
-            load_connected_weights(*(l.uf), fp, transpose);
-            load_connected_weights(*(l.uo), fp, transpose);
-            load_connected_weights(*(l.ug), fp, transpose);
-        }
-        if (l.type == GRU) {
-            if(1){
-                load_connected_weights(*(l.wz), fp, transpose);
-                load_connected_weights(*(l.wr), fp, transpose);
-                load_connected_weights(*(l.wh), fp, transpose);
-                load_connected_weights(*(l.uz), fp, transpose);
-                load_connected_weights(*(l.ur), fp, transpose);
-                load_connected_weights(*(l.uh), fp, transpose);
-            }else{
-                load_connected_weights(*(l.reset_layer), fp, transpose);
-                load_connected_weights(*(l.update_layer), fp, transpose);
-                load_connected_weights(*(l.state_layer), fp, transpose);
-            }
-        }
-        if(l.type == LOCAL){
-            int locations = l.out_w*l.out_h;
-            int size = l.size*l.size*l.c*l.n*locations;
-            fread(l.biases, sizeof(float), l.outputs, fp);
-            fread(l.weights, sizeof(float), size, fp);
-#ifdef GPU
-            if(gpu_index >= 0){
-                push_local_layer(l);
-            }
-#endif
-        }
+        if(net->layers[i].dontload) continue;
+        a.jobs[a.n].index = i;
+        a.jobs[a.n].offset = offset;
+        a.jobs[a.n].size = layer_weights_size(net->layers[i]);
+        offset += a.jobs[a.n].size*sizeof(float);
+        ++a.n;
     }
-    fprintf(stderr, "Done!\n");
     fclose(fp);
+    a.fd = open(filename, O_RDONLY);
+    if(a.fd < 0) file_error(filename);
+    run_layer_loader(&a);
+    close(a.fd);
+    free(a.jobs);
+    fprintf(stderr, "Done!\n");
 }
 
 void load_weights(network *net, char *filename)
@@ -0,0 +1,578 @@
+#include "quantize.h"
+#include "convolutional_layer.h"
+#include "utils.h"
+#include "parallel.h"
+
+#include <math.h>
+#include <pthread.h>
+
+// Post-training int8 inference. Weights are quantized symmetrically per
+// output channel, layer inputs symmetrically per tensor with the scale
+// found by calibration. The GEMM multiplies int8 weights with inputs
+// shifted to uint8 (x + 128) so it maps onto u8 x s8 dot products, and
+// subtracts 128*sum(weights) per row when dequantizing. Layers still
+// exchange float tensors; each int8 layer requantizes its input while
+// packing it.
+
+#define INT8_MC 96
+#define INT8_KQ 256
+#define INT8_NC 3072
+#define INT8_MAX_MR 8
+#define INT8_MAX_NR 32
+#define INT8_ALIGN 64
+
+typedef void (*gemm_int8_kernel_fn)(int kq, const int8_t *a, const uint8_t *b, float *c, int ldc);
+
+typedef struct{
+    char *name;
+    int mr;
+    int nr;
+    int wmax;
+    gemm_int8_kernel_fn kernel;
+    int (*supported)();
+} gemm_int8_kernel;
+
+static int int8_always_supported(){return 1;}
+
+// a holds mr rows and b nr columns of 4 consecutive k per step
+static void gemm_int8_kernel_generic(int kq, const int8_t *a, const uint8_t *b, float *c, int ldc)
+{
+    int32_t acc[4][8] = {{0}};
+    int p, i, j;
+    for(p = 0; p < kq; ++p){
+        for(i = 0; i < 4; ++i){
+            for(j = 0; j < 8; ++j){
+                acc[i][j] += a[i*4 + 0]*b[j*4 + 0] + a[i*4 + 1]*b[j*4 + 1]
+                           + a[i*4 + 2]*b[j*4 + 2] + a[i*4 + 3]*b[j*4 + 3];
+            }
+        }
+        a += 16;
+        b += 32;
+    }
+    for(i = 0; i < 4; ++i){
+        for(j = 0; j < 8; ++j){
+            c[i*ldc + j] += acc[i][j];
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+static int int8_avx512vnni_supported()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vnni");
+}
+
+static int int8_avx2_supported()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+// vpmaddubsw adds two u8 x s8 products into a saturating int16, so weights
+// are limited to 7 bits for this kernel: 2*255*63 still fits.
+#define AVX2_INT8_ROW(r) \
+    memcpy(&w, a + 4*r, 4); \
+    a0 = _mm256_set1_epi32(w); \
+    c##r##0 = _mm256_add_epi32(c##r##0, _mm256_madd_epi16(_mm256_maddubs_epi16(b0, a0), ones)); \
+    c##r##1 = _mm256_add_epi32(c##r##1, _mm256_madd_epi16(_mm256_maddubs_epi16(b1, a0), ones));
+
+#define AVX2_INT8_STORE(r) \
+    _mm256_storeu_ps(c + r*ldc,     _mm256_add_ps(_mm256_loadu_ps(c + r*ldc),     _mm256_cvtepi32_ps(c##r##0))); \
+    _mm256_storeu_ps(c + r*ldc + 8, _mm256_add_ps(_mm256_loadu_ps(c + r*ldc + 8), _mm256_cvtepi32_ps(c##r##1)));
+
+__attribute__((target("avx2")))
+static void gemm_int8_kernel_avx2(int kq, const int8_t *a, const uint8_t *b, float *c, int ldc)
+{
+    __m256i c00 = _mm256_setzero_si256(), c01 = _mm256_setzero_si256();
+    __m256i c10 = _mm256_setzero_si256(), c11 = _mm256_setzero_si256();
+    __m256i c20 = _mm256_setzero_si256(), c21 = _mm256_setzero_si256();
+    __m256i c30 = _mm256_setzero_si256(), c31 = _mm256_setzero_si256();
+    __m256i ones = _mm256_set1_epi16(1);
+    __m256i a0, b0, b1;
+    int32_t w;
+    int p;
+    for(p = 0; p < kq; ++p){
+        b0 = _mm256_load_si256((const __m256i *)b);
+        b1 = _mm256_load_si256((const __m256i *)(b + 32));
+        AVX2_INT8_ROW(0) AVX2_INT8_ROW(1) AVX2_INT8_ROW(2) AVX2_INT8_ROW(3)
+        a += 16;
+        b += 64;
+    }
+    AVX2_INT8_STORE(0) AVX2_INT8_STORE(1) AVX2_INT8_STORE(2) AVX2_INT8_STORE(3)
+}
+
+#define VNNI_ROW(r) \
+    memcpy(&w, a + 4*r, 4); \
+    a0 = _mm512_set1_epi32(w); \
+    c##r##0 = _mm512_dpbusd_epi32(c##r##0, b0, a0); \
+    c##r##1 = _mm512_dpbusd_epi32(c##r##1, b1, a0);
+
+#define VNNI_STORE(r) \
+    _mm512_storeu_ps(c + r*ldc,      _mm512_add_ps(_mm512_loadu_ps(c + r*ldc),      _mm512_cvtepi32_ps(c##r##0))); \
+    _mm512_storeu_ps(c + r*ldc + 16, _mm512_add_ps(_mm512_loadu_ps(c + r*ldc + 16), _mm512_cvtepi32_ps(c##r##1)));
+
+__attribute__((target("avx512f,avx512vnni")))
+static void gemm_int8_kernel_avx512vnni(int kq, const int8_t *a, const uint8_t *b, float *c, int ldc)
+{
+    __m512i c00 = _mm512_setzero_si512(), c01 = _mm512_setzero_si512();
+    __m512i c10 = _mm512_setzero_si512(), c11 = _mm512_setzero_si512();
+    __m512i c20 = _mm512_setzero_si512(), c21 = _mm512_setzero_si512();
+    __m512i c30 = _mm512_setzero_si512(), c31 = _mm512_setzero_si512();
+    __m512i c40 = _mm512_setzero_si512(), c41 = _mm512_setzero_si512();
+    __m512i c50 = _mm512_setzero_si512(), c51 = _mm512_setzero_si512();
+    __m512i c60 = _mm512_setzero_si512(), c61 = _mm512_setzero_si512();
+    __m512i c70 = _mm512_setzero_si512(), c71 = _mm512_setzero_si512();
+    __m512i a0, b0, b1;
+    int32_t w;
+    int p;
+    for(p = 0; p < kq; ++p){
+        b0 = _mm512_load_si512(b);
+        b1 = _mm512_load_si512(b + 64);
+        VNNI_ROW(0) VNNI_ROW(1) VNNI_ROW(2) VNNI_ROW(3)
+        VNNI_ROW(4) VNNI_ROW(5) VNNI_ROW(6) VNNI_ROW(7)
+        a += 32;
+        b += 128;
+    }
+    VNNI_STORE(0) VNNI_STORE(1) VNNI_STORE(2) VNNI_STORE(3)
+    VNNI_STORE(4) VNNI_STORE(5) VNNI_STORE(6) VNNI_STORE(7)
+}
+#endif
+
+static gemm_int8_kernel gemm_int8_kernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+    {"avx512vnni", 8, 32, 127, gemm_int8_kernel_avx512vnni, int8_avx512vnni_supported},
+    {"avx2", 4, 16, 63, gemm_int8_kernel_avx2, int8_avx2_supported},
+#endif
+    {"generic", 4, 8, 127, gemm_int8_kernel_generic, int8_always_supported},
+};
+
+static gemm_int8_kernel *gemm_int8_selected = 0;
+static pthread_once_t gemm_int8_select_once = PTHREAD_ONCE_INIT;
+
+static void gemm_int8_select_kernel()
+{
+    int i;
+    int n = sizeof(gemm_int8_kernels)/sizeof(gemm_int8_kernels[0]);
+    char *force = getenv("DARKNET_GEMM_INT8");
+    for(i = 0; i < n; ++i){
+        if(!gemm_int8_kernels[i].supported()) continue;
+        if(force && strcmp(force, gemm_int8_kernels[i].name) != 0) continue;
+        gemm_int8_selected = gemm_int8_kernels + i;
+        return;
+    }
+    if(force) fprintf(stderr, "Int8 GEMM kernel %s not available, using generic\n", force);
+    gemm_int8_selected = gemm_int8_kernels + n - 1;
+}
+
+static gemm_int8_kernel *get_gemm_int8_kernel()
+{
+    pthread_once(&gemm_int8_select_once, gemm_int8_select_kernel);
+    return gemm_int8_selected;
+}
+
+char *gemm_int8_kernel_name()
+{
+    return get_gemm_int8_kernel()->name;
+}
+
+void quantize_weights_int8(float *weights, int n, int size, int8_t *q, float *scales, int *sums)
+{
+    int wmax = get_gemm_int8_kernel()->wmax;
+    int i, j;
+    for(i = 0; i < n; ++i){
+        float *w = weights + (size_t)i*size;
+        float max = 0;
+        for(j = 0; j < size; ++j){
+            if(fabs(w[j]) > max) max = fabs(w[j]);
+        }
+        scales[i] = (max > 0) ? max/wmax : 1;
+        sums[i] = 0;
+        for(j = 0; j < size; ++j){
+            int v = (int)roundf(w[j]/scales[i]);
+            v = constrain_int(v, -wmax, wmax);
+            q[(size_t)i*size + j] = v;
+            sums[i] += v;
+        }
+    }
+}
+
+size_t packed_weights_int8_size(int M, int K)
+{
+    int mr = get_gemm_int8_kernel()->mr;
+    return (size_t)(M + mr - 1)/mr*mr*((K + 3)/4)*4;
+}
+
+// Weights are packed once, at quantization time, into panels of mr rows
+// holding all of K in steps of 4 consecutive k.
+void pack_weights_int8(int M, int K, int8_t *A, int lda, int8_t *packed)
+{
+    int mr = get_gemm_int8_kernel()->mr;
+    int KQ = (K + 3)/4;
+    int i, p, ii, q;
+    for(i = 0; i < M; i += mr){
+        for(p = 0; p < KQ; ++p){
+            for(ii = 0; ii < mr; ++ii){
+                for(q = 0; q < 4; ++q){
+                    int k = p*4 + q;
+                    *packed++ = (i + ii < M && k < K) ? A[(size_t)(i + ii)*lda + k] : 0;
+                }
+            }
+        }
+    }
+}
+
+static inline uint8_t quantize_u8(float x, float inv_scale)
+{
+    float v = x*inv_scale;
+    v = (v > 127) ? 127 : ((v < -127) ? -127 : v);
+    return (uint8_t)(int)(v + 128.5f);
+}
+
+// Where B comes from: an image (quantized once, 128 is zero) read through
+// im2col, or a float matrix stored transposed (element k, j at B[j*ldb + k]).
+typedef struct{
+    uint8_t *im;
+    int channels, height, width;
+    int ksize, stride, pad;
+    int out_w;
+    float *B;
+    int ldb;
+    float inv_scale;
+} int8_source;
+
+static void int8_source_row(int8_source *s, int K, int row, int col, int cols, uint8_t *dst)
+{
+    int j, x;
+    if(row >= K){
+        memset(dst, 128, cols);
+        return;
+    }
+    if(s->B){
+        float *src = s->B + (size_t)col*s->ldb + row;
+        for(j = 0; j < cols; ++j) dst[j] = quantize_u8(src[(size_t)j*s->ldb], s->inv_scale);
+        return;
+    }
+    int ks = s->ksize;
+    int kw = row % ks;
+    int kh = (row / ks) % ks;
+    int c = row / ks / ks;
+    uint8_t *im = s->im + (size_t)c*s->height*s->width;
+    int oh = col / s->out_w;
+    int ow = col % s->out_w;
+    for(j = 0; j < cols; ){
+        int run = (s->out_w - ow < cols - j) ? s->out_w - ow : cols - j;
+        int ih = oh*s->stride - s->pad + kh;
+        if(ih < 0 || ih >= s->height){
+            memset(dst + j, 128, run);
+        } else {
+            uint8_t *src = im + ih*s->width;
+            int iw = ow*s->stride - s->pad + kw;
+            if(s->stride == 1 && iw >= 0 && iw + run <= s->width){
+                memcpy(dst + j, src + iw, run);
+            } else {
+                for(x = 0; x < run; ++x, iw += s->stride){
+                    dst[j + x] = (iw >= 0 && iw < s->width) ? src[iw] : 128;
+                }
+            }
+        }
+        j += run;
+        ow = 0;
+        ++oh;
+    }
+}
+
+static void pack_b_int8(int8_source *s, int K, int pq, int kq, int jc, int nc, int nr, uint8_t *pb)
+{
+    uint8_t rows[4][INT8_MAX_NR];
+    int j, p, q, jj;
+    for(j = 0; j < nc; j += nr){
+        int jb = (nc - j < nr) ? nc - j : nr;
+        for(p = 0; p < kq; ++p){
+            for(q = 0; q < 4; ++q){
+                int8_source_row(s, K, (pq + p)*4 + q, jc + j, jb, rows[q]);
+                memset(rows[q] + jb, 128, nr - jb);
+            }
+            for(jj = 0; jj < nr; ++jj){
+                pb[jj*4 + 0] = rows[0][jj];
+                pb[jj*4 + 1] = rows[1][jj];
+                pb[jj*4 + 2] = rows[2][jj];
+                pb[jj*4 + 3] = rows[3][jj];
+            }
+            pb += 4*nr;
+        }
+    }
+}
+
+typedef struct{
+    float *row_scales;
+    int *row_sums;
+    float scale;
+    gemm_epilogue *e;
+} int8_dequantize;
+
+static void dequantize_tile(int8_dequantize *d, int row, int rows, int cols, float *C, int ldc)
+{
+    int i, j;
+    for(i = 0; i < rows; ++i){
+        float s = d->row_scales[row + i]*d->scale;
+        float offset = 128.f*d->row_sums[row + i];
+        float *c = C + i*ldc;
+        for(j = 0; j < cols; ++j) c[j] = (c[j] - offset)*s;
+    }
+    if(d->e) apply_gemm_epilogue(d->e, row, rows, cols, C, ldc);
+}
+
+// pa points at quad pq of the first panel, panels are lda bytes apart
+static void gemm_int8_macro_kernel(gemm_int8_kernel *k, int mc, int nc, int kq, int8_t *pa, size_t lda, uint8_t *pb, float *C, int ldc, int8_dequantize *d, int row)
+{
+    int mr = k->mr;
+    int nr = k->nr;
+    int jr;
+    #pragma omp parallel for
+    for(jr = 0; jr < nc; jr += nr){
+        float tmp[INT8_MAX_MR*INT8_MAX_NR] __attribute__((aligned(INT8_ALIGN)));
+        int jb = (nc - jr < nr) ? nc - jr : nr;
+        int ir, i, j;
+        for(ir = 0; ir < mc; ir += mr){
+            int ib = (mc - ir < mr) ? mc - ir : mr;
+            float *c = C + ir*ldc + jr;
+            int8_t *a = pa + (ir/mr)*lda;
+            if(ib == mr && jb == nr){
+                k->kernel(kq, a, pb + jr*kq*4, c, ldc);
+            } else {
+                memset(tmp, 0, mr*nr*sizeof(float));
+                k->kernel(kq, a, pb + jr*kq*4, tmp, nr);
+                for(i = 0; i < ib; ++i){
+                    for(j = 0; j < jb; ++j){
+                        c[i*ldc + j] += tmp[i*nr + j];
+                    }
+                }
+            }
+            if(d) dequantize_tile(d, row + ir, ib, jb, c, ldc);
+        }
+    }
+}
+
+static size_t int8_round(size_t size)
+{
+    return (size + INT8_ALIGN - 1)/INT8_ALIGN*INT8_ALIGN;
+}
+
+static uint8_t *int8_align(void *ptr)
+{
+    return (uint8_t *)int8_round((uintptr_t)ptr);
+}
+
+static size_t packed_b_int8_size(int N, int K)
+{
+    int nr = get_gemm_int8_kernel()->nr;
+    int KQ = (K + 3)/4;
+    int ncmax = (N < INT8_NC) ? ((N + nr - 1)/nr)*nr : INT8_NC;
+    int kqmax = (KQ < INT8_KQ) ? KQ : INT8_KQ;
+    return (size_t)ncmax*kqmax*4;
+}
+
+// Scratch for one int8 GEMM, taken from the network workspace: the
+// quantized image (im_size bytes, 0 for gemm_int8_nt_cpu) and the packed B
+// panels, both aligned for the kernels.
+size_t gemm_int8_workspace_size(int N, int K, size_t im_size)
+{
+    return INT8_ALIGN + int8_round(im_size) + packed_b_int8_size(N, K);
+}
+
+static void gemm_int8_packed(int M, int N, int K, int8_t *A, int8_source *s, int8_dequantize *d, float *C, int ldc, uint8_t *pb)
+{
+    int i;
+    for(i = 0; i < M; ++i) memset(C + (size_t)i*ldc, 0, N*sizeof(float));
+    if(M <= 0 || N <= 0) return;
+
+    gemm_int8_kernel *k = get_gemm_int8_kernel();
+    int mr = k->mr;
+    int nr = k->nr;
+    int KQ = (K + 3)/4;
+    size_t lda = (size_t)KQ*mr*4;
+    int mcmax = (INT8_MC/mr)*mr;
+    int ncmax = (N < INT8_NC) ? ((N + nr - 1)/nr)*nr : INT8_NC;
+    int kqmax = (KQ < INT8_KQ) ? KQ : INT8_KQ;
+
+    int jc, pq, ic;
+    for(jc = 0; jc < N; jc += ncmax){
+        int nc = (N - jc < ncmax) ? N - jc : ncmax;
+        for(pq = 0; pq < KQ; pq += kqmax){
+            int kq = (KQ - pq < kqmax) ? KQ - pq : kqmax;
+            pack_b_int8(s, K, pq, kq, jc, nc, nr, pb);
+            for(ic = 0; ic < M; ic += mcmax){
+                int mc = (M - ic < mcmax) ? M - ic : mcmax;
+                int8_t *pa = A + (ic/mr)*lda + (size_t)pq*mr*4;
+                gemm_int8_macro_kernel(k, mc, nc, kq, pa, lda, pb, C + ic*ldc + jc, ldc, (pq + kq == KQ) ? d : 0, ic);
+            }
+        }
+    }
+}
+
+void gemm_int8_im2col_cpu(int M, int N, int K,
+        int8_t *A, float *row_scales, int *row_sums,
+        float *im, float scale, int channels, int height, int width,
+        int ksize, int stride, int pad,
+        float *C, int ldc, gemm_epilogue *e, void *workspace)
+{
+    int i;
+    int size = channels*height*width;
+    float inv_scale = 1./scale;
+    uint8_t *qim = int8_align(workspace);
+    for(i = 0; i < size; ++i) qim[i] = quantize_u8(im[i], inv_scale);
+    int8_source s = {0};
+    s.im = qim;
+    s.channels = channels;
+    s.height = height;
+    s.width = width;
+    s.ksize = ksize;
+    s.stride = stride;
+    s.pad = pad;
+    s.out_w = (width + 2*pad - ksize) / stride + 1;
+    int8_dequantize d = {row_scales, row_sums, scale, e};
+    gemm_int8_packed(M, N, K, A, &s, &d, C, ldc, qim + int8_round(size));
+}
+
+void gemm_int8_nt_cpu(int M, int N, int K,
+        int8_t *A, float *row_scales, int *row_sums,
+        float *B, int ldb, float scale,
+        float *C, int ldc, gemm_epilogue *e, void *workspace)
+{
+    int8_source s = {0};
+    s.B = B;
+    s.ldb = ldb;
+    s.inv_scale = 1./scale;
+    int8_dequantize d = {row_scales, row_sums, scale, e};
+    gemm_int8_packed(M, N, K, A, &s, &d, C, ldc, int8_align(workspace));
+}
+
+// Ranges are taken from each layer's input as the forward pass reaches it,
+// since a planned network reuses those buffers further on.
+void calibrate_network(network *net, float *input, float *maxes)
+{
+    int i, j;
+#ifdef GPU
+    if(net->gpu_index >= 0) error("Calibration is CPU only");
+#endif
+    network state = *net;
+    state.input = input;
+    state.truth = 0;
+    state.train = 0;
+    state.delta = 0;
+    thread_pool *prev = set_thread_pool(state.pool);
+    for(i = 0; i < state.n; ++i){
+        state.index = i;
+        layer l = state.layers[i];
+        if(l.type == CONVOLUTIONAL || l.type == CONNECTED){
+            int size = l.inputs*l.batch;
+            float max = 0;
+            for(j = 0; j < size; ++j){
+                if(fabs(state.input[j]) > max) max = fabs(state.input[j]);
+            }
+            maxes[i] += max;
+        }
+        l.forward(l, state);
+        state.input = l.output;
+    }
+    set_thread_pool(prev);
+}
+
+void save_calibration(network *net, float *maxes, int n, char *filename)
+{
+    FILE *fp = fopen(filename, "w");
+    if(!fp) file_error(filename);
+    int i;
+    fprintf(fp, "# layer input_max, averaged over %d images\n", n);
+    for(i = 0; i < net->n; ++i){
+        if(maxes[i] > 0) fprintf(fp, "%d %f\n", i, maxes[i]/n);
+    }
+    fclose(fp);
+}
+
+static int is_detection_head(layer l)
+{
+    return l.type == YOLO || l.type == REGION || l.type == DETECTION;
+}
+
+static size_t quantize_layer(layer *l, float input_max)
+{
+    int n = (l->type == CONNECTED) ? l->outputs : l->n;
+    int groups = (l->type == CONNECTED) ? 1 : l->groups;
+    int size = (l->type == CONNECTED) ? l->inputs : l->c/l->groups*l->size*l->size;
+    int m = n/groups;
+    int j;
+    int8_t *q = calloc((size_t)n*size, sizeof(int8_t));
+    l->weight_scales = calloc(n, sizeof(float));
+    l->weight_sums = calloc(n, sizeof(int));
+    quantize_weights_int8(l->weights, n, size, q, l->weight_scales, l->weight_sums);
+    l->weights_int8 = calloc(groups*packed_weights_int8_size(m, size), sizeof(int8_t));
+    for(j = 0; j < groups; ++j){
+        pack_weights_int8(m, size, q + (size_t)j*m*size, size, l->weights_int8 + j*packed_weights_int8_size(m, size));
+    }
+    free(q);
+    l->input_scale = input_max/127;
+    if(l->type == CONVOLUTIONAL){
+        // also sizes the workspace for the int8 path
+        set_winograd_convolutional_layer(l, 0);
+        free_packed_convolutional_weights(l);
+    } else {
+        l->workspace_size = l->outputs*l->batch*sizeof(float) + gemm_int8_workspace_size(l->batch, l->inputs, 0);
+    }
+    if(!l->mapped) free(l->weights);
+    l->weights = 0;
+    return (size_t)n*size;
+}
+
+void quantize_network(network *net, char *filename)
+{
+#ifdef GPU
+    if(net->gpu_index >= 0){
+        fprintf(stderr, "Int8 inference is CPU only, keeping float weights\n");
+        return;
+    }
+#endif
+    // the scalar kernel is several times slower than the float GEMM
+    if(get_gemm_int8_kernel()->kernel == gemm_int8_kernel_generic && !getenv("DARKNET_GEMM_INT8")){
+        fprintf(stderr, "No SIMD int8 GEMM kernel for this CPU, keeping float weights (DARKNET_GEMM_INT8=generic forces it)\n");
+        return;
+    }
+    FILE *fp = fopen(filename, "r");
+    if(!fp) file_error(filename);
+    float *maxes = calloc(net->n, sizeof(float));
+    char *line;
+    while((line = fgetl(fp))){
+        int i;
+        float max;
+        if(line[0] != '#' && sscanf(line, "%d %f", &i, &max) == 2 && i >= 0 && i < net->n) maxes[i] = max;
+        free(line);
+    }
+    fclose(fp);
+
+    // quantize from the float weights
+    set_network_precision(net, FP32);
+    int i;
+    int count = 0;
+    size_t weights = 0;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(l->type != CONVOLUTIONAL && l->type != CONNECTED) continue;
+        if(maxes[i] <= 0 || l->binary || l->xnor || !l->weights) continue;
+        // Keep the layers feeding YOLO/region heads in float
+        if(i + 1 < net->n && is_detection_head(net->layers[i+1])) continue;
+        weights += quantize_layer(l, maxes[i]);
+        if(l->workspace_size > net->workspace_size){
+            free(net->workspace);
+            net->workspace = calloc(1, l->workspace_size);
+            net->workspace_size = l->workspace_size;
+        }
+        ++count;
+    }
+    free(maxes);
+    set_network_precision(net, net->precision);
+    fprintf(stderr, "Quantized %d layers to int8 (%s), weights %.1f MB -> %.1f MB\n",
+            count, gemm_int8_kernel_name(), weights*4/1e6, weights/1e6);
+}
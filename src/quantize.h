@@ -0,0 +1,25 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+#include <stdint.h>
+#include "darknet.h"
+#include "gemm.h"
+
+void quantize_weights_int8(float *weights, int n, int size, int8_t *q, float *scales, int *sums);
+size_t packed_weights_int8_size(int M, int K);
+void pack_weights_int8(int M, int K, int8_t *A, int lda, int8_t *packed);
+
+void gemm_int8_im2col_cpu(int M, int N, int K,
+        int8_t *A, float *row_scales, int *row_sums,
+        float *im, float scale, int channels, int height, int width,
+        int ksize, int stride, int pad,
+        float *C, int ldc, gemm_epilogue *e, void *workspace);
+
+void gemm_int8_nt_cpu(int M, int N, int K,
+        int8_t *A, float *row_scales, int *row_sums,
+        float *B, int ldb, float scale,
+        float *C, int ldc, gemm_epilogue *e, void *workspace);
+size_t gemm_int8_workspace_size(int N, int K, size_t im_size);
+
+char *gemm_int8_kernel_name();
+
+#endif
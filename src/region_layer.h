@@ -5,10 +5,11 @@
 #include "layer.h"
 #include "network.h"
 
-layer make_region_layer(int batch, int w, int h, int n, int classes, int coords);
+layer make_region_layer(int batch, int w, int h, int n, int classes, int coords, int inference);
 void forward_region_layer(const layer l, network net);
 void backward_region_layer(const layer l, network net);
 void resize_region_layer(layer *l, int w, int h);
+void avg_flipped_region(layer l);
 
 #ifdef GPU
 void forward_region_layer_gpu(const layer l, network net);
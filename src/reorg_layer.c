@@ -5,7 +5,7 @@
 #include <stdio.h>
 
 
-layer make_reorg_layer(int batch, int w, int h, int c, int stride, int reverse, int flatten, int extra)
+layer make_reorg_layer(int batch, int w, int h, int c, int stride, int reverse, int flatten, int extra, int inference)
 {
     layer l = {0};
     l.type = REORG;
@@ -41,7 +41,7 @@ layer make_reorg_layer(int batch, int w, int h, int c, int stride, int reverse,
     }
     int output_size = l.outputs * batch;
     l.output =  calloc(output_size, sizeof(float));
-    l.delta =   calloc(output_size, sizeof(float));
+    if(!inference) l.delta =   calloc(output_size, sizeof(float));
 
     l.forward = forward_reorg_layer;
     l.backward = backward_reorg_layer;
@@ -78,7 +78,7 @@ void resize_reorg_layer(layer *l, int w, int h)
     int output_size = l->outputs * l->batch;
 
     l->output = realloc(l->output, output_size * sizeof(float));
-    l->delta = realloc(l->delta, output_size * sizeof(float));
+    if(l->delta) l->delta = realloc(l->delta, output_size * sizeof(float));
 
 #ifdef GPU
     cuda_free(l->output_gpu);
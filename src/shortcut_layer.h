@@ -4,7 +4,7 @@
 #include "layer.h"
 #include "network.h"
 
-layer make_shortcut_layer(int batch, int index, int w, int h, int c, int w2, int h2, int c2);
+layer make_shortcut_layer(int batch, int index, int w, int h, int c, int w2, int h2, int c2, int inference);
 void forward_shortcut_layer(const layer l, network net);
 void backward_shortcut_layer(const layer l, network net);
 void resize_shortcut_layer(layer *l, int w, int h);
@@ -6,7 +6,7 @@
 typedef layer softmax_layer;
 
 void softmax_array(float *input, int n, float temp, float *output);
-softmax_layer make_softmax_layer(int batch, int inputs, int groups);
+softmax_layer make_softmax_layer(int batch, int inputs, int groups, int inference);
 void forward_softmax_layer(const softmax_layer l, network net);
 void backward_softmax_layer(const softmax_layer l, network net);
 
@@ -0,0 +1,214 @@
+#include "winograd.h"
+#include "gemm.h"
+#include <string.h>
+
+// Winograd F(m x m, 3 x 3) convolution for 3x3, stride 1 layers.
+// Each t x t input tile (t = m + 2) is transformed to V = B'dB, every one of
+// the t*t tile positions becomes an independent (n x c) * (c x tiles) GEMM
+// against the pre-transformed filters U = GgG', and the result goes back
+// through Y = A'MA. Tile transforms work on WINOGRAD_LANES tiles at a time
+// so the inner loops vectorize.
+
+#define WINOGRAD_LANES 16
+#define WINOGRAD_TILE_BLOCK 256
+
+static const float G2[] = {
+    1,   0,  0,
+    .5, .5, .5,
+    .5,-.5, .5,
+    0,   0,  1
+};
+
+static const float G4[] = {
+    1./4,      0,     0,
+    -1./6, -1./6, -1./6,
+    -1./6,  1./6, -1./6,
+    1./24, 1./12,  1./6,
+    1./24,-1./12,  1./6,
+    0,         0,     1
+};
+
+static int winograd_tiles(int m, int size)
+{
+    return (size + m - 1)/m;
+}
+
+static int winograd_tile_block(int m, int out_h, int out_w)
+{
+    int p = winograd_tiles(m, out_h)*winograd_tiles(m, out_w);
+    p = (p + WINOGRAD_LANES - 1)/WINOGRAD_LANES*WINOGRAD_LANES;
+    return (p < WINOGRAD_TILE_BLOCK) ? p : WINOGRAD_TILE_BLOCK;
+}
+
+size_t winograd_workspace_size(int m, int n, int c, int out_h, int out_w)
+{
+    int t = m + 2;
+    return (size_t)t*t*(n + c)*winograd_tile_block(m, out_h, out_w)*sizeof(float);
+}
+
+// 1D transforms over WINOGRAD_LANES tiles at once, element i of the
+// input at x + i*xs and element i of the output at y + i*ys.
+#define LANES_LOOP for(q = 0; q < WINOGRAD_LANES; ++q)
+
+static void winograd_input_1d(int m, const float *x, int xs, float *y, int ys)
+{
+    int q;
+    if(m == 2){
+        LANES_LOOP{
+            float d0 = x[q], d1 = x[xs + q], d2 = x[2*xs + q], d3 = x[3*xs + q];
+            y[q]        = d0 - d2;
+            y[ys + q]   = d1 + d2;
+            y[2*ys + q] = d2 - d1;
+            y[3*ys + q] = d1 - d3;
+        }
+    } else {
+        LANES_LOOP{
+            float d0 = x[q], d1 = x[xs + q], d2 = x[2*xs + q];
+            float d3 = x[3*xs + q], d4 = x[4*xs + q], d5 = x[5*xs + q];
+            y[q]        = 4*d0 - 5*d2 + d4;
+            y[ys + q]   = d3 + d4 - 4*(d1 + d2);
+            y[2*ys + q] = d4 - d3 + 4*(d1 - d2);
+            y[3*ys + q] = d4 - d2 + 2*(d3 - d1);
+            y[4*ys + q] = d4 - d2 + 2*(d1 - d3);
+            y[5*ys + q] = 4*d1 - 5*d3 + d5;
+        }
+    }
+}
+
+static void winograd_output_1d(int m, const float *x, int xs, float *y, int ys)
+{
+    int q;
+    if(m == 2){
+        LANES_LOOP{
+            float m0 = x[q], m1 = x[xs + q], m2 = x[2*xs + q], m3 = x[3*xs + q];
+            y[q]      = m0 + m1 + m2;
+            y[ys + q] = m1 - m2 - m3;
+        }
+    } else {
+        LANES_LOOP{
+            float m0 = x[q], m1 = x[xs + q], m2 = x[2*xs + q];
+            float m3 = x[3*xs + q], m4 = x[4*xs + q], m5 = x[5*xs + q];
+            float a = m1 + m2, b = m1 - m2, c = m3 + m4, d = m3 - m4;
+            y[q]        = m0 + a + c;
+            y[ys + q]   = b + 2*d;
+            y[2*ys + q] = a + 4*c;
+            y[3*ys + q] = b + 8*d + m5;
+        }
+    }
+}
+
+void winograd_transform_weights(int m, float *weights, int n, int c, float *transformed)
+{
+    int t = m + 2;
+    const float *g = (m == 2) ? G2 : G4;
+    float tmp[6*3];
+    float u[6*6];
+    int f, i, x;
+    for(f = 0; f < n; ++f){
+        for(i = 0; i < c; ++i){
+            float *w = weights + (f*c + i)*9;
+            int a, b, k;
+            for(a = 0; a < t; ++a){
+                for(b = 0; b < 3; ++b){
+                    float sum = 0;
+                    for(k = 0; k < 3; ++k) sum += g[a*3 + k]*w[k*3 + b];
+                    tmp[a*3 + b] = sum;
+                }
+            }
+            for(a = 0; a < t; ++a){
+                for(b = 0; b < t; ++b){
+                    float sum = 0;
+                    for(k = 0; k < 3; ++k) sum += tmp[a*3 + k]*g[b*3 + k];
+                    u[a*t + b] = sum;
+                }
+            }
+            for(x = 0; x < t*t; ++x){
+                transformed[((size_t)x*n + f)*c + i] = u[x];
+            }
+        }
+    }
+}
+
+void winograd_conv_cpu(int m, float *transformed, int n,
+        float *im, int c, int h, int w, int pad,
+        float *workspace, float *out, gemm_epilogue *e)
+{
+    int t = m + 2;
+    int tt = t*t;
+    int out_h = h + 2*pad - 2;
+    int out_w = w + 2*pad - 2;
+    int tiles_w = winograd_tiles(m, out_w);
+    int tiles = winograd_tiles(m, out_h)*tiles_w;
+    int block = winograd_tile_block(m, out_h, out_w);
+
+    float *V = workspace;
+    float *M = workspace + (size_t)tt*c*block;
+    float d[36*WINOGRAD_LANES];
+    float tmp[36*WINOGRAD_LANES];
+    float v[36*WINOGRAD_LANES];
+
+    int p0, p, k, x, q;
+    for(p0 = 0; p0 < tiles; p0 += block){
+        int np = (tiles - p0 < block) ? tiles - p0 : block;
+
+        for(k = 0; k < c; ++k){
+            float *ch = im + (size_t)k*h*w;
+            for(p = 0; p < np; p += WINOGRAD_LANES){
+                int lanes = (np - p < WINOGRAD_LANES) ? np - p : WINOGRAD_LANES;
+                memset(d, 0, sizeof(d));
+                for(q = 0; q < lanes; ++q){
+                    int tile = p0 + p + q;
+                    int row0 = (tile / tiles_w)*m - pad;
+                    int col0 = (tile % tiles_w)*m - pad;
+                    int a, b;
+                    for(a = 0; a < t; ++a){
+                        int row = row0 + a;
+                        if(row < 0 || row >= h) continue;
+                        for(b = 0; b < t; ++b){
+                            int col = col0 + b;
+                            if(col < 0 || col >= w) continue;
+                            d[(a*t + b)*WINOGRAD_LANES + q] = ch[row*w + col];
+                        }
+                    }
+                }
+                for(x = 0; x < t; ++x) winograd_input_1d(m, d + x*WINOGRAD_LANES, t*WINOGRAD_LANES, tmp + x*WINOGRAD_LANES, t*WINOGRAD_LANES);
+                for(x = 0; x < t; ++x) winograd_input_1d(m, tmp + x*t*WINOGRAD_LANES, WINOGRAD_LANES, v + x*t*WINOGRAD_LANES, WINOGRAD_LANES);
+                for(x = 0; x < tt; ++x){
+                    memcpy(V + ((size_t)x*c + k)*block + p, v + x*WINOGRAD_LANES, lanes*sizeof(float));
+                }
+            }
+        }
+
+        for(x = 0; x < tt; ++x){
+            gemm(0,0,n,np,c,1,
+                    transformed + (size_t)x*n*c, c,
+                    V + (size_t)x*c*block, block,
+                    0,
+                    M + (size_t)x*n*block, block);
+        }
+
+        for(k = 0; k < n; ++k){
+            float *ch = out + (size_t)k*out_h*out_w;
+            for(p = 0; p < np; p += WINOGRAD_LANES){
+                int lanes = (np - p < WINOGRAD_LANES) ? np - p : WINOGRAD_LANES;
+                for(x = 0; x < tt; ++x){
+                    memcpy(d + x*WINOGRAD_LANES, M + ((size_t)x*n + k)*block + p, WINOGRAD_LANES*sizeof(float));
+                }
+                for(x = 0; x < t; ++x) winograd_output_1d(m, d + x*WINOGRAD_LANES, t*WINOGRAD_LANES, tmp + x*WINOGRAD_LANES, t*WINOGRAD_LANES);
+                for(x = 0; x < m; ++x) winograd_output_1d(m, tmp + x*t*WINOGRAD_LANES, WINOGRAD_LANES, v + x*m*WINOGRAD_LANES, WINOGRAD_LANES);
+                if(e) apply_gemm_epilogue(e, k, 1, m*m*WINOGRAD_LANES, v, 0);
+                for(q = 0; q < lanes; ++q){
+                    int tile = p0 + p + q;
+                    int row0 = (tile / tiles_w)*m;
+                    int col0 = (tile % tiles_w)*m;
+                    int a, b;
+                    for(a = 0; a < m && row0 + a < out_h; ++a){
+                        for(b = 0; b < m && col0 + b < out_w; ++b){
+                            ch[(row0 + a)*out_w + col0 + b] = v[(a*m + b)*WINOGRAD_LANES + q];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,12 @@
+#ifndef WINOGRAD_H
+#define WINOGRAD_H
+#include <stddef.h>
+#include "gemm.h"
+
+size_t winograd_workspace_size(int m, int n, int c, int out_h, int out_w);
+void winograd_transform_weights(int m, float *weights, int n, int c, float *transformed);
+void winograd_conv_cpu(int m, float *transformed, int n,
+        float *im, int c, int h, int w, int pad,
+        float *workspace, float *out, gemm_epilogue *e);
+
+#endif
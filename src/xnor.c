@@ -0,0 +1,293 @@
+#include "xnor.h"
+#include "utils.h"
+#include "parallel.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+
+// Bit-packed XNOR convolution. Inputs and weights are reduced to their
+// signs, 64 channels per word with channels laid out innermost (HWC), so a
+// k x k tap is ceil(c/64) consecutive words. For +-1 vectors
+// dot = c - 2*popcount(w ^ x), and taps that fall in the zero padding are
+// taken out again using the per-tap popcounts of the weights.
+
+#define XNOR_FILTERS 4
+#define XNOR_PIXELS 16
+#define XNOR_PIXEL_BLOCK 64
+
+// pop[f*XNOR_PIXELS + p] = popcount(w[f] ^ x[p]) for XNOR_FILTERS weight
+// rows of words each and XNOR_PIXELS input columns, word i of column p at
+// x[i*ldx + p]
+typedef void (*xnor_kernel_fn)(int words, const uint64_t *w, const uint64_t *x, int ldx, int *pop);
+
+typedef struct{
+    char *name;
+    xnor_kernel_fn kernel;
+    int (*supported)();
+} xnor_kernel;
+
+static int xnor_always_supported(){return 1;}
+
+#define XNOR_KERNEL_LOOP \
+    int i, f, p; \
+    memset(pop, 0, XNOR_FILTERS*XNOR_PIXELS*sizeof(int)); \
+    for(i = 0; i < words; ++i){ \
+        for(f = 0; f < XNOR_FILTERS; ++f){ \
+            uint64_t v = w[f*words + i]; \
+            for(p = 0; p < XNOR_PIXELS; ++p){ \
+                pop[f*XNOR_PIXELS + p] += __builtin_popcountll(v ^ x[i*ldx + p]); \
+            } \
+        } \
+    }
+
+static void xnor_kernel_generic(int words, const uint64_t *w, const uint64_t *x, int ldx, int *pop)
+{
+    XNOR_KERNEL_LOOP
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+static int xnor_popcnt_supported()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("popcnt");
+}
+
+// the generic loop with the hardware instruction instead of a libgcc call
+__attribute__((target("popcnt")))
+static void xnor_kernel_popcnt(int words, const uint64_t *w, const uint64_t *x, int ldx, int *pop)
+{
+    XNOR_KERNEL_LOOP
+}
+
+static int xnor_avx512vpopcntdq_supported()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq");
+}
+
+#define VPOPCNT_ROW(f) \
+    v = _mm512_set1_epi64(w[f*words + i]); \
+    c##f##0 = _mm512_add_epi64(c##f##0, _mm512_popcnt_epi64(_mm512_xor_si512(v, x0))); \
+    c##f##1 = _mm512_add_epi64(c##f##1, _mm512_popcnt_epi64(_mm512_xor_si512(v, x1)));
+
+#define VPOPCNT_STORE(f) \
+    _mm256_storeu_si256((__m256i *)(pop + f*XNOR_PIXELS), _mm512_cvtepi64_epi32(c##f##0)); \
+    _mm256_storeu_si256((__m256i *)(pop + f*XNOR_PIXELS + 8), _mm512_cvtepi64_epi32(c##f##1));
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static void xnor_kernel_avx512vpopcntdq(int words, const uint64_t *w, const uint64_t *x, int ldx, int *pop)
+{
+    __m512i c00 = _mm512_setzero_si512(), c01 = _mm512_setzero_si512();
+    __m512i c10 = _mm512_setzero_si512(), c11 = _mm512_setzero_si512();
+    __m512i c20 = _mm512_setzero_si512(), c21 = _mm512_setzero_si512();
+    __m512i c30 = _mm512_setzero_si512(), c31 = _mm512_setzero_si512();
+    __m512i v, x0, x1;
+    int i;
+    for(i = 0; i < words; ++i){
+        x0 = _mm512_loadu_si512(x + i*ldx);
+        x1 = _mm512_loadu_si512(x + i*ldx + 8);
+        VPOPCNT_ROW(0) VPOPCNT_ROW(1) VPOPCNT_ROW(2) VPOPCNT_ROW(3)
+    }
+    VPOPCNT_STORE(0) VPOPCNT_STORE(1) VPOPCNT_STORE(2) VPOPCNT_STORE(3)
+}
+#endif
+
+static xnor_kernel xnor_kernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+    {"avx512vpopcntdq", xnor_kernel_avx512vpopcntdq, xnor_avx512vpopcntdq_supported},
+    {"popcnt", xnor_kernel_popcnt, xnor_popcnt_supported},
+#endif
+    {"generic", xnor_kernel_generic, xnor_always_supported},
+};
+
+static xnor_kernel *xnor_selected = 0;
+static pthread_once_t xnor_select_once = PTHREAD_ONCE_INIT;
+
+static void xnor_select_kernel()
+{
+    int i;
+    int n = sizeof(xnor_kernels)/sizeof(xnor_kernels[0]);
+    char *force = getenv("DARKNET_GEMM_XNOR");
+    for(i = 0; i < n; ++i){
+        if(!xnor_kernels[i].supported()) continue;
+        if(force && strcmp(force, xnor_kernels[i].name) != 0) continue;
+        xnor_selected = xnor_kernels + i;
+        return;
+    }
+    if(force) fprintf(stderr, "XNOR kernel %s not available, using generic\n", force);
+    xnor_selected = xnor_kernels + n - 1;
+}
+
+static xnor_kernel *get_xnor_kernel()
+{
+    pthread_once(&xnor_select_once, xnor_select_kernel);
+    return xnor_selected;
+}
+
+char *xnor_kernel_name()
+{
+    return get_xnor_kernel()->name;
+}
+
+static int xnor_channel_words(int c)
+{
+    return (c + 63)/64;
+}
+
+static int xnor_row_words(int c, int size)
+{
+    return size*size*xnor_channel_words(c);
+}
+
+size_t xnor_weights_size(int n, int c, int size)
+{
+    int filters = (n + XNOR_FILTERS - 1)/XNOR_FILTERS*XNOR_FILTERS;
+    return (size_t)filters*xnor_row_words(c, size);
+}
+
+// weights are [n][c][size][size], as in l.weights. scales gets the mean
+// magnitude of each filter (see binarize_weights) and popcounts the number
+// of positive weights of every filter tap.
+void xnor_pack_weights(float *weights, int n, int c, int size, uint64_t *packed, float *scales, int *popcounts)
+{
+    int cw = xnor_channel_words(c);
+    int words = xnor_row_words(c, size);
+    int taps = size*size;
+    int f, k, t;
+    memset(packed, 0, xnor_weights_size(n, c, size)*sizeof(uint64_t));
+    for(f = 0; f < n; ++f){
+        float *w = weights + (size_t)f*c*taps;
+        uint64_t *row = packed + (size_t)f*words;
+        float mean = 0;
+        for(k = 0; k < c*taps; ++k) mean += fabs(w[k]);
+        scales[f] = mean/(c*taps);
+        for(t = 0; t < taps; ++t){
+            int count = 0;
+            for(k = 0; k < c; ++k){
+                if(w[k*taps + t] > 0){
+                    row[t*cw + k/64] |= (uint64_t)1 << (k%64);
+                    ++count;
+                }
+            }
+            popcounts[f*taps + t] = count;
+        }
+    }
+}
+
+// sign bits of a CHW float image as HWC words, positive values set
+static void xnor_pack_input(float *im, int c, int h, int w, uint64_t *packed)
+{
+    int cw = xnor_channel_words(c);
+    int k, i;
+    memset(packed, 0, (size_t)h*w*cw*sizeof(uint64_t));
+    for(k = 0; k < c; ++k){
+        float *ch = im + (size_t)k*h*w;
+        uint64_t *dst = packed + k/64;
+        int bit = k%64;
+        for(i = 0; i < h*w; ++i){
+            dst[(size_t)i*cw] |= (uint64_t)(ch[i] > 0) << bit;
+        }
+    }
+}
+
+typedef struct{
+    xnor_kernel *kernel;
+    int n;
+    uint64_t *weights;
+    float *scales;
+    int *popcounts;
+    uint64_t *bits;
+    int c, h, w, size, stride, pad;
+    int out_w, outputs;
+    float *out;
+} xnor_conv_args;
+
+static void xnor_conv_blocks(void *ptr, int begin, int end)
+{
+    xnor_conv_args *a = ptr;
+    int n = a->n, c = a->c, h = a->h, w = a->w, size = a->size;
+    int stride = a->stride, pad = a->pad, out_w = a->out_w, outputs = a->outputs;
+    int cw = xnor_channel_words(c);
+    int words = xnor_row_words(c, size);
+    int taps = size*size;
+    uint64_t all = (taps == 64) ? ~(uint64_t)0 : ((uint64_t)1 << taps) - 1;
+    // bit im2col, word i of pixel p at col[i*XNOR_PIXEL_BLOCK + p]
+    uint64_t *col = calloc((size_t)words*XNOR_PIXEL_BLOCK, sizeof(uint64_t));
+    int block;
+    for(block = begin; block < end; ++block){
+        int p0 = block*XNOR_PIXEL_BLOCK;
+        int np = (outputs - p0 < XNOR_PIXEL_BLOCK) ? outputs - p0 : XNOR_PIXEL_BLOCK;
+        // bitmask of the taps that fall inside the image, per pixel
+        uint64_t valid[XNOR_PIXEL_BLOCK];
+        int pop[XNOR_FILTERS*XNOR_PIXELS];
+        int p, pp, f, t, q;
+        for(p = 0; p < np; ++p){
+            int oh = (p0 + p) / out_w;
+            int ow = (p0 + p) % out_w;
+            valid[p] = 0;
+            for(t = 0; t < taps; ++t){
+                int ih = oh*stride - pad + t/size;
+                int iw = ow*stride - pad + t%size;
+                uint64_t *dst = col + (size_t)t*cw*XNOR_PIXEL_BLOCK + p;
+                if(ih < 0 || ih >= h || iw < 0 || iw >= w){
+                    for(q = 0; q < cw; ++q) dst[q*XNOR_PIXEL_BLOCK] = 0;
+                    continue;
+                }
+                uint64_t *src = a->bits + ((size_t)ih*w + iw)*cw;
+                for(q = 0; q < cw; ++q) dst[q*XNOR_PIXEL_BLOCK] = src[q];
+                valid[p] |= (uint64_t)1 << t;
+            }
+        }
+        for(f = 0; f < n; f += XNOR_FILTERS){
+            for(pp = 0; pp < np; pp += XNOR_PIXELS){
+                a->kernel->kernel(words, a->weights + (size_t)f*words, col + pp, XNOR_PIXEL_BLOCK, pop);
+                for(q = 0; q < XNOR_FILTERS && f + q < n; ++q){
+                    float *o = a->out + (size_t)(f + q)*outputs + p0;
+                    for(p = pp; p < pp + XNOR_PIXELS && p < np; ++p){
+                        int mismatches = pop[q*XNOR_PIXELS + p - pp];
+                        if(valid[p] != all){
+                            // padded taps were compared against zero words
+                            for(t = 0; t < taps; ++t){
+                                if(!(valid[p] & ((uint64_t)1 << t))) mismatches -= a->popcounts[(f + q)*taps + t];
+                            }
+                        }
+                        o[p] = a->scales[f + q]*(__builtin_popcountll(valid[p])*c - 2*mismatches);
+                    }
+                }
+            }
+        }
+    }
+    free(col);
+}
+
+void xnor_conv_cpu(int n, uint64_t *weights, float *scales, int *popcounts,
+        float *im, int c, int h, int w, int size, int stride, int pad,
+        float *out, gemm_epilogue *e)
+{
+    xnor_conv_args a = {0};
+    a.kernel = get_xnor_kernel();
+    a.n = n;
+    a.weights = weights;
+    a.scales = scales;
+    a.popcounts = popcounts;
+    a.c = c;
+    a.h = h;
+    a.w = w;
+    a.size = size;
+    a.stride = stride;
+    a.pad = pad;
+    a.out_w = (w + 2*pad - size)/stride + 1;
+    a.outputs = ((h + 2*pad - size)/stride + 1)*a.out_w;
+    a.out = out;
+
+    a.bits = calloc((size_t)h*w*xnor_channel_words(c), sizeof(uint64_t));
+    xnor_pack_input(im, c, h, w, a.bits);
+
+    int blocks = (a.outputs + XNOR_PIXEL_BLOCK - 1)/XNOR_PIXEL_BLOCK;
+    parallel_for(blocks, parallel_grain((n + 1)*XNOR_PIXEL_BLOCK), xnor_conv_blocks, &a);
+    free(a.bits);
+    if(e) apply_gemm_epilogue(e, 0, n, a.outputs, out, a.outputs);
+}
@@ -0,0 +1,14 @@
+#ifndef XNOR_H
+#define XNOR_H
+#include <stddef.h>
+#include <stdint.h>
+#include "gemm.h"
+
+size_t xnor_weights_size(int n, int c, int size);
+void xnor_pack_weights(float *weights, int n, int c, int size, uint64_t *packed, float *scales, int *popcounts);
+void xnor_conv_cpu(int n, uint64_t *weights, float *scales, int *popcounts,
+        float *im, int c, int h, int w, int size, int stride, int pad,
+        float *out, gemm_epilogue *e);
+char *xnor_kernel_name();
+
+#endif
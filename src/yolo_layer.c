@@ -6,11 +6,13 @@
 #include "utils.h"
 
 #include <stdio.h>
+#include <math.h>
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
 
-layer make_yolo_layer(int batch, int w, int h, int n, int total, int *mask, int classes)
+layer make_yolo_layer(int batch, int w, int h, int n, int total, int *mask, int classes, int inference)
 {
     int i;
     layer l = {0};
@@ -35,11 +37,11 @@ layer make_yolo_layer(int batch, int w, int h, int n, int total, int *mask, int
             l.mask[i] = i;
         }
     }
-    l.bias_updates = calloc(n*2, sizeof(float));
+    if(!inference) l.bias_updates = calloc(n*2, sizeof(float));
     l.outputs = h*w*n*(classes + 4 + 1);
     l.inputs = l.outputs;
     l.truths = 90*(4 + 1);
-    l.delta = calloc(batch*l.outputs, sizeof(float));
+    if(!inference) l.delta = calloc(batch*l.outputs, sizeof(float));
     l.output = calloc(batch*l.outputs, sizeof(float));
     for(i = 0; i < total*2; ++i){
         l.biases[i] = .5;
@@ -70,7 +72,7 @@ void resize_yolo_layer(layer *l, int w, int h)
     l->outputs = h*w*l->n*(l->classes + 4 + 1);
     l->inputs = l->outputs;
 
-    l->delta = realloc(l->delta, l->batch*l->outputs*sizeof(float));
+    if(l->delta) l->delta = realloc(l->delta, l->batch*l->outputs*sizeof(float));
 
 #ifdef GPU
     cuda_free(l->delta_gpu);
@@ -151,8 +153,8 @@ void forward_yolo_layer(const layer l, network net)
     }
 #endif
 
-    memset(l.delta, 0, l.outputs * l.batch * sizeof(float));
     if(!net.train) return;
+    memset(l.delta, 0, l.outputs * l.batch * sizeof(float));
     float avg_iou = 0;
     float recall = 0;
     float recall75 = 0;
@@ -278,14 +280,26 @@ void correct_yolo_boxes(detection *dets, int n, int w, int h, int netw, int neth
     }
 }
 
-int yolo_num_detections(layer l, float thresh)
+// Detections are found in one pass over the objectness planes, a block of
+// cells at a time: anchors whose objectness clears the threshold leave
+// their location (n*l.w*l.h + cell) in a compact list, in cell then anchor
+// order, and only those get their box and classes decoded.
+
+#define YOLO_CANDIDATES 4096
+
+// obj points at the objectness of the first cell for anchor 0, the planes
+// of the other anchors follow stride floats apart. Returns the number of
+// candidates, only counting them when candidates is 0.
+typedef int (*yolo_filter_fn)(float *obj, int stride, int anchors, int cells, float thresh, int location, int wh, int *candidates);
+
+static int yolo_filter_generic(float *obj, int stride, int anchors, int cells, float thresh, int location, int wh, int *candidates)
 {
-    int i, n;
+    int k, n;
     int count = 0;
-    for (i = 0; i < l.w*l.h; ++i){
-        for(n = 0; n < l.n; ++n){
-            int obj_index  = entry_index(l, 0, n*l.w*l.h + i, 4);
-            if(l.output[obj_index] > thresh){
+    for(k = 0; k < cells; ++k){
+        for(n = 0; n < anchors; ++n){
+            if(obj[n*stride + k] > thresh){
+                if(candidates) candidates[count] = n*wh + location + k;
                 ++count;
             }
         }
@@ -293,6 +307,96 @@ int yolo_num_detections(layer l, float thresh)
     return count;
 }
 
+#define YOLO_FILTER_ANCHORS 32
+
+// one bit per cell and anchor from the SIMD compare, emitted in order
+#define YOLO_FILTER_EMIT \
+    if(!any) continue; \
+    if(!candidates){ \
+        for(n = 0; n < anchors; ++n) count += __builtin_popcount(masks[n]); \
+        continue; \
+    } \
+    while(any){ \
+        int b = __builtin_ctz(any); \
+        any &= any - 1; \
+        for(n = 0; n < anchors; ++n){ \
+            if(masks[n] >> b & 1) candidates[count++] = n*wh + location + k + b; \
+        } \
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__((target("avx")))
+static int yolo_filter_avx(float *obj, int stride, int anchors, int cells, float thresh, int location, int wh, int *candidates)
+{
+    if(anchors > YOLO_FILTER_ANCHORS) return yolo_filter_generic(obj, stride, anchors, cells, thresh, location, wh, candidates);
+    __m256 t = _mm256_set1_ps(thresh);
+    unsigned masks[YOLO_FILTER_ANCHORS];
+    int k, n;
+    int count = 0;
+    for(k = 0; k + 8 <= cells; k += 8){
+        unsigned any = 0;
+        for(n = 0; n < anchors; ++n){
+            masks[n] = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(obj + n*stride + k), t, _CMP_GT_OQ));
+            any |= masks[n];
+        }
+        YOLO_FILTER_EMIT
+    }
+    return count + yolo_filter_generic(obj + k, stride, anchors, cells - k, thresh, location + k, wh, candidates ? candidates + count : 0);
+}
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+
+static int yolo_filter_neon(float *obj, int stride, int anchors, int cells, float thresh, int location, int wh, int *candidates)
+{
+    if(anchors > YOLO_FILTER_ANCHORS) return yolo_filter_generic(obj, stride, anchors, cells, thresh, location, wh, candidates);
+    float32x4_t t = vdupq_n_f32(thresh);
+    uint32x4_t bits = {1, 2, 4, 8};
+    unsigned masks[YOLO_FILTER_ANCHORS];
+    int k, n;
+    int count = 0;
+    for(k = 0; k + 4 <= cells; k += 4){
+        unsigned any = 0;
+        for(n = 0; n < anchors; ++n){
+            masks[n] = vaddvq_u32(vandq_u32(vcgtq_f32(vld1q_f32(obj + n*stride + k), t), bits));
+            any |= masks[n];
+        }
+        YOLO_FILTER_EMIT
+    }
+    return count + yolo_filter_generic(obj + k, stride, anchors, cells - k, thresh, location + k, wh, candidates ? candidates + count : 0);
+}
+#endif
+
+static yolo_filter_fn yolo_filter = yolo_filter_generic;
+static pthread_once_t yolo_filter_once = PTHREAD_ONCE_INIT;
+
+static void select_yolo_filter()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx")) yolo_filter = yolo_filter_avx;
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    yolo_filter = yolo_filter_neon;
+#endif
+}
+
+// Candidates among cells [i, i + cells) of image 0
+static int yolo_candidates(layer l, int i, int cells, float thresh, int *candidates)
+{
+    pthread_once(&yolo_filter_once, select_yolo_filter);
+    float *obj = l.output + entry_index(l, 0, i, 4);
+    return yolo_filter(obj, l.w*l.h*(4 + l.classes + 1), l.n, cells, thresh, i, l.w*l.h, candidates);
+}
+
+int yolo_num_detections(layer l, float thresh)
+{
+    return yolo_candidates(l, 0, l.w*l.h, thresh, 0);
+}
+
 void avg_flipped_yolo(layer l)
 {
     int i,j,n,z;
@@ -319,28 +423,101 @@ void avg_flipped_yolo(layer l)
     }
 }
 
+// Zeroes all but the k largest class probabilities. Classes tied at the
+// cutoff are kept in index order, so exactly k survive (fewer if fewer are
+// nonzero).
+static void keep_top_classes(float *prob, int classes, int k)
+{
+    int j;
+    int above = 0;
+    float limit = INFINITY;
+    while(above < k){
+        float next = 0;
+        int count = 0;
+        for(j = 0; j < classes; ++j){
+            if(prob[j] < limit && prob[j] > next) next = prob[j];
+        }
+        limit = next;
+        if(next == 0) break;
+        for(j = 0; j < classes; ++j){
+            if(prob[j] == next) ++count;
+        }
+        if(above + count >= k) break;
+        above += count;
+    }
+    int ties = k - above;
+    for(j = 0; j < classes; ++j){
+        if(prob[j] > limit) continue;
+        if(prob[j] == limit && prob[j] > 0 && ties > 0) --ties;
+        else prob[j] = 0;
+    }
+}
+
+static int check_top_classes(float *prob, int classes, int k, float *expected)
+{
+    int j;
+    float *p = calloc(classes, sizeof(float));
+    memcpy(p, prob, classes*sizeof(float));
+    keep_top_classes(p, classes, k);
+    int ok = memcmp(p, expected, classes*sizeof(float)) == 0;
+    if(!ok){
+        fprintf(stderr, "top %d of", k);
+        for(j = 0; j < classes; ++j) fprintf(stderr, " %g", prob[j]);
+        fprintf(stderr, " kept");
+        for(j = 0; j < classes; ++j) fprintf(stderr, " %g", p[j]);
+        fprintf(stderr, "\n");
+    }
+    free(p);
+    return ok;
+}
+
+void test_yolo_layer()
+{
+    int ok = 1;
+    float tied[] = {.5, .9, .9};
+    float tied_2[] = {0, .9, .9};
+    float tied_1[] = {0, .9, 0};
+    ok &= check_top_classes(tied, 3, 2, tied_2);
+    ok &= check_top_classes(tied, 3, 1, tied_1);
+    float cut[] = {.3, .7, .3, .1, .3};
+    float cut_2[] = {.3, .7, 0, 0, 0};
+    float cut_3[] = {.3, .7, .3, 0, 0};
+    float cut_4[] = {.3, .7, .3, 0, .3};
+    ok &= check_top_classes(cut, 5, 2, cut_2);
+    ok &= check_top_classes(cut, 5, 3, cut_3);
+    ok &= check_top_classes(cut, 5, 4, cut_4);
+    float sparse[] = {0, .4, 0, .2};
+    ok &= check_top_classes(sparse, 4, 3, sparse);
+    fprintf(stderr, "keep_top_classes: %s\n", ok ? "ok" : "FAILED");
+}
+
 int get_yolo_detections(layer l, int w, int h, int netw, int neth, float thresh, int *map, int relative, detection *dets)
 {
-    int i,j,n;
+    int i,j,k;
     float *predictions = l.output;
-    if (l.batch == 2) avg_flipped_yolo(l);
     int count = 0;
-    for (i = 0; i < l.w*l.h; ++i){
-        int row = i / l.w;
-        int col = i % l.w;
-        for(n = 0; n < l.n; ++n){
-            int obj_index  = entry_index(l, 0, n*l.w*l.h + i, 4);
-            float objectness = predictions[obj_index];
-            if(objectness <= thresh) continue;
-            int box_index  = entry_index(l, 0, n*l.w*l.h + i, 0);
-            dets[count].bbox = get_yolo_box(predictions, l.biases, l.mask[n], box_index, col, row, l.w, l.h, netw, neth, l.w*l.h);
+    int cells = l.w*l.h;
+    int block = YOLO_CANDIDATES/l.n;
+    int candidates[YOLO_CANDIDATES];
+    if(block < 1) error("Too many anchors in a yolo layer");
+    for (i = 0; i < cells; i += block){
+        int m = yolo_candidates(l, i, (cells - i < block) ? cells - i : block, thresh, candidates);
+        for(k = 0; k < m; ++k){
+            int location = candidates[k];
+            int n = location / cells;
+            int row = location % cells / l.w;
+            int col = location % l.w;
+            float objectness = predictions[entry_index(l, 0, location, 4)];
+            int box_index  = entry_index(l, 0, location, 0);
+            dets[count].bbox = get_yolo_box(predictions, l.biases, l.mask[n], box_index, col, row, l.w, l.h, netw, neth, cells);
             dets[count].objectness = objectness;
             dets[count].classes = l.classes;
+            float *probs = predictions + entry_index(l, 0, location, 4 + 1);
             for(j = 0; j < l.classes; ++j){
-                int class_index = entry_index(l, 0, n*l.w*l.h + i, 4 + 1 + j);
-                float prob = objectness*predictions[class_index];
+                float prob = objectness*probs[j*cells];
                 dets[count].prob[j] = (prob > thresh) ? prob : 0;
             }
+            if(l.top_classes > 0 && l.top_classes < l.classes) keep_top_classes(dets[count].prob, l.classes, l.top_classes);
             ++count;
         }
     }
@@ -5,11 +5,12 @@
 #include "layer.h"
 #include "network.h"
 
-layer make_yolo_layer(int batch, int w, int h, int n, int total, int *mask, int classes);
+layer make_yolo_layer(int batch, int w, int h, int n, int total, int *mask, int classes, int inference);
 void forward_yolo_layer(const layer l, network net);
 void backward_yolo_layer(const layer l, network net);
 void resize_yolo_layer(layer *l, int w, int h);
 int yolo_num_detections(layer l, float thresh);
+void avg_flipped_yolo(layer l);
 
 #ifdef GPU
 void forward_yolo_layer_gpu(const layer l, network net);